@@ -0,0 +1,39 @@
+#ifndef AUDIOFRAMEQUEUE_H
+#define AUDIOFRAMEQUEUE_H
+
+#include "AudioFrame.h"
+
+//Single producer (decoder thread), single consumer (audio thread) frame handoff
+//Nobody is woken, the audio thread polls every queue on its own timer
+class AudioFrameQueue
+{
+public:
+    static constexpr size_t kCapacity = 64; //More than a second of typical 20ms frames
+
+    //Producer, returns false if the queue is full and the frame is dropped
+    bool Push(const QSharedPointer<AudioFrame> &frame)
+    {
+        size_t write_index = write_index_.load(std::memory_order_relaxed);
+        if (write_index - read_index_.load(std::memory_order_acquire) >= kCapacity)
+            return false;
+        frames_[write_index % kCapacity] = frame;
+        write_index_.store(write_index + 1, std::memory_order_release);
+        return true;
+    }
+
+    //Consumer, takes every queued frame
+    void Drain(std::vector<QSharedPointer<AudioFrame>> &frames)
+    {
+        size_t read_index = read_index_.load(std::memory_order_relaxed);
+        size_t write_index = write_index_.load(std::memory_order_acquire);
+        for (; read_index != write_index; ++read_index)
+            frames.push_back(std::move(frames_[read_index % kCapacity]));
+        read_index_.store(read_index, std::memory_order_release);
+    }
+private:
+    QSharedPointer<AudioFrame> frames_[kCapacity];
+    std::atomic<size_t> write_index_{ 0 }, read_index_{ 0 };
+};
+Q_DECLARE_METATYPE(QSharedPointer<AudioFrameQueue>);
+
+#endif // AUDIOFRAMEQUEUE_H
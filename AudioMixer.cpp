@@ -0,0 +1,385 @@
+#include "pch.h"
+#include "AudioMixer.h"
+
+namespace
+{
+
+static constexpr float kQuarterPi = 0.785398163f;
+
+void MixStereo(float *out, const float *in, int frame_count, float gain_left, float gain_right)
+{
+    int i = 0;
+#ifdef QDDM_SSE2
+    __m128 gains = _mm_setr_ps(gain_left, gain_right, gain_left, gain_right);
+    for (; i + 2 <= frame_count; i += 2)
+        _mm_storeu_ps(out + i * 2, _mm_add_ps(_mm_loadu_ps(out + i * 2), _mm_mul_ps(_mm_loadu_ps(in + i * 2), gains)));
+#endif
+    for (; i < frame_count; ++i)
+    {
+        out[i * 2] += in[i * 2] * gain_left;
+        out[i * 2 + 1] += in[i * 2 + 1] * gain_right;
+    }
+}
+
+void MixMono(float *out, const float *in, int frame_count, float gain_left, float gain_right)
+{
+    int i = 0;
+#ifdef QDDM_SSE2
+    __m128 gains = _mm_setr_ps(gain_left, gain_right, gain_left, gain_right);
+    for (; i + 4 <= frame_count; i += 4)
+    {
+        __m128 samples = _mm_loadu_ps(in + i);
+        float *dest = out + i * 2;
+        _mm_storeu_ps(dest, _mm_add_ps(_mm_loadu_ps(dest), _mm_mul_ps(_mm_unpacklo_ps(samples, samples), gains)));
+        _mm_storeu_ps(dest + 4, _mm_add_ps(_mm_loadu_ps(dest + 4), _mm_mul_ps(_mm_unpackhi_ps(samples, samples), gains)));
+    }
+#endif
+    for (; i < frame_count; ++i)
+    {
+        out[i * 2] += in[i] * gain_left;
+        out[i * 2 + 1] += in[i] * gain_right;
+    }
+}
+
+}
+
+bool AudioMixer::Enabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue("QDDM_SOFTWARE_MIXER") != 0;
+    return enabled;
+}
+
+AudioMixer::AudioMixer(int sample_rate)
+    :sample_rate_(sample_rate)
+{
+}
+
+void AudioMixer::AddFrame(void *source_id, const QSharedPointer<AudioFrame> &audio_frame)
+{
+    AVFrame *frame = audio_frame->frame.Get();
+    AudioSampleRing<float>::Regions regions;
+    MixerSource *source_ptr;
+    {
+        QMutexLocker lock(&mutex_);
+        source_ptr = &GetOrCreateSource(source_id);
+        MixerSource &source = *source_ptr;
+        if (source.channels != frame->channels || source.sample_format != audio_frame->sample_format || source.sample_rate != frame->sample_rate)
+            InitSource(source, frame, audio_frame->sample_format);
+        if (!source.swr_context)
+            return;
+
+        int out_size_est = swr_get_out_samples(source.swr_context.Get(), frame->nb_samples);
+        regions = source.ring.WriteRegions();
+        if (regions.Total() < static_cast<size_t>(out_size_est) * source.out_channels)
+        {
+            //Output isn't consuming, keep what's buffered in sync instead of growing swr's internal buffer
+#ifdef _DEBUG
+            statistics_.dropped_frames += 1;
+#endif
+            return;
+        }
+
+        if (!source.starting)
+        {
+            PlaybackClock::time_point now = PlaybackClock::now();
+            if (now >= source.next_drift_correction)
+            {
+                source.next_drift_correction = now + AudioTimeline::kDriftMeasureInterval;
+                if (source.drift > AudioTimeline::kDriftResync || source.drift < -AudioTimeline::kDriftResync)
+                {
+#ifdef _DEBUG
+                    statistics_.drift_resyncs += 1;
+#endif
+                    StopSource(source);
+                    regions = source.ring.WriteRegions();
+                }
+                else
+                {
+                    AudioTimeline::CompensateDrift(source.swr_context.Get(), source.drift, sample_rate_);
+                }
+            }
+        }
+        source.timeline.Add(static_cast<int64_t>(source.ring.WriteIndex() / source.out_channels), audio_frame->present_time);
+    }
+
+    //Converted straight into the ring without the lock, samples that don't fit the first region are flushed into the second one
+    //Sources are only replaced or deleted on this thread
+    MixerSource &source = *source_ptr;
+    const uint8_t **in = (const uint8_t **)frame->data;
+    int in_size = frame->nb_samples;
+    for (int i = 0; i < 2 && regions.size[i] > 0; ++i)
+    {
+        int out_space = static_cast<int>(regions.size[i] / source.out_channels);
+        uint8_t *out[1] = { reinterpret_cast<uint8_t *>(regions.data[i]) };
+        int out_size = swr_convert(source.swr_context.Get(), out, out_space, in, in_size);
+        if (out_size < 0)
+        {
+            qCWarning(CategoryAudioPlayback, "Can't convert audio frame #%d", out_size);
+            return;
+        }
+        source.ring.Commit(static_cast<size_t>(out_size) * source.out_channels);
+        if (out_size < out_space)
+            break;
+        in = nullptr;
+        in_size = 0;
+    }
+}
+
+void AudioMixer::StopSource(void *source_id)
+{
+    QMutexLocker lock(&mutex_);
+    auto itr = sources_.find(source_id);
+    if (itr != sources_.end())
+        StopSource(*itr->second);
+}
+
+void AudioMixer::DeleteSource(void *source_id)
+{
+    QMutexLocker lock(&mutex_);
+    sources_.erase(source_id);
+}
+
+void AudioMixer::SetVolume(void *source_id, float volume)
+{
+    QMutexLocker lock(&mutex_);
+    GetOrCreateSource(source_id).volume = qBound(0.0f, volume, 1.0f);
+}
+
+void AudioMixer::SetPosition(void *source_id, const QVector3D &position)
+{
+    QMutexLocker lock(&mutex_);
+    MixerSource &source = GetOrCreateSource(source_id);
+    if (source.position.isNull() != position.isNull())
+    {
+        //Force reinit on next frame, positioned sources are mixed down to mono
+        source.sample_format = AV_SAMPLE_FMT_NONE;
+        StopSource(source);
+    }
+    source.position = position;
+}
+
+void AudioMixer::SetMute(void *source_id, bool mute)
+{
+    QMutexLocker lock(&mutex_);
+    GetOrCreateSource(source_id).muted = mute;
+}
+
+void AudioMixer::SetSolo(void *solo_source_id)
+{
+    QMutexLocker lock(&mutex_);
+    solo_source_id_ = solo_source_id;
+}
+
+void AudioMixer::Drifts(std::vector<std::pair<void *, PlaybackClock::duration>> &drifts)
+{
+    QMutexLocker lock(&mutex_);
+    for (const auto &p : sources_)
+    {
+        if (p.second->swr_context && !p.second->starting)
+            drifts.emplace_back(p.first, p.second->drift);
+    }
+}
+
+int AudioMixer::Mix(float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock)
+{
+    QMutexLocker lock(&mutex_);
+    return MixLocked(out, frame_count, output_time, align_to_clock);
+}
+
+int AudioMixer::TryMix(float *out, int frame_count, PlaybackClock::time_point output_time)
+{
+    if (!mutex_.tryLock())
+    {
+        std::fill(out, out + frame_count * kOutputChannels, 0.0f);
+#ifdef _DEBUG
+        busy_periods_.fetch_add(1, std::memory_order_relaxed);
+#endif
+        return -1;
+    }
+    int mixed = MixLocked(out, frame_count, output_time, true);
+    mutex_.unlock();
+    return mixed;
+}
+
+int AudioMixer::MixLocked(float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock)
+{
+#ifdef _DEBUG
+    PlaybackClock::time_point mix_start = PlaybackClock::now();
+#endif
+    std::fill(out, out + frame_count * kOutputChannels, 0.0f);
+    int mixed = 0;
+    for (const auto &p : sources_)
+    {
+        MixerSource &source = *p.second;
+        float gain = source.muted || (solo_source_id_ && solo_source_id_ != p.first) ? 0.0f : source.volume;
+        mixed = std::max(mixed, MixSource(source, gain, out, frame_count, output_time, align_to_clock));
+    }
+#ifdef _DEBUG
+    statistics_.mix_time += PlaybackClock::now() - mix_start;
+#endif
+    return mixed;
+}
+
+#ifdef _DEBUG
+AudioMixer::MixStatistics AudioMixer::TakeStatistics()
+{
+    QMutexLocker lock(&mutex_);
+    MixStatistics statistics = statistics_;
+    statistics_ = MixStatistics();
+    statistics.busy_periods = busy_periods_.exchange(0, std::memory_order_relaxed);
+    return statistics;
+}
+#endif
+
+void AudioMixer::ConvertToS16(int16_t *out, const float *in, size_t sample_count)
+{
+    size_t i = 0;
+#ifdef QDDM_SSE2
+    __m128 scale = _mm_set1_ps(32767.0f), lower = _mm_set1_ps(-1.0f), upper = _mm_set1_ps(1.0f);
+    for (; i + 8 <= sample_count; i += 8)
+    {
+        __m128i low = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i), lower), upper), scale));
+        __m128i high = _mm_cvtps_epi32(_mm_mul_ps(_mm_min_ps(_mm_max_ps(_mm_loadu_ps(in + i + 4), lower), upper), scale));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i), _mm_packs_epi32(low, high));
+    }
+#endif
+    for (; i < sample_count; ++i)
+        out[i] = static_cast<int16_t>(std::lrint(qBound(-1.0f, in[i], 1.0f) * 32767.0f));
+}
+
+AudioMixer::MixerSource &AudioMixer::GetOrCreateSource(void *source_id)
+{
+    std::unique_ptr<MixerSource> &source = sources_[source_id];
+    if (!source)
+        source = std::make_unique<MixerSource>();
+    return *source;
+}
+
+void AudioMixer::InitSource(MixerSource &source, const AVFrame *frame, AVSampleFormat sample_format)
+{
+    source.channels = frame->channels;
+    source.sample_format = sample_format;
+    source.sample_rate = frame->sample_rate;
+    source.out_channels = source.position.isNull() ? kOutputChannels : 1;
+
+    int64_t channel_layout = frame->channel_layout ? frame->channel_layout : av_get_default_channel_layout(frame->channels);
+    source.swr_context = swr_alloc_set_opts(nullptr,
+                                            source.out_channels == 1 ? AV_CH_LAYOUT_MONO : AV_CH_LAYOUT_STEREO, AV_SAMPLE_FMT_FLT, sample_rate_,
+                                            channel_layout,                                                     sample_format,     frame->sample_rate,
+                                            0, nullptr);
+    if (source.swr_context && swr_init(source.swr_context.Get()) < 0)
+        source.swr_context = nullptr;
+    if (!source.swr_context)
+        qCWarning(CategoryAudioPlayback, "Can't convert audio source to the mixer format");
+
+    //Only reallocated when the format changes
+    size_t capacity = static_cast<size_t>(sample_rate_) * kSourceBufferMS / 1000 * source.out_channels;
+    if (source.ring.Capacity() != capacity)
+        source.ring.Reset(capacity);
+    StopSource(source);
+}
+
+void AudioMixer::StopSource(MixerSource &source)
+{
+    source.ring.Clear();
+    source.timeline.Clear();
+    source.starting = true;
+    source.drift = PlaybackClock::duration::zero();
+    if (source.swr_context)
+        swr_init(source.swr_context.Get()); //Drop buffered samples
+}
+
+int AudioMixer::MixSource(MixerSource &source, float gain, float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock)
+{
+    if (!source.swr_context)
+        return 0;
+    const size_t channels = source.out_channels;
+    int64_t available = static_cast<int64_t>(source.ring.Size() / channels);
+    if (available == 0)
+    {
+        source.starting = true;
+        return 0;
+    }
+#ifdef _DEBUG
+    statistics_.buffered_frames += available;
+    statistics_.buffer_measurements += 1;
+#endif
+
+    PlaybackClock::time_point read_time = output_time;
+    bool timed = source.timeline.PresentTime(static_cast<int64_t>(source.ring.ReadIndex() / channels), sample_rate_, read_time);
+    int offset = 0;
+    if (!align_to_clock)
+    {
+        source.starting = false;
+    }
+    else if (source.starting)
+    {
+        //Aligns the first sample with its present time, later samples follow contiguously
+        int64_t lead = DurationToFrames(read_time - output_time);
+        if (lead >= frame_count)
+            return 0;
+        if (lead > 0)
+        {
+            offset = static_cast<int>(lead);
+        }
+        else if (lead < 0)
+        {
+            int64_t skip = std::min(-lead, available);
+            source.ring.Consume(static_cast<size_t>(skip) * channels);
+            available -= skip;
+#ifdef _DEBUG
+            statistics_.late_starts += 1;
+#endif
+            if (available == 0)
+                return 0;
+        }
+        source.starting = false;
+    }
+    else if (timed)
+    {
+        source.drift = output_time - read_time;
+    }
+
+    int count = static_cast<int>(std::min<int64_t>(frame_count - offset, available));
+    if (gain > 0.0f)
+    {
+        float gain_left, gain_right;
+        PanGains(source, gain, gain_left, gain_right);
+        AudioSampleRing<float>::Regions regions = source.ring.ReadRegions();
+        int mixed = 0;
+        for (int i = 0; i < 2 && mixed < count; ++i)
+        {
+            int region_count = std::min(static_cast<int>(regions.size[i] / channels), count - mixed);
+            float *dest = out + static_cast<size_t>(offset + mixed) * kOutputChannels;
+            if (channels == 1)
+                MixMono(dest, regions.data[i], region_count, gain_left, gain_right);
+            else
+                MixStereo(dest, regions.data[i], region_count, gain_left, gain_right);
+            mixed += region_count;
+        }
+    }
+    source.ring.Consume(static_cast<size_t>(count) * channels);
+    if (offset + count < frame_count)
+        source.starting = true; //Underrun, realign with the next frame
+#ifdef _DEBUG
+    statistics_.source_frames_mixed += count;
+#endif
+    return offset + count;
+}
+
+void AudioMixer::PanGains(const MixerSource &source, float gain, float &gain_left, float &gain_right)
+{
+    gain_left = gain_right = gain;
+    if (source.position.isNull())
+        return;
+    //Equal-power pan by the horizontal direction of position
+    float pan = qBound(-1.0f, source.position.x() / source.position.length(), 1.0f);
+    float angle = (pan + 1.0f) * kQuarterPi;
+    gain_left *= std::cos(angle);
+    gain_right *= std::sin(angle);
+}
+
+int64_t AudioMixer::DurationToFrames(PlaybackClock::duration duration) const
+{
+    return std::llround(std::chrono::duration<double>(duration).count() * sample_rate_);
+}
@@ -0,0 +1,106 @@
+#ifndef AUDIOMIXER_H
+#define AUDIOMIXER_H
+
+#include "AudioFrame.h"
+#include "AudioSampleRing.h"
+#include "AudioTimeline.h"
+
+Q_DECLARE_LOGGING_CATEGORY(CategoryAudioPlayback)
+
+//Mixes every source into one interleaved float32 stereo stream at the output rate
+//Each source is resampled once into its own ring, gain, mute, solo and panning are applied while mixing
+//Mix may run on an output thread, it only waits for the short sections that change sources, never for conversion
+//Device callbacks use TryMix instead, since those sections can allocate when a source changes format
+class AudioMixer
+{
+    struct SwrContextReleaseFunctor
+    {
+        void operator()(SwrContext **object) const { swr_free(object); }
+    };
+    using SwrContextObject = AVObjectBase<SwrContext, SwrContextReleaseFunctor>;
+
+    struct MixerSource
+    {
+        AVSampleFormat sample_format = AV_SAMPLE_FMT_NONE;
+        int channels = 0, sample_rate = 0;
+        SwrContextObject swr_context;
+
+        //Mono while positioned, panned into the stereo output
+        int out_channels = 0;
+        AudioSampleRing<float> ring;
+        //Ring frame indices to present times, the first sample is aligned whenever starting and later ones follow contiguously
+        AudioTimeline timeline;
+        bool starting = true;
+        //Heard time minus present time at the read position, measured while mixing and worked off by swr on the next frames
+        PlaybackClock::duration drift = PlaybackClock::duration::zero();
+        PlaybackClock::time_point next_drift_correction;
+
+        float volume = 1.0f;
+        QVector3D position;
+        bool muted = false;
+    };
+public:
+    static constexpr int kOutputChannels = 2;
+    static constexpr int kSourceBufferMS = 1000;
+
+#ifdef _DEBUG
+    struct MixStatistics
+    {
+        PlaybackClock::duration mix_time = PlaybackClock::duration::zero();
+        int64_t source_frames_mixed = 0;
+        int64_t buffered_frames = 0; //Summed over buffer_measurements
+        int buffer_measurements = 0, dropped_frames = 0, late_starts = 0, drift_resyncs = 0, busy_periods = 0;
+    };
+#endif
+
+    //Only with QDDM_SOFTWARE_MIXER=1
+    static bool Enabled();
+
+    explicit AudioMixer(int sample_rate);
+
+    int SampleRate() const { return sample_rate_; }
+
+    void AddFrame(void *source_id, const QSharedPointer<AudioFrame> &audio_frame);
+    void StopSource(void *source_id);
+    void DeleteSource(void *source_id);
+    void SetVolume(void *source_id, float volume);
+    void SetPosition(void *source_id, const QVector3D &position);
+    void SetMute(void *source_id, bool mute);
+    void SetSolo(void *solo_source_id);
+    //Drift of every playing source
+    void Drifts(std::vector<std::pair<void *, PlaybackClock::duration>> &drifts);
+
+    //Fills frame_count interleaved frames, output_time is when the first of them is heard
+    //Without align_to_clock sources are mixed from whatever they have buffered, for outputs on a virtual clock that can't be compared with present times
+    //Returns the most frames taken from any source
+    int Mix(float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock = true);
+    //Never blocks, fills silence and returns -1 if the sources are being changed
+    int TryMix(float *out, int frame_count, PlaybackClock::time_point output_time);
+#ifdef _DEBUG
+    MixStatistics TakeStatistics();
+#endif
+
+    //Interleaved float32 to S16 with saturation
+    static void ConvertToS16(int16_t *out, const float *in, size_t sample_count);
+private:
+    MixerSource &GetOrCreateSource(void *source_id);
+    void InitSource(MixerSource &source, const AVFrame *frame, AVSampleFormat sample_format);
+    static void StopSource(MixerSource &source);
+    int MixLocked(float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock);
+    int MixSource(MixerSource &source, float gain, float *out, int frame_count, PlaybackClock::time_point output_time, bool align_to_clock);
+    static void PanGains(const MixerSource &source, float gain, float &gain_left, float &gain_right);
+
+    int64_t DurationToFrames(PlaybackClock::duration duration) const;
+
+    int sample_rate_;
+    QMutex mutex_; //Guards sources_ except the producer side of rings
+    std::unordered_map<void *, std::unique_ptr<MixerSource>> sources_;
+    void *solo_source_id_ = nullptr;
+
+#ifdef _DEBUG
+    MixStatistics statistics_;
+    std::atomic<int> busy_periods_{ 0 }; //Counted without the lock by TryMix
+#endif
+};
+
+#endif // AUDIOMIXER_H
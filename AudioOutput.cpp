@@ -1,10 +1,118 @@
 #include "pch.h"
 #include "AudioOutput.h"
 
+#include "AudioMixer.h"
+#include "AudioSink.h"
+
 Q_LOGGING_CATEGORY(CategoryAudioPlayback, "qddm.audio")
 
 static constexpr auto kFallbackLatencyAssumption = std::chrono::milliseconds(60);
 static constexpr int kBufferBlockSizeMS = 50;
+static constexpr int kQueueDrainIntervalMS = 10;
+static constexpr int kMixerPeriodMS = 20;
+static constexpr int kMixerPullPeriodMS = 5;
+static constexpr int kMixerFallbackSampleRate = 48000;
+
+namespace
+{
+
+template <typename SampleType>
+void InterleavePlanes(SampleType *out, const uint8_t *const *planes, int offset, int begin, int end, int channels)
+{
+    for (int c = 0; c < channels; ++c)
+    {
+        const SampleType *plane = reinterpret_cast<const SampleType *>(planes[c]) + offset;
+        for (int i = begin; i < end; ++i)
+            out[i * channels + c] = plane[i];
+    }
+}
+
+void InterleaveFloat(float *out, const uint8_t *const *planes, int offset, int frame_count, int channels)
+{
+    int i = 0;
+#ifdef QDDM_SSE2
+    if (channels == 2)
+    {
+        const float *left = reinterpret_cast<const float *>(planes[0]) + offset, *right = reinterpret_cast<const float *>(planes[1]) + offset;
+        for (; i + 4 <= frame_count; i += 4)
+        {
+            __m128 l = _mm_loadu_ps(left + i), r = _mm_loadu_ps(right + i);
+            _mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(l, r));
+            _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(l, r));
+        }
+    }
+#endif
+    InterleavePlanes(out, planes, offset, i, frame_count, channels);
+}
+
+void InterleaveS16(int16_t *out, const uint8_t *const *planes, int offset, int frame_count, int channels)
+{
+    int i = 0;
+#ifdef QDDM_SSE2
+    if (channels == 2)
+    {
+        const int16_t *left = reinterpret_cast<const int16_t *>(planes[0]) + offset, *right = reinterpret_cast<const int16_t *>(planes[1]) + offset;
+        for (; i + 8 <= frame_count; i += 8)
+        {
+            __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i *>(left + i)), r = _mm_loadu_si128(reinterpret_cast<const __m128i *>(right + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2), _mm_unpacklo_epi16(l, r));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(out + i * 2 + 8), _mm_unpackhi_epi16(l, r));
+        }
+    }
+#endif
+    InterleavePlanes(out, planes, offset, i, frame_count, channels);
+}
+
+//Multichannel formats from AL_EXT_MCFORMATS take the WAVE channel order, which these FFmpeg layouts follow
+bool IsWaveOrderLayout(int64_t channel_layout)
+{
+    switch (channel_layout)
+    {
+    case AV_CH_LAYOUT_QUAD:
+    case AV_CH_LAYOUT_5POINT1:
+    case AV_CH_LAYOUT_5POINT1_BACK:
+    case AV_CH_LAYOUT_6POINT1:
+    case AV_CH_LAYOUT_7POINT1:
+        return true;
+    default:
+        return false;
+    }
+}
+
+ALenum BufferFormat(int channels, AVSampleFormat sample_format)
+{
+    static const struct
+    {
+        int channels;
+        ALenum u8, s16, flt;
+    } kFormats[] = {
+        { 1, AL_FORMAT_MONO8, AL_FORMAT_MONO16, AL_FORMAT_MONO_FLOAT32 },
+        { 2, AL_FORMAT_STEREO8, AL_FORMAT_STEREO16, AL_FORMAT_STEREO_FLOAT32 },
+        { 4, AL_FORMAT_QUAD8, AL_FORMAT_QUAD16, AL_FORMAT_QUAD32 },
+        { 6, AL_FORMAT_51CHN8, AL_FORMAT_51CHN16, AL_FORMAT_51CHN32 },
+        { 7, AL_FORMAT_61CHN8, AL_FORMAT_61CHN16, AL_FORMAT_61CHN32 },
+        { 8, AL_FORMAT_71CHN8, AL_FORMAT_71CHN16, AL_FORMAT_71CHN32 },
+    };
+    for (const auto &format : kFormats)
+    {
+        if (format.channels != channels)
+            continue;
+        switch (sample_format)
+        {
+        case AV_SAMPLE_FMT_U8:
+            return format.u8;
+        case AV_SAMPLE_FMT_S16:
+            return format.s16;
+        case AV_SAMPLE_FMT_FLT:
+            return format.flt;
+        default:
+            return AL_NONE;
+        }
+    }
+    return AL_NONE;
+}
+
+}
 
 AudioOutput::AudioSource::AudioSource()
 {
@@ -41,22 +149,63 @@ AudioOutput::AudioSource::~AudioSource()
     alDeleteBuffers(al_buffer_free_count, al_buffer_free);
 }
 
+static bool PullOutputEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue("QDDM_AUDIO_PULL") != 0;
+    return enabled;
+}
+
 AudioOutput::AudioOutput(QObject *parent)
     :QObject(parent)
 {
-    device_ = alcOpenDevice(nullptr);
-    Q_ASSERT(device_);
-    context_ = alcCreateContext(device_, nullptr);
-    Q_ASSERT(context_);
-    alcMakeContextCurrent(context_);
-    alGetError();
+    bool pull_output = PullOutputEnabled();
+    QByteArray sink_name = qgetenv("QDDM_AUDIO_SINK");
+    if (sink_name.isEmpty())
+    {
+        device_ = alcOpenDevice(nullptr);
+        //Pulled output asks OpenAL to mix in short updates so the callback is invoked with small periods
+        const ALCint pull_attributes[] = { ALC_REFRESH, 1000 / kMixerPullPeriodMS, 0 };
+        if (device_)
+            context_ = alcCreateContext(device_, pull_output ? pull_attributes : nullptr);
+        if (!context_)
+        {
+            if (device_)
+                alcCloseDevice(device_);
+            device_ = nullptr;
+            qCWarning(CategoryAudioPlayback, "Can't open audio device, mixing into the null sink");
+            sink_name = "null";
+        }
+    }
+    if (context_)
+    {
+        alcMakeContextCurrent(context_);
+        alGetError();
+
+        alGetSourcei64vSOFT = (LPALGETSOURCEI64VSOFT)alGetProcAddress("alGetSourcei64vSOFT");
+        float_output_ = alIsExtensionPresent("AL_EXT_FLOAT32");
+        multichannel_output_ = alIsExtensionPresent("AL_EXT_MCFORMATS");
+    }
 
-    alGetSourcei64vSOFT = (LPALGETSOURCEI64VSOFT)alGetProcAddress("alGetSourcei64vSOFT");
+    drain_timer_ = new QTimer(this);
+    drain_timer_->setTimerType(Qt::PreciseTimer);
+    drain_timer_->setInterval(kQueueDrainIntervalMS);
+    connect(drain_timer_, &QTimer::timeout, this, &AudioOutput::OnDrainTick);
+
+    sync_timer_ = new QTimer(this);
+    sync_timer_->setInterval(AudioTimeline::kDriftMeasureInterval);
+    connect(sync_timer_, &QTimer::timeout, this, &AudioOutput::OnSyncTick);
+    sync_timer_->start();
+
+    //Pulled and headless output need the mixer
+    bool mixing = context_ ? (AudioMixer::Enabled() || pull_output) && InitMixerOutput(pull_output) : InitSinkOutput(sink_name);
+    if (mixing)
+        drain_timer_->start(); //Also paces or measures the mixer output, restarted in the audio thread by moveToThread
 }
 
 AudioOutput::~AudioOutput()
 {
     sources_.clear();
+    ReleaseMixerOutput();
     if (context_)
     {
         alcMakeContextCurrent(nullptr);
@@ -70,6 +219,8 @@ AudioOutput::~AudioOutput()
 
 void AudioOutput::onNewAudioSource(void *source_id, const AVCodecContext *context)
 {
+    if (mixer_)
+        return; //Set up from the first frame
     std::shared_ptr<AudioSource> new_source;
     try
     {
@@ -92,6 +243,11 @@ void AudioOutput::onNewAudioSource(void *source_id, const AVCodecContext *contex
 
 void AudioOutput::onStopAudioSource(void *source_id)
 {
+    if (mixer_)
+    {
+        mixer_->StopSource(source_id);
+        return;
+    }
     auto itr = sources_.find(source_id);
     if (itr == sources_.end())
         return;
@@ -101,6 +257,9 @@ void AudioOutput::onStopAudioSource(void *source_id)
 
 void AudioOutput::onDeleteAudioSource(void *source_id)
 {
+    onSetAudioSourceQueue(source_id, nullptr);
+    if (mixer_)
+        mixer_->DeleteSource(source_id);
     auto itr = sources_.find(source_id);
     if (itr == sources_.end())
         return;
@@ -113,6 +272,12 @@ void AudioOutput::onDeleteAudioSource(void *source_id)
 
 void AudioOutput::onNewAudioFrame(void *source_id, const QSharedPointer<AudioFrame> &audio_frame)
 {
+    if (mixer_)
+    {
+        mixer_->AddFrame(source_id, audio_frame);
+        return;
+    }
+
     AudioSource *source;
 
     auto itr = sources_.find(source_id);
@@ -162,34 +327,137 @@ void AudioOutput::onNewAudioFrame(void *source_id, const QSharedPointer<AudioFra
         StartSource(itr->second, audio_frame->present_time);
     }
 
+#ifdef _DEBUG
+    PlaybackClock::time_point staging_start = PlaybackClock::now();
+#endif
     CollectExhaustedBuffer(*source);
-
+    bool staged = AppendFrameToSourceBuffer(*source, audio_frame);
     AppendBufferToSource(*source);
-    while (source->buffer_block.size() < source->buffer_block_cap && !source->pending_frames.empty())
+#ifdef _DEBUG
+    staging_time_ += PlaybackClock::now() - staging_start;
+    if (staged)
+        staged_frames_ += 1;
+    else
+        dropped_frames_ += 1;
+#else
+    Q_UNUSED(staged);
+#endif
+}
+
+void AudioOutput::onSetAudioSourceQueue(void *source_id, const QSharedPointer<AudioFrameQueue> &queue)
+{
+    if (queue)
+        frame_queues_[source_id] = queue;
+    else
+        frame_queues_.erase(source_id);
+
+    if (frame_queues_.empty() && !mixer_)
+        drain_timer_->stop();
+    else if (!drain_timer_->isActive())
+        drain_timer_->start();
+}
+
+void AudioOutput::OnDrainTick()
+{
+    for (const auto &p : frame_queues_)
     {
-        AppendFrameToSourceBuffer(*source, source->pending_frames.front());
-        source->pending_frames.erase(source->pending_frames.begin());
-        if (source->buffer_block.size() >= source->buffer_block_cap)
-        {
-            AppendBufferToSource(*source);
-        }
+        p.second->Drain(drained_frames_);
+        for (const auto &audio_frame : drained_frames_)
+            onNewAudioFrame(p.first, audio_frame);
+        drained_frames_.clear();
     }
-    if (source->buffer_block.size() < source->buffer_block_cap)
+    if (mixer_)
     {
-        AppendFrameToSourceBuffer(*source, audio_frame);
-        if (source->buffer_block.size() >= source->buffer_block_cap)
+        if (mixer_output_mode_ == MixerOutputPush)
+            FillMixerOutput();
+        else if (mixer_output_mode_ == MixerOutputCallback)
+            MeasureMixerCallbackLatency();
+#ifdef _DEBUG
+        ReportMixerStatistics();
+#endif
+    }
+}
+
+void AudioOutput::OnSyncTick()
+{
+    //Played position against the present times of the samples, drift is worked off by resampling instead of restarting
+    for (const auto &p : sources_)
+    {
+        AudioSource &source = *p.second;
+        if (source.starting || source.stopping)
+            continue;
+        ALint source_state = AL_STOPPED;
+        alGetSourcei(source.al_id, AL_SOURCE_STATE, &source_state);
+        if (source_state != AL_PLAYING)
+            continue;
+        CollectExhaustedBuffer(source); //Sample offsets count from the first buffer still queued
+        PlaybackClock::duration drift;
+        if (!MeasureDrift(source, drift))
+            continue;
+
+        source.drift = drift;
+        if (drift > AudioTimeline::kDriftResync || drift < -AudioTimeline::kDriftResync)
         {
-            AppendBufferToSource(*source);
+            qCDebug(CategoryAudioPlayback) << "Resynchronizing audio source " << source.al_id << " drifted by " << std::chrono::duration_cast<std::chrono::milliseconds>(drift).count() << "ms";
+            StopSource(source);
         }
+        else if (source.swr_context || ((drift > AudioTimeline::kDriftTolerance || drift < -AudioTimeline::kDriftTolerance) && InitResampler(source)))
+        {
+            AudioTimeline::CompensateDrift(source.swr_context.Get(), drift, source.sample_rate);
+        }
+        emit audioSourceDriftChanged(p.first, std::chrono::duration<qreal, std::milli>(source.drift).count());
+    }
+
+    if (mixer_)
+    {
+        mixer_->Drifts(mixer_drifts_);
+        for (const auto &p : mixer_drifts_)
+            emit audioSourceDriftChanged(p.first, std::chrono::duration<qreal, std::milli>(p.second).count());
+        mixer_drifts_.clear();
+    }
+#ifdef _DEBUG
+    ReportStagingStatistics();
+#endif
+}
+
+bool AudioOutput::MeasureDrift(AudioSource &source, PlaybackClock::duration &drift)
+{
+    PlaybackClock::time_point now = PlaybackClock::now();
+    int64_t played_offset = 0;
+    std::chrono::nanoseconds latency = kFallbackLatencyAssumption;
+    if (alGetSourcei64vSOFT)
+    {
+        ALint64SOFT offset_latency[2];
+        alGetSourcei64vSOFT(source.al_id, AL_SAMPLE_OFFSET_LATENCY_SOFT, offset_latency);
+        if (alGetError() != AL_NO_ERROR)
+            return false;
+        played_offset = offset_latency[0] >> 32;
+        latency = std::chrono::nanoseconds(offset_latency[1]);
     }
     else
     {
-        source->pending_frames.push_back(std::move(audio_frame));
+        ALint offset = 0;
+        alGetSourcei(source.al_id, AL_SAMPLE_OFFSET, &offset);
+        if (alGetError() != AL_NO_ERROR)
+            return false;
+        played_offset = offset;
     }
+
+    PlaybackClock::time_point present_time;
+    if (!source.timeline.PresentTime(source.samples_played + played_offset, source.sample_rate, present_time))
+        return false;
+    drift = now + latency - present_time;
+    return true;
 }
 
 void AudioOutput::onSetAudioSourceVolume(void *source_id, qreal volume)
 {
+    if (mixer_)
+    {
+        mixer_->SetVolume(source_id, static_cast<float>(volume));
+        return;
+    }
+
     AudioSource *source = GetOrCreateSource(source_id);
 
     if (volume < 0)
@@ -201,8 +469,6 @@ void AudioOutput::onSetAudioSourceVolume(void *source_id, qreal volume)
 
 void AudioOutput::onSetAudioSourcePosition(void *source_id, QVector3D position)
 {
-    AudioSource *source = GetOrCreateSource(source_id);
-
     if (!std::isfinite(position.x()))
         position.setX(0);
     if (!std::isfinite(position.y()))
@@ -210,6 +476,13 @@ void AudioOutput::onSetAudioSourcePosition(void *source_id, QVector3D position)
     if (!std::isfinite(position.z()))
         position.setZ(0);
 
+    if (mixer_)
+    {
+        mixer_->SetPosition(source_id, position);
+        return;
+    }
+    AudioSource *source = GetOrCreateSource(source_id);
+
     if (position.isNull())
     {
         if (source->force_mono)
@@ -241,6 +514,12 @@ void AudioOutput::onSetAudioSourcePosition(void *source_id, QVector3D position)
 
 void AudioOutput::onSetAudioSourceMute(void *source_id, bool mute)
 {
+    if (mixer_)
+    {
+        mixer_->SetMute(source_id, mute);
+        return;
+    }
+
     AudioSource *source = GetOrCreateSource(source_id);
 
     source->muted = mute;
@@ -266,6 +545,8 @@ void AudioOutput::onSetAudioSourceSolo(void *source_id, bool solo)
                     alSourcef(source->al_id, AL_MAX_GAIN, 0.0f);
                 }
             }
+            if (mixer_)
+                mixer_->SetSolo(solo_source_id_);
             emit soloAudioSourceChanged(source_id);
         }
     }
@@ -279,6 +560,8 @@ void AudioOutput::onSetAudioSourceSolo(void *source_id, bool solo)
                 AudioSource *source = p.second.get();
                 alSourcef(source->al_id, AL_MAX_GAIN, source->muted ? 0.0f : 1.0f);
             }
+            if (mixer_)
+                mixer_->SetSolo(nullptr);
             emit soloAudioSourceChanged(nullptr);
         }
     }
@@ -298,72 +581,57 @@ void AudioOutput::InitSource(AudioSource &source, int channels, int64_t channel_
     source.sample_format = sample_fmt;
     source.sample_rate = sample_rate;
 
-    int out_channels = 0;
-    AVSampleFormat out_sample_format = AV_SAMPLE_FMT_NONE;
+    source.channel_layout = channel_layout ? channel_layout : av_get_default_channel_layout(channels);
 
+    int out_channels = 0;
     if (source.force_mono)
-    {
         out_channels = 1;
-    }
+    else if (channels == 1 || channels == 2 || (multichannel_output_ && IsWaveOrderLayout(source.channel_layout)))
+        out_channels = channels;
     else
-    {
-        switch (channels)
-        {
-        case 1:
-        case 2:
-            out_channels = channels;
-            break;
-        default:
-            out_channels = 2;
-            break;
-        }
-    }
-    switch (sample_fmt)
-    {
-    case AV_SAMPLE_FMT_U8:
-    case AV_SAMPLE_FMT_S16:
-        out_sample_format = sample_fmt;
-        break;
-    default:
-        out_sample_format = AV_SAMPLE_FMT_S16;
-        break;
-    }
+        out_channels = 2;
 
-    if (out_channels != channels || out_sample_format != sample_fmt)
-    {
-        int64_t out_channel_layout;
-        if (out_channels == 2)
-        {
-            out_channel_layout = AV_CH_LAYOUT_STEREO;
-        }
-        else
-        {
-            out_channel_layout = AV_CH_LAYOUT_MONO;
-        }
-        source.swr_context = swr_alloc_set_opts(nullptr,
-                                                out_channel_layout, out_sample_format, sample_rate,
-                                                channel_layout,     sample_fmt,        sample_rate,
-                                                0, nullptr);
-        swr_init(source.swr_context.Get());
-    }
-    if (out_sample_format == AV_SAMPLE_FMT_S16)
-    {
-        source.sample_channel_size = sizeof(uint16_t) * out_channels;
-        if (out_channels == 2)
-            source.al_buffer_format = AL_FORMAT_STEREO16;
-        else //Q_ASSERT(out_channels == 1)
-            source.al_buffer_format = AL_FORMAT_MONO16;
-    }
-    else //Q_ASSERT(out_sample_format == AV_SAMPLE_FMT_U8)
-    {
-        source.sample_channel_size = sizeof(int8_t) * out_channels;
-        if (out_channels == 2)
-            source.al_buffer_format = AL_FORMAT_STEREO8;
-        else //Q_ASSERT(out_channels == 1)
-            source.al_buffer_format = AL_FORMAT_MONO8;
-    }
+    //Interleaved float is taken as is if OpenAL accepts it, integers wider than 16 bits as well as doubles are converted to it
+    AVSampleFormat out_sample_format = av_get_packed_sample_fmt(sample_fmt);
+    if (out_sample_format != AV_SAMPLE_FMT_U8 && out_sample_format != AV_SAMPLE_FMT_S16 && !(out_sample_format == AV_SAMPLE_FMT_FLT && float_output_))
+        out_sample_format = float_output_ ? AV_SAMPLE_FMT_FLT : AV_SAMPLE_FMT_S16;
+
+    if (out_channels == channels)
+        source.out_channel_layout = source.channel_layout;
+    else if (out_channels == 2)
+        source.out_channel_layout = AV_CH_LAYOUT_STEREO;
+    else
+        source.out_channel_layout = AV_CH_LAYOUT_MONO;
+    source.out_sample_format = out_sample_format;
+    source.swr_context = nullptr;
+    source.resample = out_channels != channels || out_sample_format != av_get_packed_sample_fmt(sample_fmt);
+    //Mono planar is already interleaved
+    source.interleave = !source.resample && av_sample_fmt_is_planar(sample_fmt) && channels > 1;
+    if (source.resample)
+        InitResampler(source);
+    source.sample_channel_size = av_get_bytes_per_sample(out_sample_format) * out_channels;
+    source.al_buffer_format = BufferFormat(out_channels, out_sample_format);
+    Q_ASSERT(source.al_buffer_format != AL_NONE);
 
     source.buffer_block_cap = source.sample_rate * kBufferBlockSizeMS / 1000 * source.sample_channel_size;
+    //Only reallocated when the format changes
+    if (source.buffer_ring.Capacity() != source.buffer_block_cap * AudioSource::kRingBlockCount)
+        source.buffer_ring.Reset(source.buffer_block_cap * AudioSource::kRingBlockCount);
+}
+
+bool AudioOutput::InitResampler(AudioSource &source)
+{
+    source.swr_context = swr_alloc_set_opts(nullptr,
+                                            source.out_channel_layout, source.out_sample_format, source.sample_rate,
+                                            source.channel_layout,     source.sample_format,     source.sample_rate,
+                                            0, nullptr);
+    if (!source.swr_context || swr_init(source.swr_context.Get()) < 0)
+    {
+        qCWarning(CategoryAudioPlayback, "Can't initialize audio resampler");
+        source.swr_context = nullptr;
+        return false;
+    }
+    return true;
 }
 
 AudioOutput::AudioSource *AudioOutput::GetOrCreateSource(void *source_id)
@@ -474,35 +742,92 @@ void AudioOutput::StartSource(const std::shared_ptr<AudioSource> &source, Playba
     }
 }
 
-void AudioOutput::AppendFrameToSourceBuffer(AudioSource &source, const QSharedPointer<AudioFrame> &audio_frame)
+bool AudioOutput::AppendFrameToSourceBuffer(AudioSource &source, const QSharedPointer<AudioFrame> &audio_frame)
 {
+    if (source.buffer_block_cap == 0)
+        return false;
+    AudioSampleRing<uint8_t>::Regions regions = source.buffer_ring.WriteRegions();
+    int in_size = audio_frame->frame->nb_samples;
+    int out_size_est = source.swr_context ? swr_get_out_samples(source.swr_context.Get(), in_size) : in_size;
+    if (regions.Total() < static_cast<size_t>(out_size_est) * source.sample_channel_size)
+        return false; //Every OpenAL buffer and the whole ring are full
+
+    source.timeline.Add(source.samples_written, audio_frame->present_time);
+#ifdef _DEBUG
+    PlaybackClock::time_point conversion_start = PlaybackClock::now();
+    source.converted_samples += in_size;
+#endif
     if (source.swr_context)
     {
-        int in_size = audio_frame->frame->nb_samples;
-        int out_size_est = swr_get_out_samples(source.swr_context.Get(), in_size);
-        size_t out_offset = source.buffer_block.size();
-        source.buffer_block.resize(out_offset + out_size_est * source.sample_channel_size);
-        uint8_t *out[1] = { source.buffer_block.data() + out_offset };
-        int out_size = swr_convert(source.swr_context.Get(), out, out_size_est, (const uint8_t **)audio_frame->frame->data, in_size);
-        Q_ASSERT(out_size >= 0);
-        source.buffer_block.resize(out_offset + out_size * source.sample_channel_size);
+        //Converted straight into the ring, samples that don't fit the first region are flushed into the second one
+        const uint8_t **in = (const uint8_t **)audio_frame->frame->data;
+        for (int i = 0; i < 2 && regions.size[i] > 0; ++i)
+        {
+            int out_space = static_cast<int>(regions.size[i] / source.sample_channel_size);
+            uint8_t *out[1] = { regions.data[i] };
+            int out_size = swr_convert(source.swr_context.Get(), out, out_space, in, in_size);
+            Q_ASSERT(out_size >= 0);
+            source.buffer_ring.Commit(static_cast<size_t>(out_size) * source.sample_channel_size);
+            source.samples_written += out_size;
+            if (out_size < out_space)
+                break;
+            in = nullptr;
+            in_size = 0;
+        }
+    }
+    else if (source.interleave)
+    {
+        //Regions always end on a whole sample frame
+        int first_size = std::min(in_size, static_cast<int>(regions.size[0] / source.sample_channel_size));
+        InterleaveSamples(source, regions.data[0], audio_frame->frame.Get(), 0, first_size);
+        if (first_size < in_size)
+            InterleaveSamples(source, regions.data[1], audio_frame->frame.Get(), first_size, in_size - first_size);
+        source.buffer_ring.Commit(static_cast<size_t>(in_size) * source.sample_channel_size);
+        source.samples_written += in_size;
     }
     else
     {
-        int in_size_in_bytes = audio_frame->frame->nb_samples * source.sample_channel_size;
-        size_t out_offset = source.buffer_block.size();
-        source.buffer_block.resize(out_offset + in_size_in_bytes);
-        memcpy(source.buffer_block.data() + out_offset, audio_frame->frame->data[0], in_size_in_bytes);
+        const uint8_t *in = audio_frame->frame->data[0];
+        size_t in_size_in_bytes = static_cast<size_t>(in_size) * source.sample_channel_size;
+        size_t first_size = std::min(in_size_in_bytes, regions.size[0]);
+        memcpy(regions.data[0], in, first_size);
+        if (first_size < in_size_in_bytes)
+            memcpy(regions.data[1], in + first_size, in_size_in_bytes - first_size);
+        source.buffer_ring.Commit(in_size_in_bytes);
+        source.samples_written += in_size;
+    }
+#ifdef _DEBUG
+    source.conversion_time += PlaybackClock::now() - conversion_start;
+#endif
+    return true;
+}
+
+void AudioOutput::InterleaveSamples(const AudioSource &source, uint8_t *out, const AVFrame *frame, int offset, int count)
+{
+    const uint8_t *const *planes = frame->extended_data;
+    switch (source.out_sample_format)
+    {
+    case AV_SAMPLE_FMT_FLT:
+        InterleaveFloat(reinterpret_cast<float *>(out), planes, offset, count, source.channels);
+        break;
+    case AV_SAMPLE_FMT_S16:
+        InterleaveS16(reinterpret_cast<int16_t *>(out), planes, offset, count, source.channels);
+        break;
+    default: //Q_ASSERT(source.out_sample_format == AV_SAMPLE_FMT_U8)
+        InterleavePlanes(out, planes, offset, 0, count, source.channels);
+        break;
     }
 }
 
 void AudioOutput::AppendBufferToSource(AudioSource &source)
 {
-    while (source.buffer_block.size() >= source.buffer_block_cap && source.al_buffer_free_count > 0)
+    while (source.buffer_ring.Size() >= source.buffer_block_cap && source.al_buffer_free_count > 0)
     {
         ALenum ret = AL_NO_ERROR;
         ALBufferId buffer_id = source.al_buffer_free[source.al_buffer_free_count - 1];
-        alBufferData(buffer_id, source.al_buffer_format, source.buffer_block.data(), source.buffer_block_cap, source.sample_rate);
+        AudioSampleRing<uint8_t>::Regions regions = source.buffer_ring.ReadRegions();
+        Q_ASSERT(regions.size[0] >= source.buffer_block_cap);
+        alBufferData(buffer_id, source.al_buffer_format, regions.data[0], static_cast<ALsizei>(source.buffer_block_cap), source.sample_rate);
         if ((ret = alGetError()) != AL_NO_ERROR)
         {
             qCWarning(CategoryAudioPlayback, "Can't specify OpenAL buffer content #%d", ret);
@@ -516,7 +841,7 @@ void AudioOutput::AppendBufferToSource(AudioSource &source)
         }
         --source.al_buffer_free_count;
         source.al_buffer_occupied[source.al_buffer_occupied_count++] = buffer_id;
-        source.buffer_block.erase(source.buffer_block.begin(), source.buffer_block.begin() + source.buffer_block_cap);
+        source.buffer_ring.Consume(source.buffer_block_cap);
     }
 }
 
@@ -563,15 +888,364 @@ void AudioOutput::CollectExhaustedBuffer(AudioSource &source)
 
         source.al_buffer_free_count = after;
         source.al_buffer_occupied_count = p;
+        source.samples_played += static_cast<int64_t>(buffers_processed) * (source.buffer_block_cap / source.sample_channel_size);
         Q_ASSERT(source.al_buffer_occupied_count + source.al_buffer_free_count == AudioSource::kALBufferCount);
     }
 }
 
 void AudioOutput::StopSource(AudioOutput::AudioSource &source)
 {
-    source.pending_frames.clear();
-    source.buffer_block.clear();
+    source.buffer_ring.Rewind();
     source.starting = false;
     alSourceStop(source.al_id);
     CollectExhaustedBuffer(source);
+    if (!source.resample)
+        source.swr_context = nullptr; //Only created for drift compensation, recreated if it's needed again
+    else if (source.swr_context)
+        swr_init(source.swr_context.Get()); //Drop buffered samples and compensation
+    source.timeline.Clear();
+    source.samples_written = source.samples_played = 0;
+    source.drift = PlaybackClock::duration::zero();
+}
+
+bool AudioOutput::InitMixerOutput(bool pull)
+{
+    ALCint sample_rate = 0;
+    alcGetIntegerv(device_, ALC_FREQUENCY, 1, &sample_rate);
+    if (alcGetError(device_) != ALC_NO_ERROR || sample_rate <= 0)
+        sample_rate = kMixerFallbackSampleRate;
+
+    ALenum ret = AL_NO_ERROR;
+    alGenSources(1, &mixer_al_id_);
+    if ((ret = alGetError()) != AL_NO_ERROR)
+    {
+        qCWarning(CategoryAudioPlayback, "Can't create mixer output source #%d", ret);
+        mixer_al_id_ = 0;
+        return false;
+    }
+    alGenBuffers(kMixerALBufferCount, mixer_al_buffer_free_);
+    if ((ret = alGetError()) != AL_NO_ERROR)
+    {
+        qCWarning(CategoryAudioPlayback, "Can't create mixer output buffers #%d", ret);
+        alDeleteSources(1, &mixer_al_id_);
+        mixer_al_id_ = 0;
+        return false;
+    }
+    mixer_al_buffer_free_count_ = kMixerALBufferCount;
+    alSourcei(mixer_al_id_, AL_SOURCE_RELATIVE, AL_TRUE);
+    alSourcef(mixer_al_id_, AL_ROLLOFF_FACTOR, 0);
+
+    mixer_ = std::make_unique<AudioMixer>(sample_rate);
+    mixer_output_float_ = float_output_;
+    mixer_output_latency_ns_.store(std::chrono::nanoseconds(kFallbackLatencyAssumption).count(), std::memory_order_relaxed);
+    mixer_output_mode_ = MixerOutputPush;
+    int period_ms = kMixerPeriodMS;
+    if (pull)
+    {
+        period_ms = kMixerPullPeriodMS;
+#ifdef AL_SOFT_callback_buffer
+        LPALBUFFERCALLBACKSOFT alBufferCallbackSOFT = (LPALBUFFERCALLBACKSOFT)alGetProcAddress("alBufferCallbackSOFT");
+        if (alIsExtensionPresent("AL_SOFT_callback_buffer") && alBufferCallbackSOFT)
+        {
+            ALBufferId buffer_id = mixer_al_buffer_free_[0];
+            alBufferCallbackSOFT(buffer_id, mixer_output_float_ ? AL_FORMAT_STEREO_FLOAT32 : AL_FORMAT_STEREO16, sample_rate, &AudioOutput::MixerCallback, this);
+            alSourcei(mixer_al_id_, AL_BUFFER, buffer_id);
+            if ((ret = alGetError()) == AL_NO_ERROR)
+                mixer_output_mode_ = MixerOutputCallback;
+            else
+                qCWarning(CategoryAudioPlayback, "Can't set mixer output callback #%d", ret);
+        }
+#endif
+        if (mixer_output_mode_ != MixerOutputCallback)
+            mixer_output_mode_ = MixerOutputThread;
+    }
+    mixer_period_frames_ = sample_rate * period_ms / 1000;
+    mixer_block_.resize(static_cast<size_t>(mixer_period_frames_) * AudioMixer::kOutputChannels);
+    if (!mixer_output_float_)
+        mixer_block_s16_.resize(mixer_block_.size());
+
+    switch (mixer_output_mode_)
+    {
+    case MixerOutputCallback:
+        alSourcePlay(mixer_al_id_);
+        if ((ret = alGetError()) != AL_NO_ERROR)
+        {
+            qCCritical(CategoryAudioPlayback, "Can't start mixer output #%d", ret);
+        }
+        break;
+    case MixerOutputThread:
+        mixer_thread_ = QThread::create([this]()
+        {
+            while (!mixer_thread_stop_.load(std::memory_order_relaxed))
+            {
+                FillMixerOutput();
+                QThread::usleep(kMixerPullPeriodMS * 1000 / 2);
+            }
+        });
+        mixer_thread_->start(QThread::TimeCriticalPriority);
+        break;
+    default:
+        break;
+    }
+    qCDebug(CategoryAudioPlayback) << "Mixing in software at " << sample_rate << "Hz, " << (mixer_output_float_ ? "float32" : "s16") << " output " << (mixer_output_mode_ == MixerOutputCallback ? "pulled by callback" : mixer_output_mode_ == MixerOutputThread ? "fed by thread" : "pushed") << " in " << period_ms << "ms periods";
+    return true;
+}
+
+void AudioOutput::ReleaseMixerOutput()
+{
+    if (mixer_thread_)
+    {
+        mixer_thread_stop_.store(true, std::memory_order_relaxed);
+        mixer_thread_->wait();
+        delete mixer_thread_;
+        mixer_thread_ = nullptr;
+    }
+    if (sink_)
+    {
+        sink_.reset(); //Finishes the file of the wav sink
+        mixer_.reset();
+    }
+    if (!mixer_al_id_)
+        return;
+    alSourceStop(mixer_al_id_);
+    alSourceUnqueueBuffers(mixer_al_id_, mixer_al_buffer_occupied_count_, mixer_al_buffer_occupied_);
+    alDeleteSources(1, &mixer_al_id_); //Detaches the callback buffer too
+    alDeleteBuffers(mixer_al_buffer_occupied_count_, mixer_al_buffer_occupied_);
+    alDeleteBuffers(mixer_al_buffer_free_count_, mixer_al_buffer_free_);
+    mixer_al_id_ = 0;
+    mixer_al_buffer_occupied_count_ = mixer_al_buffer_free_count_ = 0;
+    mixer_.reset();
+}
+
+void AudioOutput::FillMixerOutput()
+{
+    ALenum ret = AL_NO_ERROR;
+    ALint buffers_processed = 0;
+    alGetSourcei(mixer_al_id_, AL_BUFFERS_PROCESSED, &buffers_processed);
+    if (alGetError() == AL_NO_ERROR && buffers_processed > 0)
+    {
+        //Buffers finish in queue order
+        alSourceUnqueueBuffers(mixer_al_id_, buffers_processed, mixer_al_buffer_free_ + mixer_al_buffer_free_count_);
+        if ((ret = alGetError()) != AL_NO_ERROR)
+        {
+            qCWarning(CategoryAudioPlayback, "Can't unqueue mixer output buffer #%d", ret);
+            return;
+        }
+        mixer_al_buffer_free_count_ += buffers_processed;
+        mixer_al_buffer_occupied_count_ -= buffers_processed;
+        std::copy(mixer_al_buffer_occupied_ + buffers_processed, mixer_al_buffer_occupied_ + buffers_processed + mixer_al_buffer_occupied_count_, mixer_al_buffer_occupied_);
+    }
+    if (mixer_al_buffer_free_count_ == 0)
+        return;
+
+    PlaybackClock::time_point output_time = MixerOutputTime();
+    mixer_output_latency_ns_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(output_time - PlaybackClock::now()).count(), std::memory_order_relaxed);
+    auto period = std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds(static_cast<int64_t>(mixer_period_frames_) * 1000000000 / mixer_->SampleRate()));
+    while (mixer_al_buffer_free_count_ > 0)
+    {
+        mixer_->Mix(mixer_block_.data(), mixer_period_frames_, output_time);
+
+        ALBufferId buffer_id = mixer_al_buffer_free_[mixer_al_buffer_free_count_ - 1];
+        if (mixer_output_float_)
+        {
+            alBufferData(buffer_id, AL_FORMAT_STEREO_FLOAT32, mixer_block_.data(), static_cast<ALsizei>(mixer_block_.size() * sizeof(float)), mixer_->SampleRate());
+        }
+        else
+        {
+            AudioMixer::ConvertToS16(mixer_block_s16_.data(), mixer_block_.data(), mixer_block_.size());
+            alBufferData(buffer_id, AL_FORMAT_STEREO16, mixer_block_s16_.data(), static_cast<ALsizei>(mixer_block_s16_.size() * sizeof(int16_t)), mixer_->SampleRate());
+        }
+        if ((ret = alGetError()) != AL_NO_ERROR)
+        {
+            qCWarning(CategoryAudioPlayback, "Can't specify mixer output buffer content #%d", ret);
+            break;
+        }
+        alSourceQueueBuffers(mixer_al_id_, 1, &buffer_id);
+        if ((ret = alGetError()) != AL_NO_ERROR)
+        {
+            qCWarning(CategoryAudioPlayback, "Can't append buffer to mixer output #%d", ret);
+            break;
+        }
+        --mixer_al_buffer_free_count_;
+        mixer_al_buffer_occupied_[mixer_al_buffer_occupied_count_++] = buffer_id;
+        output_time += period;
+    }
+
+    //First fill, or every buffer ran out
+    ALint source_state = AL_STOPPED;
+    alGetSourcei(mixer_al_id_, AL_SOURCE_STATE, &source_state);
+    if (source_state != AL_PLAYING && mixer_al_buffer_occupied_count_ > 0)
+    {
+        alSourcePlay(mixer_al_id_);
+        if ((ret = alGetError()) != AL_NO_ERROR)
+        {
+            qCCritical(CategoryAudioPlayback, "Can't start mixer output #%d", ret);
+        }
+    }
+}
+
+PlaybackClock::time_point AudioOutput::MixerOutputTime()
+{
+    //When the first sample queued next is heard
+    PlaybackClock::time_point now = PlaybackClock::now();
+    ALint source_state = AL_STOPPED;
+    alGetSourcei(mixer_al_id_, AL_SOURCE_STATE, &source_state);
+    if (source_state != AL_PLAYING || mixer_al_buffer_occupied_count_ == 0)
+        return now + kFallbackLatencyAssumption;
+
+    int64_t queued_frames = static_cast<int64_t>(mixer_al_buffer_occupied_count_) * mixer_period_frames_;
+    int64_t played_frames = 0;
+    std::chrono::nanoseconds latency = kFallbackLatencyAssumption;
+    if (alGetSourcei64vSOFT)
+    {
+        ALint64SOFT offset_latency[2];
+        alGetSourcei64vSOFT(mixer_al_id_, AL_SAMPLE_OFFSET_LATENCY_SOFT, offset_latency);
+        if (alGetError() == AL_NO_ERROR)
+        {
+            played_frames = offset_latency[0] >> 32;
+            latency = std::chrono::nanoseconds(offset_latency[1]);
+        }
+    }
+    else
+    {
+        ALint offset = 0;
+        alGetSourcei(mixer_al_id_, AL_SAMPLE_OFFSET, &offset);
+        if (alGetError() == AL_NO_ERROR)
+            played_frames = offset;
+    }
+    return now + latency + std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds((queued_frames - played_frames) * 1000000000 / mixer_->SampleRate()));
+}
+
+bool AudioOutput::InitSinkOutput(const QByteArray &sink_name)
+{
+    mixer_ = std::make_unique<AudioMixer>(kMixerFallbackSampleRate);
+    sink_ = AudioSink::Create(sink_name, mixer_->SampleRate(), AudioMixer::kOutputChannels);
+    mixer_output_mode_ = MixerOutputSink;
+    mixer_output_float_ = true;
+    mixer_period_frames_ = mixer_->SampleRate() * kMixerPeriodMS / 1000;
+    mixer_block_.resize(static_cast<size_t>(mixer_period_frames_) * AudioMixer::kOutputChannels);
+    //Each period is mixed one period ahead of when it counts as heard
+    mixer_output_latency_ns_.store(sink_->RealTime() ? static_cast<int64_t>(kMixerPeriodMS) * 1000000 : 0, std::memory_order_relaxed);
+
+    mixer_thread_ = QThread::create([this]() { RunSinkOutput(); });
+    mixer_thread_->start(sink_->RealTime() ? QThread::TimeCriticalPriority : QThread::NormalPriority);
+    qCDebug(CategoryAudioPlayback) << "Mixing in software at " << mixer_->SampleRate() << "Hz into the " << sink_->Name() << " audio sink in " << kMixerPeriodMS << "ms periods";
+    return true;
+}
+
+void AudioOutput::RunSinkOutput()
+{
+    //Without pacing the clock is virtual and runs ahead of every present time, so sources aren't aligned to it
+    //Whatever they have buffered is mixed as fast as it arrives and only what was taken is written and advances the clock
+    const bool real_time = sink_->RealTime();
+    const auto period = std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds(static_cast<int64_t>(mixer_period_frames_) * 1000000000 / mixer_->SampleRate()));
+    PlaybackClock::time_point output_time = PlaybackClock::now() + period;
+    while (!mixer_thread_stop_.load(std::memory_order_relaxed))
+    {
+        if (!real_time)
+        {
+            int mixed = mixer_->Mix(mixer_block_.data(), mixer_period_frames_, output_time, false);
+            if (mixed == 0)
+            {
+                QThread::msleep(1); //Nothing buffered, wait for the decoders instead of spinning
+                continue;
+            }
+            sink_->Write(mixer_block_.data(), mixed);
+            output_time += std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds(static_cast<int64_t>(mixed) * 1000000000 / mixer_->SampleRate()));
+            continue;
+        }
+        mixer_->Mix(mixer_block_.data(), mixer_period_frames_, output_time);
+        sink_->Write(mixer_block_.data(), mixer_period_frames_);
+        output_time += period;
+        PlaybackClock::time_point now = PlaybackClock::now();
+        if (now > output_time)
+            output_time = now + period; //Fell behind like a device underrun, skip instead of catching up
+        else if (output_time - now > period)
+            QThread::usleep(static_cast<unsigned long>(std::chrono::duration_cast<std::chrono::microseconds>(output_time - now - period).count()));
+    }
+}
+
+void AudioOutput::MeasureMixerCallbackLatency()
+{
+    //Callback data is mixed by OpenAL right away, so it's heard after the device latency
+    if (!alGetSourcei64vSOFT)
+        return;
+    ALint64SOFT offset_latency[2];
+    alGetSourcei64vSOFT(mixer_al_id_, AL_SAMPLE_OFFSET_LATENCY_SOFT, offset_latency);
+    if (alGetError() == AL_NO_ERROR)
+        mixer_output_latency_ns_.store(offset_latency[1], std::memory_order_relaxed);
+}
+
+#ifdef AL_SOFT_callback_buffer
+ALsizei AL_APIENTRY AudioOutput::MixerCallback(ALvoid *userptr, ALvoid *sampledata, ALsizei numbytes) noexcept
+{
+    return static_cast<AudioOutput *>(userptr)->PullMixerOutput(sampledata, numbytes);
+}
+
+ALsizei AudioOutput::PullMixerOutput(void *data, ALsizei byte_count)
+{
+    //Runs on OpenAL's mixing thread, no AL calls, no allocations and no waiting on the mixer lock
+    const int frame_bytes = AudioMixer::kOutputChannels * (mixer_output_float_ ? sizeof(float) : sizeof(int16_t));
+    const int frame_count = byte_count / frame_bytes;
+    PlaybackClock::time_point output_time = PlaybackClock::now() + std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds(mixer_output_latency_ns_.load(std::memory_order_relaxed)));
+    for (int mixed = 0; mixed < frame_count;)
+    {
+        int count = std::min(mixer_period_frames_, frame_count - mixed);
+        size_t offset = static_cast<size_t>(mixed) * AudioMixer::kOutputChannels;
+        if (mixer_output_float_)
+        {
+            mixer_->TryMix(static_cast<float *>(data) + offset, count, output_time);
+        }
+        else
+        {
+            mixer_->TryMix(mixer_block_.data(), count, output_time);
+            AudioMixer::ConvertToS16(static_cast<int16_t *>(data) + offset, mixer_block_.data(), static_cast<size_t>(count) * AudioMixer::kOutputChannels);
+        }
+        output_time += std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds(static_cast<int64_t>(count) * 1000000000 / mixer_->SampleRate()));
+        mixed += count;
+    }
+    return frame_count * frame_bytes;
+}
+#endif
+
+#ifdef _DEBUG
+void AudioOutput::ReportMixerStatistics()
+{
+    PlaybackClock::time_point now = PlaybackClock::now();
+    if (now - last_debug_report_ <= std::chrono::seconds(1))
+        return;
+    last_debug_report_ = now;
+    AudioMixer::MixStatistics statistics = mixer_->TakeStatistics();
+    //Cost of mixing one second of one source, and how long a sample waits from arriving at this thread until it's heard
+    if (statistics.source_frames_mixed > 0)
+        qCDebug(CategoryAudioPlayback) << "Mixing cost: " << (double)std::chrono::duration_cast<std::chrono::nanoseconds>(statistics.mix_time).count() * mixer_->SampleRate() / statistics.source_frames_mixed / 1000 << "us per source second";
+    qCDebug(CategoryAudioPlayback) << "Mixer output latency: " << mixer_output_latency_ns_.load(std::memory_order_relaxed) / 1000000 << "ms"
+                                   << ", source buffering: " << (statistics.buffer_measurements > 0 ? statistics.buffered_frames * 1000 / mixer_->SampleRate() / statistics.buffer_measurements : 0ll) << "ms"
+                                   << ", dropped frames: " << statistics.dropped_frames << ", late starts: " << statistics.late_starts << ", drift resyncs: " << statistics.drift_resyncs << ", busy periods: " << statistics.busy_periods;
+}
+
+void AudioOutput::ReportStagingStatistics()
+{
+    PlaybackClock::time_point now = PlaybackClock::now();
+    if (now - last_staging_report_ <= std::chrono::seconds(1))
+        return;
+    last_staging_report_ = now;
+    //Converting a frame into the ring and queueing whole blocks, summed over every source
+    if (staged_frames_ > 0)
+        qCDebug(CategoryAudioPlayback) << "Staging cost: " << (double)std::chrono::duration_cast<std::chrono::nanoseconds>(staging_time_).count() / staged_frames_ / 1000 << "us per frame"
+                                       << ", " << staged_frames_ << " frames staged, " << dropped_frames_ << " dropped";
+    staging_time_ = PlaybackClock::duration::zero();
+    staged_frames_ = dropped_frames_ = 0;
+
+    //Conversion alone, per source since it depends on the format each one arrives in
+    for (const auto &p : sources_)
+    {
+        AudioSource &source = *p.second;
+        if (source.converted_samples > 0)
+            qCDebug(CategoryAudioPlayback) << "Conversion cost of audio source " << source.al_id << " (" << (source.swr_context ? "swr" : source.interleave ? "interleave" : "copy") << "): "
+                                           << (double)std::chrono::duration_cast<std::chrono::nanoseconds>(source.conversion_time).count() * source.sample_rate / source.converted_samples / 1000 << "us per source second";
+        source.conversion_time = PlaybackClock::duration::zero();
+        source.converted_samples = 0;
+    }
 }
+#endif
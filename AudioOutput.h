@@ -1,7 +1,12 @@
 #ifndef AUDIOOUTPUT_H
 #define AUDIOOUTPUT_H
 
-#include "AudioFrame.h"
+#include "AudioFrameQueue.h"
+#include "AudioSampleRing.h"
+#include "AudioTimeline.h"
+
+class AudioMixer;
+class AudioSink;
 
 class AudioOutput : public QObject
 {
@@ -20,6 +25,7 @@ class AudioOutput : public QObject
     struct AudioSource
     {
         static constexpr ALsizei kALBufferCount = 4;
+        static constexpr size_t kRingBlockCount = 20; //Blocks staged beyond the ones queued in OpenAL
 
         AudioSource();
         AudioSource(const AudioSource &) = delete;
@@ -29,12 +35,22 @@ class AudioOutput : public QObject
         AudioSourceId id;
         AVSampleFormat sample_format;
         int channels, sample_channel_size, sample_rate;
+        int64_t channel_layout = 0, out_channel_layout = 0;
+        AVSampleFormat out_sample_format = AV_SAMPLE_FMT_NONE;
         bool force_mono = false;
 
-        std::vector<QSharedPointer<AudioFrame>> pending_frames;
-        SwrContextObject swr_context;
+        SwrContextObject swr_context; //Only if the format has to be converted or drift is being compensated
+        bool resample = false; //The output format needs swr, otherwise it's dropped again when stopping
+        bool interleave = false; //Planar input only differing in layout, interleaved without swr
+
+        //Samples appended and played since the last stop, played ones are those in exhausted buffers
+        AudioTimeline timeline;
+        int64_t samples_written = 0, samples_played = 0;
+        PlaybackClock::duration drift = PlaybackClock::duration::zero();
 
-        std::vector<uint8_t> buffer_block;
+        //Output bytes waiting for an OpenAL buffer, the capacity is a multiple of buffer_block_cap and blocks are only taken whole from a rewound ring,
+        //so every block is contiguous and handed to alBufferData in place
+        AudioSampleRing<uint8_t> buffer_ring;
         size_t buffer_block_cap;
 
         ALSourceId al_id;
@@ -44,12 +60,28 @@ class AudioOutput : public QObject
 
         unsigned char next_start_id = 0;
         bool starting = false, muted = false, stopping = false;
+
+#ifdef _DEBUG
+        PlaybackClock::duration conversion_time = PlaybackClock::duration::zero();
+        int64_t converted_samples = 0;
+#endif
+    };
+    static constexpr ALsizei kMixerALBufferCount = 4;
+
+    enum MixerOutputMode
+    {
+        MixerOutputPush, //Periods queued on the drain tick
+        MixerOutputCallback, //Pulled by OpenAL through AL_SOFT_callback_buffer
+        MixerOutputThread, //Short periods queued by a time-critical thread
+        MixerOutputSink, //Periods handed to an AudioSink by a thread, OpenAL isn't used at all
     };
 public:
     explicit AudioOutput(QObject *parent = nullptr);
     ~AudioOutput();
 signals:
     void soloAudioSourceChanged(void *source_id);
+    //Milliseconds the source is heard later than its present time, updated every AudioTimeline::kDriftMeasureInterval while playing
+    void audioSourceDriftChanged(void *source_id, qreal drift);
 public slots:
     //Use void* as a workaround since size_t/uintptr_t causes trouble in signals/slots
 
@@ -58,27 +90,83 @@ public slots:
     void onDeleteAudioSource(void *source_id);
 
     void onNewAudioFrame(void *source_id, const QSharedPointer<AudioFrame> &audio_frame);
+    //Frames of the source are polled from queue instead of arriving through onNewAudioFrame, nullptr to detach
+    void onSetAudioSourceQueue(void *source_id, const QSharedPointer<AudioFrameQueue> &queue);
     void onSetAudioSourceVolume(void *source_id, qreal volume);
     void onSetAudioSourcePosition(void *source_id, QVector3D position);
     void onSetAudioSourceMute(void *source_id, bool mute);
     void onSetAudioSourceSolo(void *source_id, bool solo);
+private slots:
+    void OnDrainTick();
+    void OnSyncTick();
 private:
     void InitSource(AudioSource &source);
     void InitSource(AudioSource &source, int channels, int64_t channel_layout, AVSampleFormat sample_fmt, int sample_rate);
     AudioSource *GetOrCreateSource(void *source_id);
+    static bool InitResampler(AudioSource &source);
+    bool MeasureDrift(AudioSource &source, PlaybackClock::duration &drift);
 
     void StartSource(const std::shared_ptr<AudioSource> &source, PlaybackClock::time_point timestamp);
-    static void AppendFrameToSourceBuffer(AudioSource &source, const QSharedPointer<AudioFrame> &audio_frame);
+    //Returns false if the frame doesn't fit in the ring and is dropped
+    static bool AppendFrameToSourceBuffer(AudioSource &source, const QSharedPointer<AudioFrame> &audio_frame);
+    static void InterleaveSamples(const AudioSource &source, uint8_t *out, const AVFrame *frame, int offset, int count);
     static void AppendBufferToSource(AudioSource &source);
     static void CollectExhaustedBuffer(AudioSource &source);
     static void StopSource(AudioSource &source);
 
+    //Software mixer output, one streaming source fed with mixed periods or pulling them, QDDM_AUDIO_PULL=1 selects pulling
+    bool InitMixerOutput(bool pull);
+    void ReleaseMixerOutput();
+    void FillMixerOutput();
+    PlaybackClock::time_point MixerOutputTime();
+    void MeasureMixerCallbackLatency();
+    //Headless output through AudioSink, also taken if no OpenAL device can be opened
+    bool InitSinkOutput(const QByteArray &sink_name);
+    void RunSinkOutput();
+#ifdef AL_SOFT_callback_buffer
+    static ALsizei AL_APIENTRY MixerCallback(ALvoid *userptr, ALvoid *sampledata, ALsizei numbytes) noexcept;
+    ALsizei PullMixerOutput(void *data, ALsizei byte_count);
+#endif
+#ifdef _DEBUG
+    void ReportMixerStatistics();
+    void ReportStagingStatistics();
+#endif
+
     ALCdevice *device_ = nullptr;
     ALCcontext *context_ = nullptr;
-    LPALGETSOURCEI64VSOFT alGetSourcei64vSOFT;
+    LPALGETSOURCEI64VSOFT alGetSourcei64vSOFT = nullptr;
+    bool float_output_ = false; //AL_EXT_FLOAT32
+    bool multichannel_output_ = false; //AL_EXT_MCFORMATS
     std::unordered_map<AudioSourceId, std::shared_ptr<AudioSource>> sources_;
+    std::unordered_map<AudioSourceId, QSharedPointer<AudioFrameQueue>> frame_queues_;
+    QTimer *drain_timer_ = nullptr;
+    QTimer *sync_timer_ = nullptr;
+    std::vector<std::pair<void *, PlaybackClock::duration>> mixer_drifts_;
+    std::vector<QSharedPointer<AudioFrame>> drained_frames_;
 
     void *solo_source_id_ = nullptr;
+
+    std::unique_ptr<AudioMixer> mixer_; //Set if sources are mixed by AudioMixer instead of OpenAL
+    ALSourceId mixer_al_id_ = 0;
+    ALBufferId mixer_al_buffer_occupied_[kMixerALBufferCount], mixer_al_buffer_free_[kMixerALBufferCount];
+    ALsizei mixer_al_buffer_occupied_count_ = 0, mixer_al_buffer_free_count_ = 0;
+    MixerOutputMode mixer_output_mode_ = MixerOutputPush;
+    bool mixer_output_float_ = false;
+    int mixer_period_frames_ = 0;
+    std::vector<float> mixer_block_;
+    std::vector<int16_t> mixer_block_s16_;
+    std::unique_ptr<AudioSink> sink_;
+    QThread *mixer_thread_ = nullptr;
+    std::atomic<bool> mixer_thread_stop_{ false };
+    //Until the next mixed sample is heard, measured by whichever thread feeds the output
+    std::atomic<int64_t> mixer_output_latency_ns_{ 0 };
+#ifdef _DEBUG
+    PlaybackClock::time_point last_debug_report_;
+    //Per-view path staging cost, reported with the drift measurements
+    PlaybackClock::duration staging_time_ = PlaybackClock::duration::zero();
+    int staged_frames_ = 0, dropped_frames_ = 0;
+    PlaybackClock::time_point last_staging_report_;
+#endif
 };
 
 #endif // AUDIOOUTPUT_H
@@ -0,0 +1,75 @@
+#ifndef AUDIOSAMPLERING_H
+#define AUDIOSAMPLERING_H
+
+//Fixed-capacity single producer, single consumer ring of interleaved samples, allocated only in Reset
+//Both sides see their part of the ring as up to two contiguous regions, so converters can write into it and output can read from it in place
+template <typename SampleType>
+class AudioSampleRing
+{
+public:
+    struct Regions
+    {
+        SampleType *data[2] = {};
+        size_t size[2] = {};
+
+        size_t Total() const { return size[0] + size[1]; }
+    };
+
+    //Neither side may be using the ring meanwhile
+    void Reset(size_t capacity)
+    {
+        buffer_.assign(capacity, SampleType());
+        write_index_.store(0, std::memory_order_relaxed);
+        read_index_.store(0, std::memory_order_relaxed);
+    }
+
+    size_t Capacity() const { return buffer_.size(); }
+    size_t Size() const { return write_index_.load(std::memory_order_acquire) - read_index_.load(std::memory_order_acquire); }
+    //Samples written and read since Reset, each only on its own side
+    size_t WriteIndex() const { return write_index_.load(std::memory_order_relaxed); }
+    size_t ReadIndex() const { return read_index_.load(std::memory_order_relaxed); }
+
+    //Producer
+    Regions WriteRegions()
+    {
+        size_t write_index = write_index_.load(std::memory_order_relaxed);
+        return MakeRegions(write_index, Capacity() - (write_index - read_index_.load(std::memory_order_acquire)));
+    }
+    void Commit(size_t count) { write_index_.store(write_index_.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+
+    //Consumer
+    Regions ReadRegions()
+    {
+        size_t read_index = read_index_.load(std::memory_order_relaxed);
+        return MakeRegions(read_index, write_index_.load(std::memory_order_acquire) - read_index);
+    }
+    void Consume(size_t count) { read_index_.store(read_index_.load(std::memory_order_relaxed) + count, std::memory_order_release); }
+    void Clear() { read_index_.store(write_index_.load(std::memory_order_acquire), std::memory_order_release); }
+    //Empties the ring and moves both sides back to the start, only if one thread owns both sides
+    void Rewind()
+    {
+        write_index_.store(0, std::memory_order_relaxed);
+        read_index_.store(0, std::memory_order_relaxed);
+    }
+private:
+    Regions MakeRegions(size_t index, size_t count)
+    {
+        Regions regions;
+        if (count == 0)
+            return regions;
+        size_t offset = index % Capacity();
+        regions.data[0] = buffer_.data() + offset;
+        regions.size[0] = std::min(count, Capacity() - offset);
+        if (regions.size[0] < count)
+        {
+            regions.data[1] = buffer_.data();
+            regions.size[1] = count - regions.size[0];
+        }
+        return regions;
+    }
+
+    std::vector<SampleType> buffer_;
+    std::atomic<size_t> write_index_{ 0 }, read_index_{ 0 };
+};
+
+#endif // AUDIOSAMPLERING_H
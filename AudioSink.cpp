@@ -0,0 +1,96 @@
+#include "pch.h"
+#include "AudioSink.h"
+
+#include "AudioMixer.h"
+
+std::unique_ptr<AudioSink> AudioSink::Create(const QByteArray &name, int sample_rate, int channels)
+{
+    if (name == "wav")
+    {
+        QString file_name = qEnvironmentVariable("QDDM_AUDIO_SINK_FILE", QStringLiteral("qddm-audio.wav"));
+        auto sink = std::make_unique<AudioWavSink>(file_name, sample_rate, channels);
+        if (sink->IsOpen())
+            return sink;
+        qCWarning(CategoryAudioPlayback) << "Can't open " << file_name << " for the wav audio sink, using the null sink";
+    }
+    else if (name == "null-fast")
+    {
+        return std::make_unique<AudioNullSink>(false);
+    }
+    else if (name != "null")
+    {
+        qCWarning(CategoryAudioPlayback) << "Unknown audio sink " << name << ", using the null sink";
+    }
+    return std::make_unique<AudioNullSink>(true);
+}
+
+AudioWavSink::AudioWavSink(const QString &file_name, int sample_rate, int channels)
+    :file_(file_name), sample_rate_(sample_rate), channels_(channels)
+{
+    if (!file_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return;
+    WriteHeader(0);
+}
+
+AudioWavSink::~AudioWavSink()
+{
+    if (file_.isOpen())
+        Finish();
+}
+
+void AudioWavSink::Write(const float *samples, int frame_count)
+{
+    if (!file_.isOpen())
+        return;
+    //Whole frames only, what doesn't fit under kMaxDataSize is dropped and the file closed
+    const quint32 block_align = static_cast<quint32>(channels_ * sizeof(int16_t));
+    const quint32 frames_left = (kMaxDataSize - data_size_) / block_align;
+    bool full = static_cast<quint32>(frame_count) >= frames_left;
+    if (full)
+        frame_count = static_cast<int>(frames_left);
+    size_t sample_count = static_cast<size_t>(frame_count) * channels_;
+    if (block_.size() < sample_count)
+        block_.resize(sample_count);
+    AudioMixer::ConvertToS16(block_.data(), samples, sample_count);
+    for (size_t i = 0; i < sample_count; ++i)
+        block_[i] = qToLittleEndian(block_[i]);
+    qint64 size = static_cast<qint64>(sample_count * sizeof(int16_t));
+    if (file_.write(reinterpret_cast<const char *>(block_.data()), size) != size)
+    {
+        qCWarning(CategoryAudioPlayback) << "Can't write to " << file_.fileName() << ", closing the wav audio sink";
+        Finish();
+        return;
+    }
+    data_size_ += static_cast<quint32>(size);
+    if (full)
+    {
+        qCWarning(CategoryAudioPlayback) << file_.fileName() << " reached the wav size limit, closing the wav audio sink";
+        Finish();
+    }
+}
+
+void AudioWavSink::Finish()
+{
+    if (file_.seek(0))
+        WriteHeader(data_size_);
+    file_.close();
+}
+
+void AudioWavSink::WriteHeader(quint32 data_size)
+{
+    uchar header[kHeaderSize];
+    const quint16 block_align = static_cast<quint16>(channels_ * sizeof(int16_t));
+    memcpy(header, "RIFF", 4);
+    qToLittleEndian<quint32>(static_cast<quint32>(kHeaderSize - 8) + data_size, header + 4);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    qToLittleEndian<quint32>(16, header + 16);
+    qToLittleEndian<quint16>(1, header + 20); //PCM
+    qToLittleEndian<quint16>(static_cast<quint16>(channels_), header + 22);
+    qToLittleEndian<quint32>(static_cast<quint32>(sample_rate_), header + 24);
+    qToLittleEndian<quint32>(static_cast<quint32>(sample_rate_) * block_align, header + 28);
+    qToLittleEndian<quint16>(block_align, header + 32);
+    qToLittleEndian<quint16>(16, header + 34);
+    memcpy(header + 36, "data", 4);
+    qToLittleEndian<quint32>(data_size, header + 40);
+    file_.write(reinterpret_cast<const char *>(header), kHeaderSize);
+}
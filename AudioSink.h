@@ -0,0 +1,59 @@
+#ifndef AUDIOSINK_H
+#define AUDIOSINK_H
+
+Q_DECLARE_LOGGING_CATEGORY(CategoryAudioPlayback)
+
+//Receives the mixed interleaved float32 stereo stream instead of OpenAL, so the pipeline runs without sound hardware
+//Selected by QDDM_AUDIO_SINK: "null" consumes in real time, "null-fast" as fast as the mixer runs, "wav" writes to QDDM_AUDIO_SINK_FILE
+//Write is only called from the output thread
+class AudioSink
+{
+public:
+    //The null sink for unknown names or if the chosen sink can't be opened
+    static std::unique_ptr<AudioSink> Create(const QByteArray &name, int sample_rate, int channels);
+
+    virtual ~AudioSink() = default;
+
+    //If false, periods are mixed back to back on a virtual clock instead of being paced by PlaybackClock
+    virtual bool RealTime() const { return true; }
+    virtual const char *Name() const = 0;
+    virtual void Write(const float *samples, int frame_count) = 0;
+};
+
+class AudioNullSink : public AudioSink
+{
+public:
+    explicit AudioNullSink(bool real_time) :real_time_(real_time) {}
+
+    bool RealTime() const override { return real_time_; }
+    const char *Name() const override { return real_time_ ? "null" : "null-fast"; }
+    void Write(const float *, int) override {}
+private:
+    bool real_time_;
+};
+
+//16-bit PCM, sizes in the header are filled in when closed
+//RIFF sizes are 32-bit, so writing stops a bit short of 4 GiB, about 6 hours of 48kHz stereo
+class AudioWavSink : public AudioSink
+{
+public:
+    AudioWavSink(const QString &file_name, int sample_rate, int channels);
+    ~AudioWavSink();
+
+    bool IsOpen() const { return file_.isOpen(); }
+    const char *Name() const override { return "wav"; }
+    void Write(const float *samples, int frame_count) override;
+private:
+    static constexpr qint64 kHeaderSize = 44;
+    static constexpr quint32 kMaxDataSize = std::numeric_limits<quint32>::max() - static_cast<quint32>(kHeaderSize);
+
+    void WriteHeader(quint32 data_size);
+    void Finish();
+
+    QFile file_;
+    int sample_rate_, channels_;
+    quint32 data_size_ = 0;
+    std::vector<int16_t> block_;
+};
+
+#endif // AUDIOSINK_H
@@ -0,0 +1,65 @@
+#ifndef AUDIOTIMELINE_H
+#define AUDIOTIMELINE_H
+
+Q_DECLARE_LOGGING_CATEGORY(CategoryAudioPlayback)
+
+//Maps output sample indices to the present time of the frame starting there, so the played position can be compared with PlaybackClock
+//Anchors stay correct while swr stretches or squeezes the output
+class AudioTimeline
+{
+public:
+    static constexpr size_t kAnchorCount = 64;
+    //Drift within tolerance is left alone, beyond resync playback is restarted instead of resampled
+    static constexpr auto kDriftTolerance = std::chrono::milliseconds(2);
+    static constexpr auto kDriftResync = std::chrono::milliseconds(200);
+    static constexpr auto kDriftMeasureInterval = std::chrono::milliseconds(500);
+    static constexpr int kDriftCorrectionMS = 2000;
+    static constexpr int kMaxCompensationPermille = 5;
+
+    void Clear() { begin_ = end_ = 0; }
+
+    void Add(int64_t sample_index, PlaybackClock::time_point present_time)
+    {
+        if (end_ - begin_ == kAnchorCount)
+            ++begin_;
+        anchors_[end_++ % kAnchorCount] = { sample_index, present_time };
+    }
+
+    //Anchors before the one covering sample_index are dropped, so indices have to be asked in increasing order
+    bool PresentTime(int64_t sample_index, int sample_rate, PlaybackClock::time_point &present_time)
+    {
+        while (end_ - begin_ > 1 && anchors_[(begin_ + 1) % kAnchorCount].sample_index <= sample_index)
+            ++begin_;
+        if (begin_ == end_ || anchors_[begin_ % kAnchorCount].sample_index > sample_index)
+            return false;
+        const Anchor &anchor = anchors_[begin_ % kAnchorCount];
+        present_time = anchor.present_time + std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::nanoseconds((sample_index - anchor.sample_index) * 1000000000 / sample_rate));
+        return true;
+    }
+
+    //Works off drift (positive if heard late) over the next kDriftCorrectionMS of output, changing the rate by at most kMaxCompensationPermille
+    static void CompensateDrift(SwrContext *swr_context, PlaybackClock::duration drift, int sample_rate)
+    {
+        int sample_delta = 0, distance = 0;
+        if (drift > kDriftTolerance || drift < -kDriftTolerance)
+        {
+            distance = sample_rate * kDriftCorrectionMS / 1000;
+            int max_delta = distance * kMaxCompensationPermille / 1000;
+            sample_delta = qBound(-max_delta, static_cast<int>(-std::llround(std::chrono::duration<double>(drift).count() * sample_rate)), max_delta);
+        }
+        int ret = swr_set_compensation(swr_context, sample_delta, distance);
+        if (ret < 0)
+            qCWarning(CategoryAudioPlayback, "Can't set drift compensation #%d", ret);
+    }
+private:
+    struct Anchor
+    {
+        int64_t sample_index;
+        PlaybackClock::time_point present_time;
+    };
+
+    Anchor anchors_[kAnchorCount];
+    size_t begin_ = 0, end_ = 0;
+};
+
+#endif // AUDIOTIMELINE_H
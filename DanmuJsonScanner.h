@@ -0,0 +1,235 @@
+#ifndef DANMUJSONSCANNER_H
+#define DANMUJSONSCANNER_H
+
+//Forward-only cursor over a JSON text that reads the few values it's asked for and skips everything else without building a document
+//Assumes the text is well formed, malformed input only makes a read fail, never read out of bounds
+class DanmuJsonScanner
+{
+public:
+    DanmuJsonScanner(const char *data, size_t size) :pos_(data), end_(data + size) {}
+
+    bool Failed() const { return failed_; }
+
+    bool BeginObject() { return Expect('{'); }
+    bool BeginArray() { return Expect('['); }
+    bool AtArray()
+    {
+        SkipWhitespace();
+        return pos_ != end_ && *pos_ == '[';
+    }
+
+    //Moves to the value of the next member, false at the end of the object
+    bool NextMember(const char *&key, size_t &key_size)
+    {
+        if (!NextItem('}'))
+            return false;
+        if (!ReadRawString(key, key_size) || !Expect(':'))
+            return false;
+        SkipWhitespace();
+        return true;
+    }
+    //Moves to the value of the first member named key, skipping the others
+    bool FindMember(QLatin1String key)
+    {
+        const char *member_key;
+        size_t member_key_size;
+        while (NextMember(member_key, member_key_size))
+        {
+            if (member_key_size == (size_t)key.size() && memcmp(member_key, key.data(), member_key_size) == 0)
+                return true;
+            if (!SkipValue())
+                return false;
+        }
+        return false;
+    }
+    //Moves to the next element, false at the end of the array
+    bool NextElement()
+    {
+        if (!NextItem(']'))
+            return false;
+        SkipWhitespace();
+        return true;
+    }
+
+    //Content of a string value with escapes left as they are
+    bool ReadRawString(const char *&data, size_t &size)
+    {
+        SkipWhitespace();
+        if (pos_ == end_ || *pos_ != '"')
+            return Fail();
+        const char *begin = ++pos_;
+        if (!SkipString())
+            return false;
+        data = begin;
+        size = pos_ - 1 - begin;
+        return true;
+    }
+    bool ReadString(QString &value)
+    {
+        const char *data;
+        size_t size;
+        if (!ReadRawString(data, size))
+            return false;
+        value.clear();
+        const char *run = data, *end = data + size;
+        for (const char *p = data; p < end;)
+        {
+            if (*p != '\\')
+            {
+                ++p;
+                continue;
+            }
+            value.append(QString::fromUtf8(run, p - run));
+            if (end - p < 2)
+                return Fail();
+            char escaped = p[1];
+            p += 2;
+            switch (escaped)
+            {
+            case 'b': value.append(QLatin1Char('\b')); break;
+            case 'f': value.append(QLatin1Char('\f')); break;
+            case 'n': value.append(QLatin1Char('\n')); break;
+            case 'r': value.append(QLatin1Char('\r')); break;
+            case 't': value.append(QLatin1Char('\t')); break;
+            case 'u':
+            {
+                //Surrogate pairs come as two escapes, each one is a UTF-16 unit
+                if (end - p < 4)
+                    return Fail();
+                ushort unit = 0;
+                for (int i = 0; i < 4; ++i)
+                {
+                    int digit = HexDigit(p[i]);
+                    if (digit < 0)
+                        return Fail();
+                    unit = (ushort)(unit * 16 + digit);
+                }
+                value.append(QChar(unit));
+                p += 4;
+                break;
+            }
+            default: value.append(QLatin1Char(escaped)); break;
+            }
+            run = p;
+        }
+        value.append(QString::fromUtf8(run, end - run));
+        return true;
+    }
+    //False if the value isn't a number, which is then left unread
+    bool ReadNumber(double &value)
+    {
+        SkipWhitespace();
+        const char *begin = pos_;
+        while (pos_ != end_ && (isdigit((unsigned char)*pos_) || *pos_ == '-' || *pos_ == '+' || *pos_ == '.' || *pos_ == 'e' || *pos_ == 'E'))
+            ++pos_;
+        bool ok = false;
+        value = QByteArray::fromRawData(begin, pos_ - begin).toDouble(&ok);
+        if (!ok)
+            pos_ = begin;
+        return ok;
+    }
+
+    bool SkipValue()
+    {
+        SkipWhitespace();
+        if (pos_ == end_)
+            return Fail();
+        switch (*pos_)
+        {
+        case '"':
+            ++pos_;
+            return SkipString();
+        case '{':
+        case '[':
+        {
+            int depth = 0;
+            while (pos_ != end_)
+            {
+                char c = *pos_++;
+                if (c == '"')
+                {
+                    if (!SkipString())
+                        return false;
+                }
+                else if (c == '{' || c == '[')
+                {
+                    ++depth;
+                }
+                else if ((c == '}' || c == ']') && --depth == 0)
+                {
+                    return true;
+                }
+            }
+            return Fail();
+        }
+        default:
+            //Number, true, false or null
+            while (pos_ != end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ']' && !IsWhitespace(*pos_))
+                ++pos_;
+            return true;
+        }
+    }
+private:
+    static bool IsWhitespace(char c) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+    static int HexDigit(char c)
+    {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    bool Fail() { failed_ = true; return false; }
+    void SkipWhitespace()
+    {
+        while (pos_ != end_ && IsWhitespace(*pos_))
+            ++pos_;
+    }
+    bool Expect(char c)
+    {
+        SkipWhitespace();
+        if (pos_ == end_ || *pos_ != c)
+            return Fail();
+        ++pos_;
+        return true;
+    }
+    //Steps over the separator before an item or the closing bracket, the first item has no separator
+    bool NextItem(char close)
+    {
+        SkipWhitespace();
+        if (pos_ == end_)
+            return Fail();
+        if (*pos_ == close)
+        {
+            ++pos_;
+            return false;
+        }
+        if (*pos_ == ',')
+            ++pos_;
+        return true;
+    }
+    //From after the opening quote to after the closing one, a quote preceded by an odd number of backslashes is escaped
+    bool SkipString()
+    {
+        const char *begin = pos_;
+        while (const char *quote = (const char *)memchr(pos_, '"', end_ - pos_))
+        {
+            const char *p = quote;
+            while (p != begin && p[-1] == '\\')
+                --p;
+            pos_ = quote + 1;
+            if ((quote - p) % 2 == 0)
+                return true;
+        }
+        pos_ = end_;
+        return Fail();
+    }
+
+    const char *pos_, *end_;
+    bool failed_ = false;
+};
+
+#endif // DANMUJSONSCANNER_H
@@ -1,9 +1,12 @@
 #include "pch.h"
 #include "FixedGridLayout.h"
 
+#include "VideoFrameGridRenderNodeOGL.h"
+
 FixedGridLayout::FixedGridLayout(QQuickItem *parent)
     :QQuickItem(parent)
 {
+    setFlag(ItemHasContents, true);
     row_height_ = height() / rows_;
     column_width_ = width() / columns_;
     connect(this, &QQuickItem::widthChanged, this, &FixedGridLayout::OnWidthChanged);
@@ -40,6 +43,86 @@ void FixedGridLayout::setColumns(int columns)
     }
 }
 
+void FixedGridLayout::setBatchedVideo(bool batched_video)
+{
+    if (batched_video_ != batched_video)
+    {
+        batched_video_ = batched_video;
+        update();
+        emit batchedVideoChanged();
+    }
+}
+
+void FixedGridLayout::AddVideoTile(QQuickItem *tile)
+{
+    video_tiles_.emplace(tile, std::vector<QSharedPointer<VideoFrame>>());
+    removed_video_tiles_.erase(std::remove(removed_video_tiles_.begin(), removed_video_tiles_.end(), tile), removed_video_tiles_.end());
+    update();
+}
+
+void FixedGridLayout::RemoveVideoTile(QQuickItem *tile)
+{
+    if (video_tiles_.erase(tile) > 0)
+    {
+        removed_video_tiles_.push_back(tile);
+        update();
+    }
+}
+
+void FixedGridLayout::AddVideoFrame(QQuickItem *tile, const QSharedPointer<VideoFrame> &frame)
+{
+    auto itr = video_tiles_.find(tile);
+    if (itr == video_tiles_.end())
+        return;
+    auto &next_frames = itr->second;
+    bool need_update = next_frames.empty();
+    if (next_frames.size() >= 8)
+        next_frames.erase(next_frames.begin());
+    next_frames.push_back(frame);
+    if (need_update)
+        update();
+}
+
+QSGNode *FixedGridLayout::updatePaintNode(QSGNode *node_base, QQuickItem::UpdatePaintNodeData *)
+{
+    VideoFrameGridRenderNodeOGL *node = static_cast<VideoFrameGridRenderNodeOGL *>(node_base);
+    if (!batched_video_ || video_tiles_.empty())
+    {
+        removed_video_tiles_.clear();
+        for (auto &video_tile : video_tiles_)
+            video_tile.second.clear();
+        return nullptr;
+    }
+    if (!node)
+    {
+        if (width() <= 0 || height() <= 0)
+            return nullptr;
+        node = new VideoFrameGridRenderNodeOGL;
+    }
+
+    for (QQuickItem *tile : removed_video_tiles_)
+        node->RemoveTile(tile);
+    removed_video_tiles_.clear();
+
+    for (auto &video_tile : video_tiles_)
+    {
+        QQuickItem *tile = video_tile.first;
+        if (tile->isVisible() && tile->width() > 0 && tile->height() > 0)
+            node->SetTileRect(tile, tile->mapRectToItem(this, QRectF(0, 0, tile->width(), tile->height())));
+        else
+            node->SetTileRect(tile, QRectF());
+        if (!video_tile.second.empty())
+        {
+            node->AddVideoFrames(tile, std::move(video_tile.second));
+            video_tile.second.clear();
+        }
+    }
+
+    node->Synchronize(this);
+
+    return node;
+}
+
 void FixedGridLayout::OnWidthChanged()
 {
     column_width_ = width() / columns_;
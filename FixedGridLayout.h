@@ -1,6 +1,8 @@
 #ifndef FIXEDGRIDLAYOUT_H
 #define FIXEDGRIDLAYOUT_H
 
+#include "VideoFrame.h"
+
 class FixedGridLayoutAttachedType : public QObject
 {
     Q_OBJECT
@@ -35,6 +37,7 @@ class FixedGridLayout : public QQuickItem
 
     Q_PROPERTY(int rows READ rows WRITE setRows NOTIFY rowsChanged)
     Q_PROPERTY(int columns READ columns WRITE setColumns NOTIFY columnsChanged)
+    Q_PROPERTY(bool batchedVideo READ batchedVideo WRITE setBatchedVideo NOTIFY batchedVideoChanged)
 public:
     explicit FixedGridLayout(QQuickItem *parent = nullptr);
 
@@ -42,16 +45,25 @@ public:
     void setRows(int rows);
     int columns() const { return columns_; }
     void setColumns(int columns);
+    bool batchedVideo() const { return batched_video_; }
+    void setBatchedVideo(bool batched_video);
+
+    //Video of tiles attached here is drawn by a single node under all children, see LiveStreamView::videoLayout
+    void AddVideoTile(QQuickItem *tile);
+    void RemoveVideoTile(QQuickItem *tile);
+    void AddVideoFrame(QQuickItem *tile, const QSharedPointer<VideoFrame> &frame);
 
     static FixedGridLayoutAttachedType *qmlAttachedProperties(QObject *parent) { return new FixedGridLayoutAttachedType(parent); }
 signals:
     void rowsChanged();
     void columnsChanged();
+    void batchedVideoChanged();
 private slots:
     void OnWidthChanged();
     void OnHeightChanged();
 protected:
     void itemChange(QQuickItem::ItemChange change, const QQuickItem::ItemChangeData &value) override;
+    QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) override;
 private:
     void AddChild(QQuickItem *child);
     void RemoveChild(QQuickItem *child);
@@ -62,6 +74,10 @@ private:
     int rows_ = 1, columns_ = 1;
     qreal row_height_ = 0, column_width_ = 0;
     bool repositioning_ = false;
+
+    bool batched_video_ = false;
+    std::unordered_map<QQuickItem *, std::vector<QSharedPointer<VideoFrame>>> video_tiles_;
+    std::vector<QQuickItem *> removed_video_tiles_;
 };
 QML_DECLARE_TYPEINFO(FixedGridLayout, QML_HAS_ATTACHED_PROPERTIES)
 
@@ -0,0 +1,118 @@
+#ifndef FLVTAGALIGNER_H
+#define FLVTAGALIGNER_H
+
+//Holds back incomplete FLV tags so that a stream can be cut at any time and another FLV stream spliced right after the last complete tag
+class FlvTagAligner
+{
+    static constexpr int kFileHeaderSize = 13; //Including PreviousTagSize0
+    static constexpr int kTagHeaderSize = 11, kTagTrailerSize = 4;
+    static constexpr int kTagTypeAudio = 8, kTagTypeVideo = 9, kTagTypeScript = 18;
+public:
+    FlvTagAligner()
+    {
+    }
+
+    //Strip file header if this stream is going to be spliced after another one
+    void BeginStream(bool splice)
+    {
+        pending_.clear();
+        pending_pos_ = 0;
+        header_checked_ = false;
+        strip_header_ = splice;
+        passthrough_ = false;
+        has_timestamp_ = false;
+    }
+
+    //Incomplete tag is discarded
+    void EndStream()
+    {
+        pending_.clear();
+        pending_pos_ = 0;
+    }
+
+    void Append(QIODevice *source, qint64 max_size)
+    {
+        if (max_size > 0)
+            pending_.append(source->read(max_size));
+    }
+
+    //Returns data ending at a tag boundary, or everything if the stream doesn't look like FLV
+    QByteArray TakeAlignedData()
+    {
+        if (!header_checked_)
+        {
+            if (pending_.size() < kFileHeaderSize)
+                return QByteArray();
+            header_checked_ = true;
+            if (!pending_.startsWith("FLV"))
+                passthrough_ = true;
+            else if (strip_header_)
+                pending_.remove(0, kFileHeaderSize);
+            else
+                pending_pos_ = kFileHeaderSize;
+        }
+        if (!passthrough_)
+        {
+            while (pending_.size() - pending_pos_ >= kTagHeaderSize)
+            {
+                const uint8_t *tag = reinterpret_cast<const uint8_t *>(pending_.constData()) + pending_pos_;
+                int tag_type = tag[0] & 0x1F;
+                if (tag_type != kTagTypeAudio && tag_type != kTagTypeVideo && tag_type != kTagTypeScript)
+                {
+                    passthrough_ = true;
+                    break;
+                }
+                int tag_size = kTagHeaderSize + ((tag[1] << 16) | (tag[2] << 8) | tag[3]) + kTagTrailerSize;
+                if (pending_.size() - pending_pos_ < tag_size)
+                    break;
+                if (tag_type != kTagTypeScript)
+                {
+                    last_timestamp_ = std::chrono::milliseconds((int32_t)((uint32_t)tag[7] << 24 | (uint32_t)tag[4] << 16 | (uint32_t)tag[5] << 8 | (uint32_t)tag[6]));
+                    has_timestamp_ = true;
+                }
+                pending_pos_ += tag_size;
+            }
+        }
+        QByteArray data;
+        if (passthrough_)
+        {
+            data = std::move(pending_);
+            pending_.clear();
+            pending_pos_ = 0;
+        }
+        else if (pending_pos_ > 0)
+        {
+            data = pending_.left(pending_pos_);
+            pending_.remove(0, pending_pos_);
+            pending_pos_ = 0;
+        }
+        return data;
+    }
+
+    int PendingSize() const { return pending_.size(); }
+    //Bytes still missing from the file header or tag at the end of pending data, 0 at a tag boundary or in passthrough
+    //Read whatever the input budget is, a tag larger than the free budget would never complete otherwise
+    qint64 MissingSize() const
+    {
+        if (!header_checked_)
+            return pending_.isEmpty() ? 0 : kFileHeaderSize - pending_.size();
+        if (passthrough_ || pending_.size() == pending_pos_)
+            return 0;
+        if (pending_.size() - pending_pos_ < kTagHeaderSize)
+            return kTagHeaderSize - (pending_.size() - pending_pos_);
+        const uint8_t *tag = reinterpret_cast<const uint8_t *>(pending_.constData()) + pending_pos_;
+        qint64 tag_size = kTagHeaderSize + ((tag[1] << 16) | (tag[2] << 8) | tag[3]) + kTagTrailerSize;
+        return std::max<qint64>(0, tag_size - (pending_.size() - pending_pos_));
+    }
+    bool HasTimestamp() const { return has_timestamp_; }
+    std::chrono::milliseconds LastTimestamp() const { return last_timestamp_; }
+private:
+    QByteArray pending_;
+    int pending_pos_ = 0;
+    bool header_checked_ = false, strip_header_ = false, passthrough_ = false;
+
+    bool has_timestamp_ = false;
+    std::chrono::milliseconds last_timestamp_ = 0ms;
+};
+
+#endif // FLVTAGALIGNER_H
@@ -9,6 +9,9 @@ static constexpr PlaybackClock::duration kPacketBufferStartThreshold = 2400ms, k
 static constexpr PlaybackClock::duration kFrameBufferStartThreshold = 200ms, kFrameBufferFullThreshold = 200ms;
 static constexpr std::chrono::milliseconds kFrameBufferPushInit = 50ms, kFrameBufferPushInterval = 50ms;
 static constexpr PlaybackClock::duration kUploadToRenderLatency = 120ms;
+static constexpr int64_t kTimestampDiscontinuityThreshold = AV_TIME_BASE, kTimestampDiscontinuityGap = AV_TIME_BASE / 50; //In AV_TIME_BASE_Q
+static constexpr PlaybackClock::duration kStatisticsInterval = 2s;
+static constexpr PlaybackClock::duration kStandbyPacketBufferLimit = 4000ms; //Must stay below kPacketBufferFullThreshold or demuxer will block
 
 template <typename ToDuration>
 static inline constexpr ToDuration AVTimestampToDuration(int64_t timestamp, AVRational time_base)
@@ -62,6 +65,12 @@ void LiveStreamDecoder::PushData(QIODevice *device)
     demuxer_in_.Fill(device, std::min<qint64>(kInputBufferSizeLimit, device->bytesAvailable()));
 }
 
+size_t LiveStreamDecoder::PushDataCapacity()
+{
+    size_t buffered_size = demuxer_in_.SizeLocked();
+    return buffered_size >= (size_t)kInputBufferSizeLimit ? 0 : kInputBufferSizeLimit - buffered_size;
+}
+
 void LiveStreamDecoder::EndData()
 {
     demuxer_in_.End();
@@ -227,6 +236,8 @@ void LiveStreamDecoder::onNewInputStream(const QString &url_hint, const QString
 
     video_stream_time_base_ = demuxer_ctx_->streams[video_stream_index_]->time_base;
     audio_stream_time_base_ = demuxer_ctx_->streams[audio_stream_index_]->time_base;
+    video_decoder_parameters_ = CopyStreamParameters(video_stream->codecpar, nullptr, 0);
+    audio_decoder_parameters_ = CopyStreamParameters(audio_stream->codecpar, nullptr, 0);
 
     open_ = true;
 
@@ -238,6 +249,8 @@ void LiveStreamDecoder::onNewInputStream(const QString &url_hint, const QString
     demuxer_thread_.start();
     QMetaObject::invokeMethod(worker, "Work");
 
+    SetVideoDecodeEffort(video_visible_ && !video_resume_pending_);
+
     emit newMedia(video_decoder_ctx_.Get(), audio_decoder_ctx_.Get());
     InitPlaying();
     StartPushTick();
@@ -256,6 +269,98 @@ void LiveStreamDecoder::onClearBuffer()
     packet_buffer_start_threshold_ = kPacketBufferStartThresholdLowLatencyInit;
 }
 
+void LiveStreamDecoder::onSetStandby(bool standby)
+{
+    if (standby_ == standby)
+        return;
+    standby_ = standby;
+    if (standby_)
+    {
+        //Keep demuxing, but drop everything decoded so far and only hold the packets from the latest keyframe on
+        if (playing())
+            StopPlaying();
+        video_frames_.clear();
+        audio_frames_.clear();
+        if (open_)
+            TrimStandbyPacketBuffer();
+    }
+    else if (open_)
+    {
+        //Decoders may hold references of packets fed before standby, packet buffer starts with a keyframe now
+        avcodec_flush_buffers(video_decoder_ctx_.Get());
+        avcodec_flush_buffers(audio_decoder_ctx_.Get());
+        video_eof_ = audio_eof_ = false;
+        packet_buffer_start_threshold_ = kPacketBufferStartThresholdLowLatencyInit;
+        ResetStatistics();
+        qCDebug(CategoryStreamDecoding, "Leaving standby");
+    }
+}
+
+void LiveStreamDecoder::onSetVideoVisible(bool visible)
+{
+    if (video_visible_ == visible)
+        return;
+    video_visible_ = visible;
+    if (!video_visible_)
+    {
+        //Keep the clock and audio running, video frames are still decoded for timing but dropped when due
+        video_resume_pending_ = false;
+        video_visible_pts_ = AV_NOPTS_VALUE;
+        SetVideoDecodeEffort(false);
+        qCDebug(CategoryStreamDecoding, "Video hidden");
+    }
+    else
+    {
+        //Frames decoded with shortcuts are broken until the next keyframe, see Decode()
+        video_resume_pending_ = true;
+        qCDebug(CategoryStreamDecoding, "Video visible, waiting for keyframe");
+    }
+}
+
+void LiveStreamDecoder::onSetVideoFrameQueue(void *owner, const QSharedPointer<VideoFrameQueue> &queue)
+{
+    video_frame_queue_ = queue;
+    video_output_owner_ = owner;
+}
+
+void LiveStreamDecoder::onDetachVideoOutput(void *owner)
+{
+    if (owner != video_output_owner_)
+        return;
+    video_frame_queue_.reset();
+    video_output_owner_ = nullptr;
+    onSetVideoVisible(true); //The source may be shown somewhere else
+}
+
+void LiveStreamDecoder::onSetAudioFrameQueue(void *owner, const QSharedPointer<AudioFrameQueue> &queue)
+{
+    audio_frame_queue_ = queue;
+    audio_frame_queue_owner_ = owner;
+}
+
+void LiveStreamDecoder::onDetachAudioFrameQueue(void *owner)
+{
+    if (owner != audio_frame_queue_owner_)
+        return;
+    audio_frame_queue_.reset();
+    audio_frame_queue_owner_ = nullptr;
+}
+
+void LiveStreamDecoder::SetVideoDecodeEffort(bool full)
+{
+    if (!video_decoder_ctx_)
+        return;
+    video_decoder_ctx_->skip_loop_filter = full ? AVDISCARD_DEFAULT : AVDISCARD_ALL;
+    video_decoder_ctx_->skip_frame = full ? AVDISCARD_DEFAULT : AVDISCARD_NONREF;
+}
+
+bool LiveStreamDecoder::IsVideoFrameShown(const VideoFrame &frame) const
+{
+    if (!video_visible_ || video_resume_pending_)
+        return false;
+    return video_visible_pts_ == AV_NOPTS_VALUE || frame.timestamp >= video_visible_pts_;
+}
+
 void LiveStreamDecoder::onSetDefaultMediaRecordFile(const QString &file_path)
 {
     remuxer_out_path_default_ = file_path;
@@ -300,6 +405,11 @@ void LiveStreamSourceDemuxWorker::Work()
     int ret;
     LiveStreamDecoder::AVPacketObject packet;
 
+    //A spliced input (reconnected stream) usually restarts its timestamps, so keep them continuous with a shared offset
+    int64_t timestamp_offset = 0, last_video_dts = AV_NOPTS_VALUE, last_audio_dts = AV_NOPTS_VALUE;
+    //It may also come with different codec parameters, the FLV demuxer announces them as new extradata on the next packet
+    std::shared_ptr<const AVCodecParameters> video_parameters = decoder_->video_decoder_parameters_, audio_parameters = decoder_->audio_decoder_parameters_;
+
     while (true)
     {
         ret = av_read_frame(decoder_->demuxer_ctx_.Get(), packet.ReleaseAndGet());
@@ -317,6 +427,48 @@ void LiveStreamSourceDemuxWorker::Work()
         packet.SetOwn();
         const int packet_stream_index = packet->stream_index;
 
+        if ((packet_stream_index == video_stream_index || packet_stream_index == audio_stream_index) && packet->dts != AV_NOPTS_VALUE)
+        {
+            const AVRational time_base = decoder_->demuxer_ctx_->streams[packet_stream_index]->time_base;
+            int64_t &last_dts = packet_stream_index == video_stream_index ? last_video_dts : last_audio_dts;
+            int64_t dts = av_rescale_q(packet->dts, time_base, AV_TIME_BASE_Q) + timestamp_offset;
+            if (last_dts != AV_NOPTS_VALUE && (dts < last_dts || dts - last_dts > kTimestampDiscontinuityThreshold))
+            {
+                int64_t correction = last_dts + kTimestampDiscontinuityGap - dts;
+                timestamp_offset += correction;
+                dts += correction;
+                qCInfo(CategoryStreamDecoding, "Timestamp discontinuity of %lldms corrected", (long long)(-correction / (AV_TIME_BASE / 1000)));
+            }
+            last_dts = dts;
+            if (timestamp_offset != 0)
+            {
+                int64_t offset = av_rescale_q(timestamp_offset, AV_TIME_BASE_Q, time_base);
+                packet->dts += offset;
+                if (packet->pts != AV_NOPTS_VALUE)
+                    packet->pts += offset;
+            }
+        }
+
+        if (packet_stream_index == video_stream_index || packet_stream_index == audio_stream_index)
+        {
+            std::shared_ptr<const AVCodecParameters> &parameters = packet_stream_index == video_stream_index ? video_parameters : audio_parameters;
+            const AVCodecParameters *codecpar = decoder_->demuxer_ctx_->streams[packet_stream_index]->codecpar;
+            int extradata_size = 0;
+            const uint8_t *extradata = av_packet_get_side_data(packet.Get(), AV_PKT_DATA_NEW_EXTRADATA, &extradata_size);
+            if (!extradata && parameters)
+            {
+                extradata = parameters->extradata;
+                extradata_size = parameters->extradata_size;
+            }
+            if (!parameters || !LiveStreamDecoder::SameStreamParameters(*parameters, *codecpar, extradata, extradata_size))
+            {
+                std::shared_ptr<const AVCodecParameters> new_parameters = LiveStreamDecoder::CopyStreamParameters(codecpar, extradata, extradata_size);
+                if (new_parameters)
+                    parameters = std::move(new_parameters);
+            }
+            packet.stream_parameters = parameters;
+        }
+
         do
         {
             QMutexLocker lock(&decoder_->remuxer_mutex_);
@@ -356,6 +508,8 @@ void LiveStreamSourceDemuxWorker::Work()
                 decoder_->demuxer_out_condition_.wait(lock.mutex());
             if (Q_UNLIKELY(decoder_->demuxer_eof_))
                 return;
+            if (packet->pts != AV_NOPTS_VALUE)
+                decoder_->demuxed_video_pts_ = packet->pts;
             decoder_->video_packets_.push_back(std::move(packet));
         }
         else if (packet_stream_index == audio_stream_index)
@@ -425,6 +579,18 @@ void LiveStreamDecoder::Decode()
         auto video_packet_itr = video_packets_.begin(), video_packet_itr_end = video_packets_.end();
         while (video_packet_itr != video_packet_itr_end && (video_frames_.empty() || video_frames_.back()->timestamp < timestamp_video_frame_full))
         {
+            if (!UpdateDecoderParameters(true, video_packet_itr->stream_parameters))
+            {
+                lock.unlock();
+                Close();
+                return;
+            }
+            if (video_resume_pending_ && ((*video_packet_itr)->flags & AV_PKT_FLAG_KEY))
+            {
+                SetVideoDecodeEffort(true);
+                video_resume_pending_ = false;
+                video_visible_pts_ = (*video_packet_itr)->pts;
+            }
             ret = SendVideoPacket(video_packet_itr->Get());
             ++video_packet_itr;
             if (ret == AVERROR_EOF)
@@ -461,6 +627,12 @@ void LiveStreamDecoder::Decode()
         auto audio_packet_itr = audio_packets_.begin(), audio_packet_itr_end = audio_packets_.end();
         while (audio_packet_itr != audio_packet_itr_end && (audio_frames_.empty() || audio_frames_.back()->timestamp < timestamp_audio_frame_full))
         {
+            if (!UpdateDecoderParameters(false, audio_packet_itr->stream_parameters))
+            {
+                lock.unlock();
+                Close();
+                return;
+            }
             ret = SendAudioPacket(audio_packet_itr->Get());
             ++audio_packet_itr;
             if (ret == AVERROR_EOF)
@@ -481,6 +653,107 @@ void LiveStreamDecoder::Decode()
     demuxer_out_condition_.notify_all();
 }
 
+std::shared_ptr<const AVCodecParameters> LiveStreamDecoder::CopyStreamParameters(const AVCodecParameters *codecpar, const uint8_t *extradata, int extradata_size)
+{
+    AVCodecParameters *parameters = avcodec_parameters_alloc();
+    if (!parameters)
+        return nullptr;
+    std::shared_ptr<const AVCodecParameters> result(parameters, [](const AVCodecParameters *p) { AVCodecParameters *object = const_cast<AVCodecParameters *>(p); avcodec_parameters_free(&object); });
+    if (avcodec_parameters_copy(parameters, codecpar) < 0)
+        return nullptr;
+    if (extradata && extradata != codecpar->extradata)
+    {
+        av_freep(&parameters->extradata);
+        parameters->extradata_size = 0;
+        if (!(parameters->extradata = (uint8_t *)av_mallocz(extradata_size + AV_INPUT_BUFFER_PADDING_SIZE)))
+            return nullptr;
+        memcpy(parameters->extradata, extradata, extradata_size);
+        parameters->extradata_size = extradata_size;
+    }
+    return result;
+}
+
+bool LiveStreamDecoder::SameStreamParameters(const AVCodecParameters &parameters, const AVCodecParameters &codecpar, const uint8_t *extradata, int extradata_size)
+{
+    if (parameters.codec_id != codecpar.codec_id || parameters.profile != codecpar.profile)
+        return false;
+    if (parameters.codec_type == AVMEDIA_TYPE_VIDEO && (parameters.width != codecpar.width || parameters.height != codecpar.height))
+        return false;
+    if (parameters.codec_type == AVMEDIA_TYPE_AUDIO && (parameters.sample_rate != codecpar.sample_rate || parameters.channels != codecpar.channels || parameters.channel_layout != codecpar.channel_layout))
+        return false;
+    //Sequence headers (SPS/PPS, AudioSpecificConfig) hold the rest, like a resolution the FLV demuxer doesn't update
+    return parameters.extradata_size == extradata_size && (extradata_size == 0 || memcmp(parameters.extradata, extradata, extradata_size) == 0);
+}
+
+bool LiveStreamDecoder::UpdateDecoderParameters(bool video, const std::shared_ptr<const AVCodecParameters> &parameters)
+{
+    std::shared_ptr<const AVCodecParameters> &current = video ? video_decoder_parameters_ : audio_decoder_parameters_;
+    if (!parameters || parameters == current)
+        return true;
+    bool same = current && SameStreamParameters(*current, *parameters, parameters->extradata, parameters->extradata_size);
+    current = parameters;
+    if (same)
+        return true;
+    return ReopenDecoder(video);
+}
+
+bool LiveStreamDecoder::ReopenDecoder(bool video)
+{
+    AVCodecContextObject &decoder_ctx = video ? video_decoder_ctx_ : audio_decoder_ctx_;
+    const AVCodecParameters *parameters = (video ? video_decoder_parameters_ : audio_decoder_parameters_).get();
+
+    //Drain frames still held by the old decoder before it's replaced
+    if (video)
+    {
+        SendVideoPacket(nullptr);
+        video_eof_ = false;
+    }
+    else
+    {
+        SendAudioPacket(nullptr);
+        audio_eof_ = false;
+    }
+
+    int ret;
+    AVCodec *codec = avcodec_find_decoder(parameters->codec_id);
+    if (!codec)
+    {
+        qCWarning(CategoryStreamDecoding, "No decoder for new %s stream parameters", video ? "video" : "audio");
+        return false;
+    }
+    AVCodecContextObject new_decoder_ctx = avcodec_alloc_context3(codec);
+    if (!new_decoder_ctx)
+    {
+        qCWarning(CategoryStreamDecoding, "Failed to alloc codec for new %s stream parameters", video ? "video" : "audio");
+        return false;
+    }
+    if (avcodec_parameters_to_context(new_decoder_ctx.Get(), parameters) < 0)
+        return false;
+    if (video)
+    {
+        if (decoder_ctx->codec_id != parameters->codec_id)
+        {
+            //Hardware decoding was set up for the old codec
+            video_decoder_hw_ctx_ = nullptr;
+            video_decoder_hw_pixel_format_ = AV_PIX_FMT_NONE;
+        }
+        if (video_decoder_hw_pixel_format_ != AV_PIX_FMT_NONE)
+            new_decoder_ctx->hw_device_ctx = av_buffer_ref(video_decoder_hw_ctx_.Get());
+    }
+    if ((ret = avcodec_open2(new_decoder_ctx.Get(), codec, NULL)) < 0)
+    {
+        qCWarning(CategoryStreamDecoding, "Failed to open codec for new %s stream parameters #%u", video ? "video" : "audio", ret);
+        return false;
+    }
+    decoder_ctx = std::move(new_decoder_ctx);
+    if (video)
+        SetVideoDecodeEffort(video_visible_ && !video_resume_pending_);
+
+    qCInfo(CategoryStreamDecoding, "%s stream parameters changed, decoder reopened", video ? "Video" : "Audio");
+    emit newMedia(video_decoder_ctx_.Get(), audio_decoder_ctx_.Get());
+    return true;
+}
+
 int LiveStreamDecoder::SendVideoPacket(AVPacket *packet)
 {
     if (video_eof_)
@@ -625,6 +898,7 @@ int LiveStreamDecoder::ReceiveVideoFrame()
     QSharedPointer<VideoFrame> video_frame = QSharedPointer<VideoFrame>::create();
     video_frame->timestamp = pts;
     video_frame->frame = std::move(frame);
+    decoded_video_pts_ = pts;
 
     video_frames_.push_back(std::move(video_frame));
 
@@ -802,11 +1076,44 @@ int LiveStreamDecoder::SkipAudioPacket(AVPacket *packet)
     return ret;
 }
 
+void LiveStreamDecoder::TrimStandbyPacketBuffer()
+{
+    QMutexLocker lock(&demuxer_out_mutex_);
+
+    auto keyframe_ritr = std::find_if(video_packets_.rbegin(), video_packets_.rend(), [](const AVPacketObject &packet) { return (packet->flags & AV_PKT_FLAG_KEY) != 0; });
+    if (keyframe_ritr == video_packets_.rend())
+    {
+        //Nothing decodable, wait for next keyframe
+        video_packets_.clear();
+        audio_packets_.clear();
+    }
+    else
+    {
+        auto keyframe_itr = std::prev(keyframe_ritr.base());
+        auto keyframe_time = AVTimestampToDuration<std::chrono::microseconds>((*keyframe_itr)->pts, video_stream_time_base_);
+        video_packets_.erase(video_packets_.begin(), keyframe_itr);
+        auto audio_itr = std::find_if(audio_packets_.begin(), audio_packets_.end(), [this, keyframe_time](const AVPacketObject &packet)
+        {
+            return AVTimestampToDuration<std::chrono::microseconds>(packet->pts, audio_stream_time_base_) >= keyframe_time;
+        });
+        audio_packets_.erase(audio_packets_.begin(), audio_itr);
+
+        if (IsPacketBufferLongerThan(kStandbyPacketBufferLimit)) //GOP too long to be held
+        {
+            video_packets_.clear();
+            audio_packets_.clear();
+        }
+    }
+
+    lock.unlock();
+    demuxer_out_condition_.notify_all();
+}
 
 void LiveStreamDecoder::StartPushTick()
 {
     push_tick_time_ = PlaybackClock::now();
     push_tick_enabled_ = true;
+    ResetStatistics();
 #ifdef _DEBUG
     last_debug_report_ = PlaybackClock::now();
 #endif
@@ -824,6 +1131,13 @@ void LiveStreamDecoder::OnPushTick()
     if (Q_UNLIKELY(!open_))
         return;
 
+    if (standby_)
+    {
+        TrimStandbyPacketBuffer();
+        SetUpNextPushTick();
+        return;
+    }
+
     if (!playing() && IsFrameBufferLongerThan(kFrameBufferStartThreshold))
     {
         QMutexLocker lock(&demuxer_out_mutex_);
@@ -846,7 +1160,40 @@ void LiveStreamDecoder::OnPushTick()
             if (duration >= pushed_time_)
                 break;
             frame.present_time = base_time_ + duration + kUploadToRenderLatency;
-            emit newVideoFrame(*video_itr);
+            if (!IsVideoFrameShown(frame))
+            {
+#ifdef _DEBUG
+                hidden_video_frames_dropped_ += 1;
+#endif
+                continue;
+            }
+            if (video_frame_queue_)
+            {
+                VideoFrameQueue::PushResult result = video_frame_queue_->Push(*video_itr);
+#ifdef _DEBUG
+                switch (result)
+                {
+                case VideoFrameQueue::PushDropped:
+                    video_queue_drops_ += 1;
+                    break;
+                case VideoFrameQueue::PushQueuedAndNotified:
+                    video_queue_notifications_ += 1;
+                    Q_FALLTHROUGH();
+                case VideoFrameQueue::PushQueued:
+                    video_frames_queued_ += 1;
+                    break;
+                }
+#else
+                Q_UNUSED(result);
+#endif
+            }
+            else
+            {
+                emit newVideoFrame(*video_itr);
+#ifdef _DEBUG
+                video_frames_signaled_ += 1;
+#endif
+            }
         }
         video_frames_.erase(video_frames_.begin(), video_itr);
 
@@ -858,7 +1205,25 @@ void LiveStreamDecoder::OnPushTick()
             if (duration >= pushed_time_)
                 break;
             frame.present_time = base_time_ + duration + kUploadToRenderLatency;
-            emit newAudioFrame(*audio_itr);
+            if (audio_frame_queue_)
+            {
+                bool queued = audio_frame_queue_->Push(*audio_itr);
+#ifdef _DEBUG
+                if (queued)
+                    audio_frames_queued_ += 1;
+                else
+                    audio_queue_drops_ += 1;
+#else
+                Q_UNUSED(queued);
+#endif
+            }
+            else
+            {
+                emit newAudioFrame(*audio_itr);
+#ifdef _DEBUG
+                audio_frames_signaled_ += 1;
+#endif
+            }
         }
         audio_frames_.erase(audio_frames_.begin(), audio_itr);
 
@@ -867,6 +1232,7 @@ void LiveStreamDecoder::OnPushTick()
             if (video_frames_.empty() || audio_frames_.empty())
             {
                 qCDebug(CategoryStreamDecoding, "Frame buffer is empty");
+                statistics_underruns_ += 1;
                 packet_buffer_start_threshold_ += kPacketBufferStartThresholdLowLatencyStep;
                 qCDebug(CategoryStreamDecoding) << "Next packet buffer startup threshold: " << std::chrono::duration_cast<std::chrono::milliseconds>(packet_buffer_start_threshold_).count() << "ms";
                 StopPlaying();
@@ -892,13 +1258,63 @@ void LiveStreamDecoder::OnPushTick()
         qCDebug(CategoryStreamDecoding) << "Audio packet buffer: " << (audio_packets_.empty() ? 0ll : AVTimestampToDuration<std::chrono::milliseconds>(audio_packets_.back()->pts - audio_packets_.front()->pts, audio_stream_time_base_).count()) << "ms";
         qCDebug(CategoryStreamDecoding) << "Video frame buffer: " << (video_frames_.empty() ? 0ll : AVTimestampToDuration<std::chrono::milliseconds>(video_frames_.back()->timestamp - video_frames_.front()->timestamp, video_stream_time_base_).count()) << "ms";
         qCDebug(CategoryStreamDecoding) << "Audio frame buffer: " << (audio_frames_.empty() ? 0ll : AVTimestampToDuration<std::chrono::milliseconds>(audio_frames_.back()->timestamp - audio_frames_.front()->timestamp, audio_stream_time_base_).count()) << "ms";
+        if (hidden_video_frames_dropped_ > 0)
+            qCDebug(CategoryStreamDecoding) << "Hidden video frames dropped: " << hidden_video_frames_dropped_;
+        hidden_video_frames_dropped_ = 0;
+        //Every signaled frame and every queue notification is one event posted to another thread
+        qCDebug(CategoryStreamDecoding) << "Video frames signaled: " << video_frames_signaled_ << ", queued: " << video_frames_queued_ << ", queue wakeups: " << video_queue_notifications_ << ", queue drops: " << video_queue_drops_;
+        video_frames_signaled_ = video_frames_queued_ = video_queue_notifications_ = video_queue_drops_ = 0;
+        qCDebug(CategoryStreamDecoding) << "Audio frames signaled: " << audio_frames_signaled_ << ", queued: " << audio_frames_queued_ << ", queue drops: " << audio_queue_drops_;
+        audio_frames_signaled_ = audio_frames_queued_ = audio_queue_drops_ = 0;
     }
 #endif
 
+    PlaybackClock::time_point decode_start_time = PlaybackClock::now();
     Decode(); //Try to pull some packet
+    if (Q_UNLIKELY(!open_))
+        return;
+    statistics_decode_time_ += PlaybackClock::now() - decode_start_time;
+    UpdateStatistics();
     SetUpNextPushTick();
 }
 
+void LiveStreamDecoder::ResetStatistics()
+{
+    statistics_window_start_ = PlaybackClock::now();
+    statistics_decode_time_ = PlaybackClock::duration::zero();
+    {
+        QMutexLocker lock(&demuxer_out_mutex_);
+        statistics_demuxed_video_pts_start_ = demuxed_video_pts_;
+    }
+    statistics_decoded_video_pts_start_ = decoded_video_pts_;
+    statistics_underruns_ = 0;
+}
+
+void LiveStreamDecoder::UpdateStatistics()
+{
+    //Reported for quality control: how fast media arrives, how fast it can be decoded, and how often playback ran dry
+    PlaybackClock::time_point current_time = PlaybackClock::now();
+    if (current_time - statistics_window_start_ < kStatisticsInterval)
+        return;
+    int64_t demuxed_video_pts;
+    {
+        QMutexLocker lock(&demuxer_out_mutex_);
+        demuxed_video_pts = demuxed_video_pts_;
+    }
+    if (demuxed_video_pts != AV_NOPTS_VALUE && statistics_demuxed_video_pts_start_ != AV_NOPTS_VALUE &&
+        decoded_video_pts_ != AV_NOPTS_VALUE && statistics_decoded_video_pts_start_ != AV_NOPTS_VALUE)
+    {
+        double wall_time = std::chrono::duration<double>(current_time - statistics_window_start_).count();
+        double demuxed_time = std::chrono::duration<double>(AVTimestampToDuration<std::chrono::microseconds>(demuxed_video_pts - statistics_demuxed_video_pts_start_, video_stream_time_base_)).count();
+        double decoded_time = std::chrono::duration<double>(AVTimestampToDuration<std::chrono::microseconds>(decoded_video_pts_ - statistics_decoded_video_pts_start_, video_stream_time_base_)).count();
+        double decode_time = std::chrono::duration<double>(statistics_decode_time_).count();
+        double ingest_ratio = demuxed_time / wall_time;
+        double decode_speed = decode_time > 0 ? decoded_time / decode_time : std::numeric_limits<double>::infinity();
+        emit statisticsUpdated(ingest_ratio, decode_speed, statistics_underruns_);
+    }
+    ResetStatistics();
+}
+
 void LiveStreamDecoder::SetUpNextPushTick()
 {
     if (!push_tick_enabled_)
@@ -1062,10 +1478,13 @@ void LiveStreamDecoder::Close()
     sws_context_ = nullptr;
     video_decoder_ctx_ = nullptr;
     audio_decoder_ctx_ = nullptr;
+    video_decoder_parameters_.reset();
+    audio_decoder_parameters_.reset();
     video_decoder_hw_ctx_ = nullptr;
     video_packets_.clear();
     audio_packets_.clear();
     demuxer_eof_ = false;
+    demuxed_video_pts_ = decoded_video_pts_ = AV_NOPTS_VALUE;
     demuxer_ctx_ = nullptr;
     input_ctx_ = nullptr;
 
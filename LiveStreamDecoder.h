@@ -2,7 +2,8 @@
 #define LIVESTREAMDECODER_H
 
 #include "VideoFrame.h"
-#include "AudioFrame.h"
+#include "VideoFrameQueue.h"
+#include "AudioFrameQueue.h"
 #include "SubtitleFrame.h"
 
 #include "BlockingFIFOBuffer.h"
@@ -31,6 +32,7 @@ class LiveStreamDecoder : public QObject
         AVPacketObject() = default;
         AVPacketObject(const AVPacketObject &obj) = delete;
         AVPacketObject(AVPacketObject &&obj)
+            :stream_parameters(std::move(obj.stream_parameters))
         {
             if (!obj.owns_object)
                 return;
@@ -43,6 +45,7 @@ class LiveStreamDecoder : public QObject
         {
             if (this == &obj)
                 return *this;
+            stream_parameters = std::move(obj.stream_parameters);
             if (owns_object)
             {
                 av_packet_unref(&object);
@@ -64,6 +67,7 @@ class LiveStreamDecoder : public QObject
         AVPacket *Get() { return &object; }
         AVPacket *ReleaseAndGet()
         {
+            stream_parameters.reset();
             if (owns_object)
             {
                 av_packet_unref(&object);
@@ -74,6 +78,7 @@ class LiveStreamDecoder : public QObject
         void SetOwn() { owns_object = true; }
         void Release()
         {
+            stream_parameters.reset();
             if (owns_object)
             {
                 av_packet_unref(&object);
@@ -87,6 +92,9 @@ class LiveStreamDecoder : public QObject
         AVPacket *operator->() { return &object; }
         operator bool() const { return owns_object; }
         bool operator!() const { return !owns_object; }
+
+        //Parameters of the stream when the packet was demuxed, shared by all packets until a spliced input changes them
+        std::shared_ptr<const AVCodecParameters> stream_parameters;
     private:
         AVPacket object;
         bool owns_object = false;
@@ -129,10 +137,12 @@ public:
 
     bool open() const { return open_; }
     bool playing() const { return playing_; }
+    bool standby() const { return standby_; }
 
     void BeginData();
     size_t PushData(const char *data, size_t size);
     void PushData(QIODevice *device);
+    size_t PushDataCapacity();
     void EndData();
     void CloseData();
 signals:
@@ -143,10 +153,22 @@ signals:
     void newVideoFrame(const QSharedPointer<VideoFrame> &video_frame);
     void newAudioFrame(const QSharedPointer<AudioFrame> &audio_frame);
     void deleteMedia();
+
+    void statisticsUpdated(qreal ingest_ratio, qreal decode_speed, int underruns);
 public slots:
     void onNewInputStream(const QString &url_hint, const QString &record_path);
     void onDeleteInputStream();
     void onClearBuffer();
+    void onSetStandby(bool standby);
+    void onSetVideoVisible(bool visible);
+    //Video frames go into queue instead of newVideoFrame while set, owner is the view that set it
+    void onSetVideoFrameQueue(void *owner, const QSharedPointer<VideoFrameQueue> &queue);
+    //Clears the queue and shows video again, only if owner is still the view that set the queue since another view may have taken over meanwhile
+    void onDetachVideoOutput(void *owner);
+    //Audio frames go into queue instead of newAudioFrame while set, owner is the view that set it
+    void onSetAudioFrameQueue(void *owner, const QSharedPointer<AudioFrameQueue> &queue);
+    //Clears the queue only if owner is still the view that set it
+    void onDetachAudioFrameQueue(void *owner);
     void onSetDefaultMediaRecordFile(const QString &file_path);
     void onSetOneshotMediaRecordFile(const QString &file_path);
 private slots:
@@ -156,14 +178,26 @@ private:
     static int AVIOReadCallback(void *opaque, uint8_t *buf, int buf_size);
 
     void Decode();
+    static std::shared_ptr<const AVCodecParameters> CopyStreamParameters(const AVCodecParameters *codecpar, const uint8_t *extradata, int extradata_size);
+    static bool SameStreamParameters(const AVCodecParameters &parameters, const AVCodecParameters &codecpar, const uint8_t *extradata, int extradata_size);
+    //Keeps the decoder if the parameters of the packet are the same as it was opened with, reopens it otherwise
+    bool UpdateDecoderParameters(bool video, const std::shared_ptr<const AVCodecParameters> &parameters);
+    bool ReopenDecoder(bool video);
     int SendVideoPacket(AVPacket *packet);
     int SendAudioPacket(AVPacket *packet);
     int ReceiveVideoFrame();
     int ReceiveAudioFrame();
 
+    void SetVideoDecodeEffort(bool full);
+    bool IsVideoFrameShown(const VideoFrame &frame) const;
+
     void ClearBuffer();
     int SkipVideoPacket(AVPacket *packet);
     int SkipAudioPacket(AVPacket *packet);
+    void TrimStandbyPacketBuffer();
+
+    void ResetStatistics();
+    void UpdateStatistics();
 
     void StartPushTick();
     void StopPushTick();
@@ -201,12 +235,21 @@ private:
 
     AVBufferRefObject video_decoder_hw_ctx_;
     AVCodecContextObject video_decoder_ctx_, audio_decoder_ctx_;
+    std::shared_ptr<const AVCodecParameters> video_decoder_parameters_, audio_decoder_parameters_; //What the decoder contexts were opened with
     AVPixelFormat video_decoder_hw_pixel_format_;
     SwsContextObject sws_context_;
 
     std::vector<QSharedPointer<VideoFrame>> video_frames_;
     std::vector<QSharedPointer<AudioFrame>> audio_frames_;
     bool open_ = false, playing_ = false, video_eof_ = false, audio_eof_ = false;
+    bool standby_ = false;
+    //Hidden video is decoded with shortcuts and not pushed, it's shown again from the first keyframe sent after becoming visible
+    bool video_visible_ = true, video_resume_pending_ = false;
+    int64_t video_visible_pts_ = AV_NOPTS_VALUE;
+    QSharedPointer<VideoFrameQueue> video_frame_queue_;
+    void *video_output_owner_ = nullptr;
+    QSharedPointer<AudioFrameQueue> audio_frame_queue_;
+    void *audio_frame_queue_owner_ = nullptr;
 
     AVRational video_stream_time_base_, audio_stream_time_base_;
     PlaybackClock::time_point base_time_;
@@ -217,8 +260,18 @@ private:
     PlaybackClock::time_point push_tick_time_;
     bool push_tick_enabled_ = false;
 
+    //Media time is compared with wall time, demuxed_video_pts_ is guarded by demuxer_out_mutex_
+    PlaybackClock::time_point statistics_window_start_;
+    PlaybackClock::duration statistics_decode_time_;
+    int64_t demuxed_video_pts_ = AV_NOPTS_VALUE, decoded_video_pts_ = AV_NOPTS_VALUE;
+    int64_t statistics_demuxed_video_pts_start_, statistics_decoded_video_pts_start_;
+    int statistics_underruns_ = 0;
+
 #ifdef _DEBUG
     PlaybackClock::time_point last_debug_report_;
+    int hidden_video_frames_dropped_ = 0;
+    int video_frames_signaled_ = 0, video_frames_queued_ = 0, video_queue_notifications_ = 0, video_queue_drops_ = 0;
+    int audio_frames_signaled_ = 0, audio_frames_queued_ = 0, audio_queue_drops_ = 0;
 #endif
 };
 
@@ -11,6 +11,7 @@ LiveStreamSource::LiveStreamSource(QObject *parent)
     connect(this, &LiveStreamSource::newInputStream, decoder_, &LiveStreamDecoder::onNewInputStream);
     connect(this, &LiveStreamSource::deleteInputStream, decoder_, &LiveStreamDecoder::onDeleteInputStream);
     connect(this, &LiveStreamSource::clearBuffer, decoder_, &LiveStreamDecoder::onClearBuffer);
+    connect(this, &LiveStreamSource::setStandby, decoder_, &LiveStreamDecoder::onSetStandby);
     connect(this, &LiveStreamSource::setDefaultMediaRecordFile, decoder_, &LiveStreamDecoder::onSetDefaultMediaRecordFile);
     connect(this, &LiveStreamSource::setOneshotMediaRecordFile, decoder_, &LiveStreamDecoder::onSetOneshotMediaRecordFile);
     connect(decoder_, &LiveStreamDecoder::invalidMedia, this, &LiveStreamSource::OnInvalidMediaRedirector);
@@ -42,11 +43,26 @@ void LiveStreamSource::onRequestDeactivate()
     Deactivate();
 }
 
+void LiveStreamSource::onRequestSwitchOption(const QString &option)
+{
+    SwitchOption(option);
+}
+
 void LiveStreamSource::onRequestClearBuffer()
 {
     emit clearBuffer();
 }
 
+void LiveStreamSource::onRequestStandby(bool standby)
+{
+    if (standby_ != standby)
+    {
+        standby_ = standby;
+        emit setStandby(standby);
+        UpdateStandby();
+    }
+}
+
 void LiveStreamSource::onRequestSetRecordPath(const QString &path)
 {
     record_path_ = path;
@@ -78,6 +94,11 @@ void LiveStreamSource::PushData(QIODevice *source)
     return decoder_->PushData(source);
 }
 
+size_t LiveStreamSource::PushDataCapacity()
+{
+    return decoder_->PushDataCapacity();
+}
+
 void LiveStreamSource::EndData()
 {
     return decoder_->EndData();
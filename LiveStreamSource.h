@@ -34,13 +34,16 @@ signals:
     void newInputStream(const QString &url_hint, const QString &record_path);
     void deleteInputStream();
     void clearBuffer();
+    void setStandby(bool standby);
     void setDefaultMediaRecordFile(const QString &file_path);
     void setOneshotMediaRecordFile(const QString &file_path);
 public slots:
     void onRequestUpdateInfo();
     void onRequestActivate(const QString &option);
     void onRequestDeactivate();
+    void onRequestSwitchOption(const QString &option);
     void onRequestClearBuffer();
+    void onRequestStandby(bool standby);
     void onRequestSetRecordPath(const QString &path);
 private slots:
     void OnInvalidMediaRedirector();
@@ -49,15 +52,19 @@ protected:
     void BeginData();
     size_t PushData(const char *data, size_t size);
     void PushData(QIODevice *device);
+    size_t PushDataCapacity();
     void EndData();
     void CloseData();
 
     const QString &RecordPath() const { return record_path_; }
+    bool Standby() const { return standby_; }
 private:
     virtual void UpdateInfo() = 0;
     virtual void Activate(const QString &option) = 0;
     virtual void Deactivate() = 0;
+    virtual void SwitchOption(const QString &option) { Q_UNUSED(option); Deactivate(); } //Model will activate it again with new option
     virtual void UpdateRecordPath() {}
+    virtual void UpdateStandby() {}
     virtual void OnInvalidMedia() {}
     virtual void OnDeleteMedia() {}
 
@@ -65,6 +72,7 @@ private:
     LiveStreamDecoder *decoder_ = nullptr;
 
     QString record_path_;
+    bool standby_ = false;
 };
 
 #endif // LIVESTREAMSOURCE_H
@@ -3,6 +3,50 @@
 
 #include "LiveStreamSourceBilibiliDanmu.h"
 
+Q_LOGGING_CATEGORY(CategorySourceBilibili, "qddm.source")
+
+static constexpr int kMaxReconnectAttempts = 3;
+static constexpr std::chrono::milliseconds kReconnectRetryInterval = 500ms;
+
+static constexpr int kRaceCandidateCount = 3;
+static constexpr qint64 kRaceWinSize = 0x10000;
+static constexpr PlaybackClock::duration kIngestCheckWindow = 5s;
+static constexpr double kIngestRatioFailoverThreshold = 0.9;
+static constexpr int kIngestSlowWindowsBeforeFailover = 2;
+
+struct CdnHostStats
+{
+    double first_data_ms;
+    double ingest_ratio;
+};
+static constexpr double kCdnHostStatsSmoothing = 0.3, kCdnHostUnknownScore = 500, kCdnHostFailedFirstDataMs = 5000;
+static QHash<QString, CdnHostStats> cdn_host_stats; //Shared by all bilibili sources, only accessed from source thread
+
+static void RecordCdnHostFirstData(const QString &host, double first_data_ms)
+{
+    auto itr = cdn_host_stats.find(host);
+    if (itr == cdn_host_stats.end())
+        cdn_host_stats.insert(host, CdnHostStats{ first_data_ms, 1 });
+    else
+        itr->first_data_ms += (first_data_ms - itr->first_data_ms) * kCdnHostStatsSmoothing;
+}
+
+static void RecordCdnHostIngestRatio(const QString &host, double ingest_ratio)
+{
+    auto itr = cdn_host_stats.find(host);
+    if (itr != cdn_host_stats.end())
+        itr->ingest_ratio += (ingest_ratio - itr->ingest_ratio) * kCdnHostStatsSmoothing;
+}
+
+static double CdnHostScore(const QString &host)
+{
+    //Lower is better
+    auto itr = cdn_host_stats.find(host);
+    if (itr == cdn_host_stats.end())
+        return kCdnHostUnknownScore;
+    return itr->first_data_ms / std::max(itr->ingest_ratio, 0.1);
+}
+
 LiveStreamSourceBilibili::LiveStreamSourceBilibili(int room_display_id, QNetworkAccessManager *network_manager, QObject *parent)
     :LiveStreamSource(parent),
     room_display_id_(room_display_id),
@@ -212,7 +256,7 @@ void LiveStreamSourceBilibili::OnRequestRoomInfoComplete()
 
 void LiveStreamSourceBilibili::Activate(const QString &quality_name)
 {
-    if (stream_info_reply_ || av_reply_) //Activating or active
+    if (stream_info_reply_ || av_reply_ || reconnecting_ || !candidates_.empty()) //Activating or active
         return;
 
     if (active_) //Deactivating
@@ -226,8 +270,8 @@ void LiveStreamSourceBilibili::Activate(const QString &quality_name)
         return;
     }
 
-    int quality_chosen = quality_.value(quality_name, -1);
-    if (quality_chosen == -1)
+    quality_chosen_ = quality_.value(quality_name, -1);
+    if (quality_chosen_ == -1)
     {
         emit invalidSourceArgument();
         return;
@@ -239,11 +283,21 @@ void LiveStreamSourceBilibili::Activate(const QString &quality_name)
         return;
     }
 
+    RequestStreamInfo();
+    if (!stream_info_reply_)
+    {
+        emit invalidSourceArgument();
+        return;
+    }
+}
+
+void LiveStreamSourceBilibili::RequestStreamInfo()
+{
     QUrl request_url("https://api.live.bilibili.com/xlive/web-room/v1/playUrl/playUrl");
     QUrlQuery request_query;
     request_query.addQueryItem("cid", QString::number(room_id_));
     request_query.addQueryItem("platform", "web");
-    request_query.addQueryItem("qn", QString::number(quality_chosen));
+    request_query.addQueryItem("qn", QString::number(quality_chosen_));
     request_query.addQueryItem("https_url_req", "1");
     request_query.addQueryItem("ptype", "16");
     request_url.setQuery(request_query);
@@ -252,10 +306,7 @@ void LiveStreamSourceBilibili::Activate(const QString &quality_name)
     request.setRawHeader("User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/88.0.4324.190 Safari/537.36");
     stream_info_reply_ = network_manager_->get(request);
     if (!stream_info_reply_)
-    {
-        emit invalidSourceArgument();
         return;
-    }
     connect(stream_info_reply_, &QNetworkReply::readyRead, this, &LiveStreamSourceBilibili::OnRequestStreamInfoProgress);
     connect(stream_info_reply_, &QNetworkReply::finished, this, &LiveStreamSourceBilibili::OnRequestStreamInfoComplete);
 }
@@ -268,7 +319,10 @@ void LiveStreamSourceBilibili::OnRequestStreamInfoProgress()
     {
         stream_info_reply_->deleteLater();
         stream_info_reply_ = nullptr;
-        emit invalidSourceArgument();
+        if (reconnecting_)
+            Reconnect();
+        else
+            emit invalidSourceArgument();
         return;
     }
 }
@@ -281,56 +335,141 @@ void LiveStreamSourceBilibili::OnRequestStreamInfoComplete()
     stream_info_reply_->deleteLater();
     stream_info_reply_ = nullptr;
 
+    stream_urls_ = ParseStreamUrls(json_doc);
+    if (reconnecting_)
+    {
+        //Keep the decoder open and splice the new stream into it, unless the decoder hasn't even got the file header yet
+        if (!StartRace(stream_urls_, av_data_pushed_))
+            Reconnect();
+        return;
+    }
+
     Q_ASSERT(!active_);
-    do
+    if (StartRace(stream_urls_, false))
     {
-        if (!json_doc.isObject())
-            break;
-        QJsonObject json_object = json_doc.object();
-        int code = (int)json_object.value("code").toDouble(-1);
-        if (code != 0)
-            break;
-        QJsonValue data_value = json_object.value("data");
-        if (!data_value.isObject())
-            break;
-        QJsonObject data_object = data_value.toObject();
+        active_ = true;
+        emit activated();
 
-        QJsonValue durl_value = data_object.value("durl");
-        if (!durl_value.isArray())
-            break;
-        QJsonArray durl = durl_value.toArray();
-        if (durl.empty())
-            break;
+        av_data_pushed_ = false;
+        BeginData();
+        emit newInputStream("stream.flv", RecordPath().isEmpty() ? QString() : QDir(RecordPath()).absoluteFilePath(GenerateRecordFileName()));
 
-        QJsonValue first_url = durl[0].toObject().value("url");
-        if (!first_url.isString())
-            break;
+        if (!Standby()) //Danmu isn't shown for warm sources
+            danmu_source_->Activate(room_id_, 3);
+    }
+    if (!active_)
+    {
+        emit invalidSourceArgument();
+        return;
+    }
+}
+
+QList<QUrl> LiveStreamSourceBilibili::ParseStreamUrls(const QJsonDocument &json_doc)
+{
+    QList<QUrl> urls;
+    if (!json_doc.isObject())
+        return urls;
+    QJsonObject json_object = json_doc.object();
+    int code = (int)json_object.value("code").toDouble(-1);
+    if (code != 0)
+        return urls;
+    QJsonValue data_value = json_object.value("data");
+    if (!data_value.isObject())
+        return urls;
+    QJsonObject data_object = data_value.toObject();
+
+    QJsonValue durl_value = data_object.value("durl");
+    if (!durl_value.isArray())
+        return urls;
+    QJsonArray durl = durl_value.toArray();
+    for (const QJsonValue value : durl)
+    {
+        QJsonValue url_value = value.toObject().value("url");
+        if (url_value.isString())
+            urls.append(QUrl(url_value.toString()));
+    }
+
+    //Prefer hosts that did well before
+    std::stable_sort(urls.begin(), urls.end(), [](const QUrl &lhs, const QUrl &rhs) { return CdnHostScore(lhs.host()) < CdnHostScore(rhs.host()); });
+    return urls;
+}
 
-        QUrl request_url(first_url.toString());
-        QNetworkRequest request(request_url);
+bool LiveStreamSourceBilibili::StartRace(const QList<QUrl> &urls, bool splice)
+{
+    //Open first few candidates at once, the first one delivering kRaceWinSize bytes is kept
+    Q_ASSERT(candidates_.empty());
+    candidates_splice_ = splice;
+    PlaybackClock::time_point start_time = PlaybackClock::now();
+    for (const QUrl &url : urls)
+    {
+        if ((int)candidates_.size() >= kRaceCandidateCount)
+            break;
+        QNetworkRequest request(url);
         request.setAttribute(QNetworkRequest::RedirectPolicyAttribute, QNetworkRequest::NoLessSafeRedirectPolicy);
         request.setMaximumRedirectsAllowed(2);
         request.setRawHeader("User-Agent", "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/88.0.4324.190 Safari/537.36");
         request.setRawHeader("Origin", "https://live.bilibili.com");
         request.setRawHeader("Referer", "https://live.bilibili.com/");
-        av_reply_ = av_network_manager_->get(request);
-        if (!av_reply_)
-            break;
-        active_ = true;
-        emit activated();
+        QNetworkReply *reply = av_network_manager_->get(request);
+        if (!reply)
+            continue;
+        connect(reply, &QNetworkReply::readyRead, this, &LiveStreamSourceBilibili::OnCandidateProgress);
+        connect(reply, &QNetworkReply::finished, this, &LiveStreamSourceBilibili::OnCandidateProgress);
+        candidates_.push_back(StreamCandidate{ reply, url.host(), start_time });
+    }
+    return !candidates_.empty();
+}
 
-        BeginData();
-        emit newInputStream("stream.flv", RecordPath().isEmpty() ? QString() : QDir(RecordPath()).absoluteFilePath(GenerateRecordFileName()));
-        connect(av_reply_, &QNetworkReply::readyRead, this, &LiveStreamSourceBilibili::OnAVStreamProgress);
-        push_timer_->start();
+void LiveStreamSourceBilibili::OnCandidateProgress()
+{
+    auto itr = std::find_if(candidates_.begin(), candidates_.end(), [this](const StreamCandidate &candidate) { return candidate.reply == sender(); });
+    if (itr == candidates_.end())
+        return;
+    QNetworkReply *reply = itr->reply;
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(PlaybackClock::now() - itr->start_time).count();
 
-        danmu_source_->Activate(room_id_, 3);
-    } while (false);
-    if (!active_)
+    if (reply->bytesAvailable() < kRaceWinSize && !reply->isFinished())
+        return;
+    if (reply->bytesAvailable() < kRaceWinSize && (candidates_.size() > 1 || reply->bytesAvailable() <= 0))
     {
-        emit invalidSourceArgument();
+        //Ended before delivering enough data
+        RecordCdnHostFirstData(itr->host, kCdnHostFailedFirstDataMs);
+        qCDebug(CategorySourceBilibili) << "Room" << room_display_id_ << "candidate" << itr->host << "failed:" << reply->errorString();
+        reply->deleteLater();
+        candidates_.erase(itr);
+        if (candidates_.empty())
+            Reconnect();
         return;
     }
+
+    RecordCdnHostFirstData(itr->host, elapsed_ms);
+    qCDebug(CategorySourceBilibili, "Room %d: %s won in %.0fms", room_display_id_, qUtf8Printable(itr->host), elapsed_ms);
+    QString host = itr->host;
+    candidates_.erase(itr);
+    for (const auto &candidate : candidates_)
+    {
+        //Still slower than the winner
+        RecordCdnHostFirstData(candidate.host, elapsed_ms * 2);
+        candidate.reply->deleteLater();
+    }
+    candidates_.clear();
+    disconnect(reply, nullptr, this, nullptr);
+
+    av_reply_ = reply;
+    av_host_ = host;
+    av_aligner_.BeginStream(candidates_splice_);
+    connect(av_reply_, &QNetworkReply::readyRead, this, &LiveStreamSourceBilibili::OnAVStreamProgress);
+    push_timer_->start();
+    ingest_window_started_ = false;
+    ingest_slow_windows_ = 0;
+    PushAVStream();
+}
+
+void LiveStreamSourceBilibili::ClearCandidates()
+{
+    for (const auto &candidate : candidates_)
+        candidate.reply->deleteLater();
+    candidates_.clear();
 }
 
 void LiveStreamSourceBilibili::OnAVStreamProgress()
@@ -338,13 +477,7 @@ void LiveStreamSourceBilibili::OnAVStreamProgress()
     if (!av_reply_ || sender() != av_reply_)
         return;
 
-    PushData(av_reply_);
-    if (av_reply_->isFinished() && av_reply_->bytesAvailable() <= 0)
-    {
-        qDebug() << av_reply_->error() << ' ' << av_reply_->errorString();
-        push_timer_->stop();
-        EndData();
-    }
+    PushAVStream();
 }
 
 void LiveStreamSourceBilibili::OnAVStreamPush()
@@ -354,34 +487,194 @@ void LiveStreamSourceBilibili::OnAVStreamPush()
         push_timer_->stop();
         return;
     }
-    if (av_reply_->bytesAvailable() > 0)
+    PushAVStream();
+}
+
+void LiveStreamSourceBilibili::PushAVStream()
+{
+    qint64 capacity = (qint64)PushDataCapacity() - av_aligner_.PendingSize();
+    if (capacity <= 0)
+        ingest_window_limited_ = true;
+    //The decoder's budget only applies at tag boundaries, the rest of a started tag is always read
+    capacity = std::max(capacity, av_aligner_.MissingSize());
+    av_aligner_.Append(av_reply_, std::min(capacity, av_reply_->bytesAvailable()));
+    QByteArray data = av_aligner_.TakeAlignedData();
+    if (!data.isEmpty())
     {
-        PushData(av_reply_);
+        PushData(data.constData(), data.size());
+        av_data_pushed_ = true;
+        if (reconnecting_)
+        {
+            reconnecting_ = false;
+            reconnect_attempts_ = 0;
+            qCInfo(CategorySourceBilibili, "Room %d reconnected, gap %lldms", room_display_id_,
+                   (long long)std::chrono::duration_cast<std::chrono::milliseconds>(PlaybackClock::now() - reconnect_start_time_).count());
+        }
     }
     if (av_reply_->isFinished() && av_reply_->bytesAvailable() <= 0)
     {
-        qDebug() << av_reply_->error() << ' ' << av_reply_->errorString();
+        qCDebug(CategorySourceBilibili) << av_reply_->error() << ' ' << av_reply_->errorString();
         push_timer_->stop();
+        av_reply_->deleteLater();
+        av_reply_ = nullptr;
+        av_aligner_.EndStream();
+        Reconnect();
+        return;
+    }
+    CheckIngestRate();
+}
+
+void LiveStreamSourceBilibili::CheckIngestRate()
+{
+    //Compare media time received against wall time, a CDN node that can't keep up stutters forever
+    if (!av_aligner_.HasTimestamp())
+        return;
+    PlaybackClock::time_point now = PlaybackClock::now();
+    if (!ingest_window_started_)
+    {
+        ingest_window_started_ = true;
+        ingest_window_limited_ = false;
+        ingest_window_start_ = now;
+        ingest_window_media_start_ = av_aligner_.LastTimestamp();
+        return;
+    }
+    if (now - ingest_window_start_ < kIngestCheckWindow)
+        return;
+
+    double ingest_ratio = std::chrono::duration<double>(av_aligner_.LastTimestamp() - ingest_window_media_start_).count() / std::chrono::duration<double>(now - ingest_window_start_).count();
+    if (!ingest_window_limited_) //Otherwise it's us not reading fast enough
+    {
+        RecordCdnHostIngestRatio(av_host_, ingest_ratio);
+        if (ingest_ratio < kIngestRatioFailoverThreshold)
+            ingest_slow_windows_ += 1;
+        else
+            ingest_slow_windows_ = 0;
+    }
+    ingest_window_limited_ = false;
+    ingest_window_start_ = now;
+    ingest_window_media_start_ = av_aligner_.LastTimestamp();
+
+    if (ingest_slow_windows_ >= kIngestSlowWindowsBeforeFailover)
+        Failover();
+}
+
+void LiveStreamSourceBilibili::Failover()
+{
+    qCInfo(CategorySourceBilibili, "Room %d: %s is too slow, failing over", room_display_id_, qUtf8Printable(av_host_));
+    push_timer_->stop();
+    av_reply_->deleteLater();
+    av_reply_ = nullptr;
+    av_aligner_.EndStream();
+    reconnecting_ = true;
+    reconnect_start_time_ = PlaybackClock::now();
+
+    QList<QUrl> urls;
+    for (const QUrl &url : stream_urls_)
+        if (url.host() != av_host_)
+            urls.append(url);
+    if (!StartRace(urls, av_data_pushed_))
+        Reconnect();
+}
+
+void LiveStreamSourceBilibili::Reconnect()
+{
+    //CDN often closes the response on its own, request a new one and continue on the same decoder
+    if (reconnect_attempts_ >= kMaxReconnectAttempts)
+    {
+        qCWarning(CategorySourceBilibili, "Room %d failed to reconnect after %d attempts", room_display_id_, reconnect_attempts_);
+        reconnecting_ = false;
+        reconnect_attempts_ = 0;
         EndData();
+        return;
+    }
+    if (!reconnecting_)
+    {
+        reconnecting_ = true;
+        reconnect_start_time_ = PlaybackClock::now();
     }
+    reconnect_attempts_ += 1;
+    QTimer::singleShot(kReconnectRetryInterval * (reconnect_attempts_ - 1), this, [this]()
+    {
+        if (!reconnecting_ || stream_info_reply_ || av_reply_ || !candidates_.empty())
+            return;
+        RequestStreamInfo();
+        if (!stream_info_reply_)
+            Reconnect();
+    });
 }
 
 void LiveStreamSourceBilibili::Deactivate()
 {
+    if (reconnecting_ && stream_info_reply_)
+    {
+        stream_info_reply_->deleteLater();
+        stream_info_reply_ = nullptr;
+    }
+    if (av_reply_ || reconnecting_ || !candidates_.empty())
+    {
+        ClearCandidates();
+        push_timer_->stop();
+        if (av_reply_)
+        {
+            av_reply_->close();
+            av_reply_->deleteLater();
+            av_reply_ = nullptr;
+        }
+        reconnecting_ = false;
+        reconnect_attempts_ = 0;
+        CloseData();
+        emit deleteInputStream();
+    }
+}
+
+void LiveStreamSourceBilibili::SwitchOption(const QString &quality_name)
+{
+    int quality_chosen = quality_.value(quality_name, -1);
+    if (quality_chosen == -1)
+    {
+        emit invalidSourceArgument();
+        return;
+    }
+    if (!active_ || quality_chosen == quality_chosen_)
+        return;
+    quality_chosen_ = quality_chosen;
     if (av_reply_)
     {
+        //Splice stream of new quality into the same decoder
         push_timer_->stop();
-        av_reply_->close();
         av_reply_->deleteLater();
         av_reply_ = nullptr;
-        CloseData();
-        emit deleteInputStream();
+        av_aligner_.EndStream();
     }
+    else if (stream_info_reply_)
+    {
+        //Urls of the old quality are being requested, ask again
+        stream_info_reply_->deleteLater();
+        stream_info_reply_ = nullptr;
+    }
+    else if (!candidates_.empty())
+    {
+        //Hosts of the old quality are racing, the winner would be the old quality
+        ClearCandidates();
+    }
+    else
+    {
+        return; //Waiting to reconnect, next stream info request will use new quality
+    }
+    qCInfo(CategorySourceBilibili, "Room %d switching to quality %d", room_display_id_, quality_chosen_);
+    if (!reconnecting_)
+    {
+        reconnecting_ = true;
+        reconnect_start_time_ = PlaybackClock::now();
+    }
+    RequestStreamInfo();
+    if (!stream_info_reply_)
+        Reconnect();
 }
 
 void LiveStreamSourceBilibili::UpdateRecordPath()
 {
-    if (active_ && av_reply_)
+    if (active_)
     {
         if (RecordPath().isEmpty())
         {
@@ -394,6 +687,16 @@ void LiveStreamSourceBilibili::UpdateRecordPath()
     }
 }
 
+void LiveStreamSourceBilibili::UpdateStandby()
+{
+    if (!active_)
+        return;
+    if (Standby())
+        danmu_source_->Deactivate();
+    else
+        danmu_source_->Activate(room_id_, 3);
+}
+
 void LiveStreamSourceBilibili::OnInvalidMedia()
 {
     OnDeleteMedia();
@@ -410,6 +713,17 @@ void LiveStreamSourceBilibili::OnDeleteMedia()
         av_reply_ = nullptr;
         //No need to CloseData since LiveStreamDecoder::Close() has already done that
     }
+    if (reconnecting_)
+    {
+        if (stream_info_reply_)
+        {
+            stream_info_reply_->deleteLater();
+            stream_info_reply_ = nullptr;
+        }
+        reconnecting_ = false;
+        reconnect_attempts_ = 0;
+    }
+    ClearCandidates();
     danmu_source_->Deactivate();
     active_ = false;
     emit deactivated();
@@ -2,6 +2,7 @@
 #define LIVESTREAMSOURCEBILIBILI_H
 
 #include "LiveStreamSource.h"
+#include "FlvTagAligner.h"
 
 class LiveStreamSourceBilibiliDanmu;
 
@@ -9,6 +10,13 @@ class LiveStreamSourceBilibili : public LiveStreamSource
 {
     Q_OBJECT
 
+    struct StreamCandidate
+    {
+        QNetworkReply *reply;
+        QString host;
+        PlaybackClock::time_point start_time;
+    };
+
 public:
     explicit LiveStreamSourceBilibili(int room_display_id, QNetworkAccessManager *network_manager, QObject *parent = nullptr);
     ~LiveStreamSourceBilibili();
@@ -25,16 +33,28 @@ private slots:
     void OnRequestRoomInfoComplete();
     void OnRequestStreamInfoProgress();
     void OnRequestStreamInfoComplete();
+    void OnCandidateProgress();
     void OnAVStreamProgress();
     void OnAVStreamPush();
 private:
     virtual void UpdateInfo() override;
     virtual void Activate(const QString &option) override;
     virtual void Deactivate() override;
+    virtual void SwitchOption(const QString &option) override;
     virtual void UpdateRecordPath() override;
+    virtual void UpdateStandby() override;
     virtual void OnInvalidMedia() override;
     virtual void OnDeleteMedia() override;
 
+    void RequestStreamInfo();
+    static QList<QUrl> ParseStreamUrls(const QJsonDocument &json_doc);
+    bool StartRace(const QList<QUrl> &urls, bool splice);
+    void ClearCandidates();
+    void PushAVStream();
+    void CheckIngestRate();
+    void Failover();
+    void Reconnect();
+
     QString GenerateRecordFileName() const;
 
     int room_display_id_ = -1, room_id_ = -1;
@@ -43,11 +63,27 @@ private:
     QHash<QString, int> quality_;
 
     bool active_ = false;
+    int quality_chosen_ = -1;
     QString pending_option_;
     QNetworkAccessManager *network_manager_ = nullptr, *av_network_manager_ = nullptr;
     QNetworkReply *info_reply_ = nullptr, *stream_info_reply_ = nullptr, *av_reply_ = nullptr;
     LiveStreamSourceBilibiliDanmu *danmu_source_ = nullptr;
     QTimer *push_timer_ = nullptr;
+    QList<QUrl> stream_urls_;
+    std::vector<StreamCandidate> candidates_;
+    bool candidates_splice_ = false;
+    QString av_host_;
+    FlvTagAligner av_aligner_;
+    bool av_data_pushed_ = false;
+
+    bool ingest_window_started_ = false, ingest_window_limited_ = false;
+    PlaybackClock::time_point ingest_window_start_;
+    std::chrono::milliseconds ingest_window_media_start_;
+    int ingest_slow_windows_ = 0;
+
+    bool reconnecting_ = false;
+    int reconnect_attempts_ = 0;
+    PlaybackClock::time_point reconnect_start_time_;
 };
 
 #endif // LIVESTREAMSOURCEBILIBILI_H
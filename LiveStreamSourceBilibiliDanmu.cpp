@@ -2,6 +2,7 @@
 #include "LiveStreamSourceBilibiliDanmu.h"
 
 #include "LiveStreamSourceBilibili.h"
+#include "DanmuJsonScanner.h"
 
 namespace
 {
@@ -78,6 +79,22 @@ LiveStreamSourceBilibiliDanmu::LiveStreamSourceBilibiliDanmu(QNetworkAccessManag
 {
     connect(chatroom_heartbeat_timer_, &QTimer::timeout, this, &LiveStreamSourceBilibiliDanmu::OnChatroomSocketHeartbeatTick);
     chatroom_heartbeat_timer_->setInterval(30000);
+
+    command_handlers_.insert(QByteArrayLiteral("DANMU_MSG"), &LiveStreamSourceBilibiliDanmu::HandleDanmuMessage);
+
+#ifdef _DEBUG
+    QString capture_file_name = qEnvironmentVariable("QDDM_DANMU_CAPTURE");
+    if (!capture_file_name.isEmpty())
+    {
+        //Unbuffered so records of several chatrooms appending to the same file don't interleave
+        capture_file_.setFileName(capture_file_name);
+        if (!capture_file_.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Unbuffered))
+            qWarning() << "Can't open danmu capture file " << capture_file_name;
+    }
+    QString replay_file_name = qEnvironmentVariable("QDDM_DANMU_REPLAY");
+    if (!replay_file_name.isEmpty())
+        QTimer::singleShot(0, this, [this, replay_file_name]() { ReplayCapture(replay_file_name); });
+#endif
 }
 
 void LiveStreamSourceBilibiliDanmu::Activate(int room_id, int retry_left)
@@ -275,9 +292,29 @@ void LiveStreamSourceBilibiliDanmu::OnChatroomSocketBinaryMessage(const QByteArr
 {
     if (!chatroom_socket_)
         return;
+#ifdef _DEBUG
+    if (capture_file_.isOpen())
+    {
+        QByteArray record(4, Qt::Uninitialized);
+        qToBigEndian<quint32>(message.size(), record.data());
+        capture_file_.write(record + message);
+    }
+#endif
+    if (!ProcessMessage(message))
+        chatroom_socket_->close();
+#ifdef _DEBUG
+    ReportStatistics();
+#endif
+}
 
+bool LiveStreamSourceBilibiliDanmu::ProcessMessage(const QByteArray &message)
+{
     if (message.size() < (int)kPacketHeaderSize)
-        return;
+        return true;
+#ifdef _DEBUG
+    messages_per_second_ += 1;
+    bytes_per_second_ += message.size();
+#endif
     PacketHeader message_header;
     DecodePacketHeader(message_header, message.data());
 
@@ -291,7 +328,7 @@ void LiveStreamSourceBilibiliDanmu::OnChatroomSocketBinaryMessage(const QByteArr
         if (err != Z_OK)
         {
             qWarning() << "Error while decompression, code " << err;
-            return;
+            return true;
         }
         payload = uncompressed_data.data();
         payload_size = uncompressed_data.size();
@@ -318,43 +355,7 @@ void LiveStreamSourceBilibiliDanmu::OnChatroomSocketBinaryMessage(const QByteArr
         case PROTOCOL_VERSION_RAW_JSON:
         case PROTOCOL_VERSION_ZLIB_JSON:
         {
-            if (packet_payload_size > (size_t)std::numeric_limits<int>::max())
-                break;
-            QJsonDocument json_doc = QJsonDocument::fromJson(QByteArray::fromRawData(packet_payload, packet_payload_size));
-            if (!json_doc.isObject())
-                break;
-            QJsonObject packet_object = json_doc.object();
-            QString command = packet_object.value("cmd").toString();
-
-            //TODO: Use a QHash<QString, ?> instead of a bunch of if. Even QHash<QString, int> and a switch would be better
-            if (command == "DANMU_MSG")
-            {
-                QJsonArray info = packet_object.value("info").toArray();
-                if (info.size() < 2)
-                    break;
-
-                QString content = info[1].toString();
-                if (content.isEmpty())
-                    break;
-                QSharedPointer<SubtitleFrame> danmu_frame = QSharedPointer<SubtitleFrame>::create();
-                danmu_frame->content = content;
-
-                QJsonArray style = info[0].toArray();
-                //qDebug() << style;
-                if (style.size() >= 4)
-                {
-                    quint32 color_value = (quint32)style[3].toDouble(0xFFFFFF);
-                    danmu_frame->color = QColor((quint8)(color_value >> 16), (quint8)(color_value >> 8), (quint8)(color_value), 0xFF);
-                    danmu_frame->style = SubtitleStyle::NORMAL;
-                }
-                else
-                {
-                    danmu_frame->color = QColor(0xFF, 0xFF, 0xFF, 0xFF);
-                    danmu_frame->style = SubtitleStyle::NORMAL;
-                }
-                parent_->OnNewDanmu(danmu_frame);
-            }
-
+            DispatchNotice(packet_payload, packet_payload_size);
             break;
         }
         case PROTOCOL_VERSION_HEARTBEAT:
@@ -369,8 +370,7 @@ void LiveStreamSourceBilibiliDanmu::OnChatroomSocketBinaryMessage(const QByteArr
                 if (packet_object.value("code").toDouble(-1) != 0)
                 {
                     qWarning() << "Chatfoom verification failed";
-                    chatroom_socket_->close();
-                    return;
+                    return false;
                 }
                 else
                 {
@@ -384,7 +384,124 @@ void LiveStreamSourceBilibiliDanmu::OnChatroomSocketBinaryMessage(const QByteArr
         payload += packet_size;
         payload_size -= packet_size;
     }
+    return true;
+}
+
+void LiveStreamSourceBilibiliDanmu::DispatchNotice(const char *packet, size_t packet_size)
+{
+#ifdef _DEBUG
+    notices_per_second_ += 1;
+    PlaybackClock::time_point scan_begin = PlaybackClock::now();
+#endif
+    //Only the command is read here, most notices are of commands nobody subscribed to
+    DanmuJsonScanner scanner(packet, packet_size);
+    const char *command;
+    size_t command_size;
+    bool found = scanner.BeginObject() && scanner.FindMember(QLatin1String("cmd")) && scanner.ReadRawString(command, command_size);
+#ifdef _DEBUG
+    PlaybackClock::time_point handle_begin = PlaybackClock::now();
+    scan_time_ += handle_begin - scan_begin;
+#endif
+    if (!found)
+        return;
+    //Some commands carry a suffix of protocol options, like DANMU_MSG:4:0:2:2:2:0
+    const char *suffix = (const char *)memchr(command, ':', command_size);
+    if (suffix)
+        command_size = suffix - command;
+    CommandHandler handler = command_handlers_.value(QByteArray::fromRawData(command, (int)command_size), nullptr);
+    if (!handler)
+        return;
+    (this->*handler)(packet, packet_size);
+#ifdef _DEBUG
+    handled_per_second_ += 1;
+    handle_time_ += PlaybackClock::now() - handle_begin;
+#endif
+}
+
+void LiveStreamSourceBilibiliDanmu::HandleDanmuMessage(const char *packet, size_t packet_size)
+{
+    //Reads info[0][3] as the color and info[1] as the content, the rest of info is skipped
+    DanmuJsonScanner scanner(packet, packet_size);
+    if (!scanner.BeginObject() || !scanner.FindMember(QLatin1String("info")) || !scanner.BeginArray())
+        return;
+
+    quint32 color_value = 0xFFFFFF;
+    if (!scanner.NextElement())
+        return;
+    if (scanner.AtArray())
+    {
+        scanner.BeginArray();
+        for (int index = 0; scanner.NextElement(); ++index)
+        {
+            double value;
+            if (index == 3 && scanner.ReadNumber(value))
+                color_value = (quint32)value;
+            else if (!scanner.SkipValue())
+                return;
+        }
+    }
+    else if (!scanner.SkipValue())
+    {
+        return;
+    }
+    if (scanner.Failed() || !scanner.NextElement())
+        return;
+
+    QSharedPointer<SubtitleFrame> danmu_frame = QSharedPointer<SubtitleFrame>::create();
+    if (!scanner.ReadString(danmu_frame->content) || danmu_frame->content.isEmpty())
+        return;
+    danmu_frame->color = QColor((quint8)(color_value >> 16), (quint8)(color_value >> 8), (quint8)(color_value), 0xFF);
+    danmu_frame->style = SubtitleStyle::NORMAL;
+    parent_->OnNewDanmu(danmu_frame);
+}
+
+#ifdef _DEBUG
+void LiveStreamSourceBilibiliDanmu::ReportStatistics()
+{
+    PlaybackClock::time_point current_time = PlaybackClock::now();
+    if (current_time - last_debug_report_ < std::chrono::seconds(1))
+        return;
+    last_debug_report_ = current_time;
+    qDebug() << "Chatroom " << room_id_ << ": " << messages_per_second_ << " messages, " << bytes_per_second_ / 1024 << "KiB, "
+             << notices_per_second_ << " notices, " << handled_per_second_ << " handled";
+    qDebug() << "Chatroom " << room_id_ << ": " << std::chrono::duration_cast<std::chrono::microseconds>(scan_time_).count() << "us scanning commands, "
+             << std::chrono::duration_cast<std::chrono::microseconds>(handle_time_).count() << "us in handlers";
+    messages_per_second_ = notices_per_second_ = handled_per_second_ = 0;
+    bytes_per_second_ = 0;
+    scan_time_ = handle_time_ = PlaybackClock::duration::zero();
+}
+
+void LiveStreamSourceBilibiliDanmu::ReplayCapture(const QString &file_name)
+{
+    //Runs a QDDM_DANMU_CAPTURE file through the parser at once, handled danmu are shown as usual
+    QFile file(file_name);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "Can't open danmu capture file " << file_name;
+        return;
+    }
+    QByteArray capture = file.readAll();
+    std::vector<QByteArray> messages;
+    for (int offset = 0; capture.size() - offset >= 4;)
+    {
+        int size = (int)qFromBigEndian<quint32>(capture.constData() + offset);
+        offset += 4;
+        if (size < 0 || size > capture.size() - offset)
+            break;
+        messages.push_back(capture.mid(offset, size));
+        offset += size;
+    }
+
+    PlaybackClock::time_point replay_begin = PlaybackClock::now();
+    for (const QByteArray &message : messages)
+        ProcessMessage(message);
+    PlaybackClock::duration replay_time = PlaybackClock::now() - replay_begin;
+    qDebug() << "Replayed " << messages.size() << " messages, " << capture.size() / 1024 << "KiB in "
+             << std::chrono::duration_cast<std::chrono::microseconds>(replay_time).count() << "us, "
+             << notices_per_second_ << " notices, " << handled_per_second_ << " handled, "
+             << std::chrono::duration_cast<std::chrono::microseconds>(scan_time_).count() << "us scanning commands";
 }
+#endif
 
 size_t LiveStreamSourceBilibiliDanmu::MakePacket(QByteArray &buffer, ProtocolVersion protocol_version, PacketType packet_type, size_t payload_size)
 {
@@ -30,6 +30,8 @@ class LiveStreamSourceBilibiliDanmu : public QObject
         quint16 reserved_16, protocol_version;
         quint32 packet_type, reserved_1;
     };
+    //Gets the whole JSON text of a notice packet whose command it's registered for
+    using CommandHandler = void (LiveStreamSourceBilibiliDanmu::*)(const char *packet, size_t packet_size);
 public:
     explicit LiveStreamSourceBilibiliDanmu(QNetworkAccessManager *network_manager, LiveStreamSourceBilibili *parent);
 
@@ -50,6 +52,15 @@ private:
     void FinishPacket(QByteArray &buffer);
     void DecodePacketHeader(PacketHeader &header, const char *src);
 
+    //False if the connection should be closed
+    bool ProcessMessage(const QByteArray &message);
+    void DispatchNotice(const char *packet, size_t packet_size);
+    void HandleDanmuMessage(const char *packet, size_t packet_size);
+#ifdef _DEBUG
+    void ReportStatistics();
+    void ReplayCapture(const QString &file_name);
+#endif
+
     LiveStreamSourceBilibili *parent_ = nullptr;
 
     int room_id_ = -1, retry_left_ = -1;
@@ -60,6 +71,16 @@ private:
     QNetworkReply *chatroom_info_reply_ = nullptr;
     QWebSocket *chatroom_socket_ = nullptr;
     QTimer *chatroom_heartbeat_timer_ = nullptr;
+
+    QHash<QByteArray, CommandHandler> command_handlers_; //Notices of other commands are dropped after reading only their command
+
+#ifdef _DEBUG
+    QFile capture_file_; //QDDM_DANMU_CAPTURE, every received message prefixed with its big endian size
+    PlaybackClock::time_point last_debug_report_;
+    PlaybackClock::duration scan_time_ = PlaybackClock::duration::zero(), handle_time_ = PlaybackClock::duration::zero();
+    int messages_per_second_ = 0, notices_per_second_ = 0, handled_per_second_ = 0;
+    size_t bytes_per_second_ = 0;
+#endif
 };
 
 #endif // LIVESTREAMSOURCEBILIBILIDANMU_H
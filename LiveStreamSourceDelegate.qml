@@ -51,6 +51,8 @@ Item {
                     Layout.preferredWidth: parent.height
                     radius: width * 0.5
                     color: display.online ? "green" : "red"
+                    border.color: display.warm ? "orange" : "transparent"
+                    border.width: 2
                 }
 
                 Text {
@@ -65,6 +67,29 @@ Item {
                     text: display.name
                 }
 
+                Rectangle {
+                    Layout.preferredHeight: parent.height
+                    Layout.preferredWidth: parent.height
+
+                    border.color: "black"
+                    border.width: 1
+                    color: display.pinned ? "orange" : "lightgray";
+
+                    Text {
+                        anchors.centerIn: parent
+                        font.pixelSize: parent.height - 4
+                        text: "P"
+                    }
+
+                    MouseArea {
+                        anchors.fill: parent
+
+                        onClicked: {
+                            sourceModelMain.setSourcePinned(display.id, !display.pinned);
+                        }
+                    }
+                }
+
                 Button {
                     Layout.preferredHeight: parent.height
                     Layout.preferredWidth: parent.height
@@ -83,6 +108,16 @@ Item {
                 }
             }
 
+            Text {
+                Layout.fillWidth: true
+                visible: display.abrStatus !== ""
+
+                font.pixelSize: 12
+                color: "darkorange"
+
+                text: display.effectiveOption + " - " + display.abrStatus
+            }
+
             Image {
                 Layout.fillWidth: true
                 Layout.preferredHeight: width * 0.5617 //470x264
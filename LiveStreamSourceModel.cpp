@@ -2,11 +2,21 @@
 #include "LiveStreamSourceModel.h"
 
 #include "LiveStreamSource.h"
+#include "LiveStreamDecoder.h"
 #include "LiveStreamSourceBilibili.h"
 #include "LiveStreamSourceFile.h"
 
 Q_LOGGING_CATEGORY(CategorySourceControl, "qddm.sourcectrl")
 
+//Each warm source costs one stream connection plus at most a few seconds of demuxed packets, so the budget is counted in sources
+static constexpr int kDefaultWarmSourceLimit = 4;
+static constexpr size_t kRecentSourceHistorySize = 16;
+
+//Quality control works on decoder statistics reported every 2s, lower quickly but raise slowly to avoid flapping
+static constexpr qreal kAbrIngestRatioLow = 0.9, kAbrIngestRatioHigh = 0.98;
+static constexpr qreal kAbrDecodeSpeedLow = 1.1, kAbrDecodeSpeedHigh = 1.5;
+static constexpr int kAbrDownshiftReports = 2, kAbrUpshiftReports = 30, kAbrIgnoredReportsAfterSwitch = 2;
+
 void LiveStreamSourceInfo::setOptionIndex(int new_option_index)
 {
     if (new_option_index < 0 || new_option_index >= available_options_.size())
@@ -48,17 +58,32 @@ void LiveStreamSourceInfo::setAvailableOptions(const QList<QString> &new_availab
     }
 }
 
+void LiveStreamSourceInfo::setAbrOffset(int new_abr_offset)
+{
+    if (new_abr_offset < 0)
+        new_abr_offset = 0;
+    if (abr_offset_ != new_abr_offset)
+    {
+        QString old_effective_option = effectiveOption();
+
+        abr_offset_ = new_abr_offset;
+
+        if (old_effective_option != effectiveOption())
+            emit effectiveOptionChanged();
+    }
+}
+
 QString LiveStreamSourceInfo::effectiveOption() const
 {
-    if (option_index_ != -1)
-        return available_options_[option_index_];
-    if (!available_options_.empty())
-        return available_options_.front();
-    return QString();
+    //Options are listed from highest quality to lowest
+    if (available_options_.empty())
+        return QString();
+    int index = std::min((option_index_ != -1 ? option_index_ : 0) + abr_offset_, (int)available_options_.size() - 1);
+    return available_options_[index];
 }
 
 LiveStreamSourceModel::LiveStreamSourceModel(QObject *parent)
-    :QAbstractListModel(parent), source_network_manager_(new QNetworkAccessManager)
+    :QAbstractListModel(parent), source_network_manager_(new QNetworkAccessManager), warm_source_limit_(kDefaultWarmSourceLimit)
 {
     source_network_manager_->moveToThread(&source_thread_);
     connect(&source_thread_, &QThread::finished, source_network_manager_, &QObject::deleteLater);
@@ -109,6 +134,18 @@ QVariant LiveStreamSourceModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+void LiveStreamSourceModel::setWarmSourceLimit(int new_warm_source_limit)
+{
+    if (new_warm_source_limit < 0)
+        new_warm_source_limit = 0;
+    if (warm_source_limit_ != new_warm_source_limit)
+    {
+        warm_source_limit_ = new_warm_source_limit;
+        UpdateWarmSources();
+        emit warmSourceLimitChanged();
+    }
+}
+
 void LiveStreamSourceModel::addFileSource(const QString &name, const QString &path)
 {
     AddSource(new LiveStreamSourceFile(path), name);
@@ -127,6 +164,10 @@ void LiveStreamSourceModel::setSourceOption(int id, int option_index)
         LiveStreamSourceInfo *source_info = itr->second.get();
         QString effective_option = source_info->effectiveOption();
         source_info->setOptionIndex(option_index);
+        //Manual choice overrides quality control
+        source_info->setAbrOffset(0);
+        source_info->setAbrStatus(QString());
+        abr_states_.erase(id);
         if (effective_option != source_info->effectiveOption())
             DeactivateSource(source_info->source());
     }
@@ -150,6 +191,20 @@ void LiveStreamSourceModel::setSourceRecording(int id, bool enabled)
     }
 }
 
+void LiveStreamSourceModel::setSourcePinned(int id, bool pinned)
+{
+    auto itr = sources_.find(id);
+    if (itr != sources_.end())
+    {
+        LiveStreamSourceInfo *source_info = itr->second.get();
+        if (source_info->pinned() != pinned)
+        {
+            source_info->setPinned(pinned);
+            UpdateWarmSources();
+        }
+    }
+}
+
 void LiveStreamSourceModel::clearSourceBuffer(int id)
 {
     auto itr = sources_.find(id);
@@ -179,8 +234,12 @@ void LiveStreamSourceModel::removeSourceById(int id)
 
         emit deleteSource(id);
         activated_sources_.erase(id);
+        warm_sources_.erase(id);
+        abr_states_.erase(id);
+        recent_sources_.erase(std::remove(recent_sources_.begin(), recent_sources_.end(), id), recent_sources_.end());
         itr->second->source()->deleteLater();
         sources_.erase(itr);
+        UpdateWarmSources();
     }
 }
 
@@ -201,8 +260,12 @@ void LiveStreamSourceModel::removeSourceByIndex(int index)
         {
             emit deleteSource(id);
             activated_sources_.erase(id);
+            warm_sources_.erase(id);
+            abr_states_.erase(id);
+            recent_sources_.erase(std::remove(recent_sources_.begin(), recent_sources_.end(), id), recent_sources_.end());
             itr->second->source()->deleteLater();
             sources_.erase(itr);
+            UpdateWarmSources();
         }
     }
 }
@@ -217,8 +280,8 @@ LiveStreamSourceInfo *LiveStreamSourceModel::ActivateAndGetSource(int source_id)
     activated_sources_.emplace(source_id);
 
     LiveStreamSourceInfo *source_info = itr->second.get();
-    if (source_info->online() && !source_info->activated())
-        ActivateSource(source_info->source(), source_info->effectiveOption());
+    PromoteSource(source_id, source_info);
+    UpdateWarmSources();
 
     return source_info;
 }
@@ -226,11 +289,7 @@ LiveStreamSourceInfo *LiveStreamSourceModel::ActivateAndGetSource(int source_id)
 void LiveStreamSourceModel::DeactivateSingleSource(int source_id)
 {
     if (activated_sources_.erase(source_id) > 0)
-    {
-        auto itr = sources_.find(source_id);
-        if (itr != sources_.end() && itr->second->activated())
-            DeactivateSource(itr->second->source());
-    }
+        ReleaseSources({ source_id });
 }
 
 void LiveStreamSourceModel::ActivateAndGetSources(std::vector<std::pair<int, LiveStreamSourceInfo *>> &sources)
@@ -249,51 +308,33 @@ void LiveStreamSourceModel::ActivateAndGetSources(std::vector<std::pair<int, Liv
             LiveStreamSourceInfo *source_info = itr->second.get();
             p.second = source_info;
 
-            auto itr_activated = activated_sources_.find(p.first);
-            if (itr_activated == activated_sources_.end())
+            //Unmark it now so that everything left in activated_sources_ should be released
+            if (activated_sources_.erase(p.first) == 0)
             {
                 //Not previously marked as activated
-                if (source_info->online() && !source_info->activated())
-                {
-                    //Not activated yet and online, activate
-                    ActivateSource(source_info->source(), source_info->effectiveOption());
-                }
-            }
-            else
-            {
-                //Unmark it now so that everything left in activated_sources_ should be deactivated
-                activated_sources_.erase(itr_activated);
+                PromoteSource(p.first, source_info);
             }
         }
     }
-    for (int id : activated_sources_)
-    {
-        auto itr = sources_.find(id);
-        if (itr != sources_.end() && itr->second->activated())
-        {
-            DeactivateSource(itr->second->source());
-        }
-    }
+    std::vector<int> released_sources(activated_sources_.begin(), activated_sources_.end());
     activated_sources_ = std::move(new_activated_sources);
+    ReleaseSources(released_sources);
 }
 
 void LiveStreamSourceModel::DeactivateAllSource()
 {
-    for (int id : activated_sources_)
-    {
-        auto itr = sources_.find(id);
-        if (itr != sources_.end() && itr->second->activated())
-            DeactivateSource(itr->second->source());
-    }
+    std::vector<int> released_sources(activated_sources_.begin(), activated_sources_.end());
     activated_sources_.clear();
+    ReleaseSources(released_sources);
 }
 
-void LiveStreamSourceModel::AddSource(LiveStreamSource *source, const QString &name)
+int LiveStreamSourceModel::AddSource(LiveStreamSource *source, const QString &name)
 {
     int id = next_id_++;
     source->moveToThread(&source_thread_);
     connect(source, &LiveStreamSource::activated, this, [this, id]() { OnActivated(id); });
     connect(source, &LiveStreamSource::deactivated, this, [this, id]() { OnDeactivated(id); });
+    connect(source->decoder(), &LiveStreamDecoder::statisticsUpdated, this, [this, id](qreal ingest_ratio, qreal decode_speed, int underruns) { OnStatisticsUpdated(id, ingest_ratio, decode_speed, underruns); });
     connect(&source_thread_, &QThread::finished, source, &QObject::deleteLater);
     sources_.emplace(id, std::make_unique<LiveStreamSourceInfo>(id, source, name, this));
 
@@ -302,6 +343,7 @@ void LiveStreamSourceModel::AddSource(LiveStreamSource *source, const QString &n
     sources_index_.push_back(id);
     endInsertRows();
     emit newSource(id);
+    return id;
 }
 
 int LiveStreamSourceModel::FindSourceIndex(int id)
@@ -312,6 +354,85 @@ int LiveStreamSourceModel::FindSourceIndex(int id)
     return -1;
 }
 
+void LiveStreamSourceModel::PromoteSource(int id, LiveStreamSourceInfo *source_info)
+{
+    if (warm_sources_.erase(id) > 0)
+    {
+        source_info->setWarm(false);
+        qCDebug(CategorySourceControl, "Source %d promoted from standby", id);
+    }
+    StandbySource(source_info->source(), false);
+    if (source_info->online() && !source_info->activated())
+        ActivateSource(source_info->source(), source_info->effectiveOption());
+}
+
+void LiveStreamSourceModel::ReleaseSources(const std::vector<int> &ids)
+{
+    //Must be already removed from activated_sources_
+    for (int id : ids)
+    {
+        recent_sources_.erase(std::remove(recent_sources_.begin(), recent_sources_.end(), id), recent_sources_.end());
+        recent_sources_.insert(recent_sources_.begin(), id);
+    }
+    if (recent_sources_.size() > kRecentSourceHistorySize)
+        recent_sources_.resize(kRecentSourceHistorySize);
+
+    UpdateWarmSources();
+
+    for (int id : ids)
+    {
+        auto itr = sources_.find(id);
+        if (itr != sources_.end() && itr->second->activated() && !IsSourceWanted(id))
+            DeactivateSource(itr->second->source());
+    }
+}
+
+void LiveStreamSourceModel::UpdateWarmSources()
+{
+    std::unordered_set<int> new_warm_sources;
+    auto add_candidate = [this, &new_warm_sources](int id)
+    {
+        if ((int)new_warm_sources.size() >= warm_source_limit_ || activated_sources_.count(id) > 0)
+            return;
+        auto itr = sources_.find(id);
+        if (itr != sources_.end() && itr->second->online())
+            new_warm_sources.insert(id);
+    };
+    for (int id : sources_index_)
+    {
+        auto itr = sources_.find(id);
+        if (itr != sources_.end() && itr->second->pinned())
+            add_candidate(id);
+    }
+    for (int id : recent_sources_)
+        add_candidate(id);
+
+    for (int id : warm_sources_)
+    {
+        if (new_warm_sources.count(id) > 0)
+            continue;
+        auto itr = sources_.find(id);
+        if (itr == sources_.end())
+            continue;
+        itr->second->setWarm(false);
+        qCDebug(CategorySourceControl, "Source %d dropped from standby", id);
+        if (activated_sources_.count(id) == 0 && itr->second->activated())
+            DeactivateSource(itr->second->source());
+    }
+    for (int id : new_warm_sources)
+    {
+        if (warm_sources_.count(id) > 0)
+            continue;
+        LiveStreamSourceInfo *source_info = sources_.find(id)->second.get();
+        source_info->setWarm(true);
+        qCDebug(CategorySourceControl, "Source %d kept in standby", id);
+        StandbySource(source_info->source(), true);
+        if (!source_info->activated())
+            ActivateSource(source_info->source(), source_info->effectiveOption());
+    }
+    warm_sources_ = std::move(new_warm_sources);
+}
+
 void LiveStreamSourceModel::OnActivated(int id)
 {
     auto itr = sources_.find(id);
@@ -320,7 +441,7 @@ void LiveStreamSourceModel::OnActivated(int id)
     itr->second->setActivated(true);
     qCDebug(CategorySourceControl, "Source %d activated", id);
 
-    if (activated_sources_.count(id) == 0)
+    if (!IsSourceWanted(id))
         DeactivateSource(itr->second->source());
 }
 
@@ -332,10 +453,76 @@ void LiveStreamSourceModel::OnDeactivated(int id)
     itr->second->setActivated(false);
     qCDebug(CategorySourceControl, "Source %d deactivated", id);
 
-    if (itr->second->online() && activated_sources_.count(id) > 0)
+    if (itr->second->online() && IsSourceWanted(id))
         ActivateSource(itr->second->source(), itr->second->effectiveOption());
 }
 
+void LiveStreamSourceModel::OnStatisticsUpdated(int id, qreal ingest_ratio, qreal decode_speed, int underruns)
+{
+    auto itr = sources_.find(id);
+    if (itr == sources_.end())
+        return;
+    LiveStreamSourceInfo *source_info = itr->second.get();
+    AbrState &state = abr_states_[id];
+    qCDebug(CategorySourceControl, "Source %d: ingest %.2fx, decode %.2fx, %d underruns", id, ingest_ratio, decode_speed, underruns);
+    if (state.ignored_reports > 0)
+    {
+        state.ignored_reports -= 1;
+        return;
+    }
+
+    QString reason;
+    if (ingest_ratio < kAbrIngestRatioLow)
+        reason = QStringLiteral("network %1x").arg(ingest_ratio, 0, 'f', 2);
+    else if (decode_speed < kAbrDecodeSpeedLow)
+        reason = QStringLiteral("decode %1x").arg(decode_speed, 0, 'f', 2);
+    else if (underruns > 0)
+        reason = QStringLiteral("%1 underruns").arg(underruns);
+
+    if (!reason.isEmpty())
+    {
+        state.bad_reports += 1;
+        state.good_reports = 0;
+    }
+    else if (ingest_ratio >= kAbrIngestRatioHigh && decode_speed >= kAbrDecodeSpeedHigh)
+    {
+        state.bad_reports = 0;
+        state.good_reports += 1;
+    }
+    else
+    {
+        state.bad_reports = 0; //Hold
+    }
+
+    int abr_offset = source_info->abrOffset();
+    int option_index = std::max(source_info->optionIndex(), 0);
+    if (state.bad_reports >= kAbrDownshiftReports && option_index + abr_offset + 1 < (int)source_info->availableOptions().size())
+    {
+        SetSourceAbrOffset(source_info, abr_offset + 1, QStringLiteral("Lowered (%1)").arg(reason));
+    }
+    else if (state.good_reports >= kAbrUpshiftReports && abr_offset > 0)
+    {
+        SetSourceAbrOffset(source_info, abr_offset - 1, abr_offset - 1 > 0 ? QStringLiteral("Raising") : QString());
+    }
+}
+
+void LiveStreamSourceModel::SetSourceAbrOffset(LiveStreamSourceInfo *source_info, int abr_offset, const QString &abr_status)
+{
+    AbrState &state = abr_states_[source_info->id()];
+    state.bad_reports = state.good_reports = 0;
+    state.ignored_reports = kAbrIgnoredReportsAfterSwitch;
+
+    QString effective_option = source_info->effectiveOption();
+    source_info->setAbrOffset(abr_offset);
+    source_info->setAbrStatus(abr_status);
+    if (effective_option != source_info->effectiveOption())
+    {
+        qCDebug(CategorySourceControl) << "Source" << source_info->id() << "quality" << effective_option << "->" << source_info->effectiveOption() << abr_status;
+        if (source_info->activated())
+            SwitchSourceOption(source_info->source(), source_info->effectiveOption());
+    }
+}
+
 void LiveStreamSourceModel::StartUpdateSources()
 {
     if (sources_updated_count_ != -1)
@@ -392,11 +579,12 @@ void LiveStreamSourceModel::UpdateSingleSourceDone(int status, const QString &de
     source_info.setCover(cover);
     source_info.setAvailableOptions(options);
 
+    bool was_online = source_info.online();
     if (status == LiveStreamSource::STATUS_ONLINE && source_info.online() == false)
     {
         source_info.setOnline(true);
         //If marked as activated but not active, activate
-        if (!source_info.activated() && activated_sources_.count(id) > 0)
+        if (!source_info.activated() && IsSourceWanted(id))
         {
             ActivateSource(source_info.source(), source_info.effectiveOption());
         }
@@ -460,6 +648,8 @@ void LiveStreamSourceModel::UpdateSingleSourceDone(int status, const QString &de
             }
         }
     }
+    if (source_info.online() != was_online)
+        UpdateWarmSources();
 
     sources_updated_count_ += 1;
     ContinueUpdateSources();
@@ -481,11 +671,21 @@ void LiveStreamSourceModel::DeactivateSource(LiveStreamSource *source)
     QMetaObject::invokeMethod(source, "onRequestDeactivate");
 }
 
+void LiveStreamSourceModel::SwitchSourceOption(LiveStreamSource *source, const QString &option)
+{
+    QMetaObject::invokeMethod(source, "onRequestSwitchOption", Q_ARG(QString, option));
+}
+
 void LiveStreamSourceModel::ClearSourceBuffer(LiveStreamSource *source)
 {
     QMetaObject::invokeMethod(source, "onRequestClearBuffer");
 }
 
+void LiveStreamSourceModel::StandbySource(LiveStreamSource *source, bool standby)
+{
+    QMetaObject::invokeMethod(source, "onRequestStandby", Q_ARG(bool, standby));
+}
+
 void LiveStreamSourceModel::EnableSourceRecording(LiveStreamSource *source, const QString &out_path)
 {
     QMetaObject::invokeMethod(source, "onRequestSetRecordPath", Q_ARG(QString, out_path));
@@ -534,7 +734,8 @@ void LiveStreamSourceModel::LoadFromFile()
             continue;
 
         QString name = item_object.value("name").toString();
-        AddSource(source, name);
+        int id = AddSource(source, name);
+        sources_[id]->setPinned(item_object.value("pinned").toBool(false));
     }
 }
 
@@ -547,6 +748,7 @@ void LiveStreamSourceModel::SaveToFile()
         item["type"] = p.second->source()->SourceType();
         item["name"] = p.second->name();
         item["data"] = p.second->source()->ToJson();
+        item["pinned"] = p.second->pinned();
         json_array.push_back(item);
     }
 
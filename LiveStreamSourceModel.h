@@ -17,6 +17,9 @@ class LiveStreamSourceInfo : public QObject
     Q_PROPERTY(bool online READ online NOTIFY onlineChanged)
     Q_PROPERTY(bool activated READ activated NOTIFY activatedChanged)
     Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged)
+    Q_PROPERTY(bool pinned READ pinned NOTIFY pinnedChanged)
+    Q_PROPERTY(bool warm READ warm NOTIFY warmChanged)
+    Q_PROPERTY(QString abrStatus READ abrStatus NOTIFY abrStatusChanged)
 
     Q_PROPERTY(QString effectiveOption READ effectiveOption NOTIFY effectiveOptionChanged)
 public:
@@ -42,6 +45,14 @@ public:
     void setActivated(bool new_activated) { if (activated_ != new_activated) { activated_ = new_activated; emit activatedChanged(); } }
     bool recording() { return recording_; }
     void setRecording(bool new_recording) { if (recording_ != new_recording) { recording_ = new_recording; emit recordingChanged(); } }
+    bool pinned() const { return pinned_; }
+    void setPinned(bool new_pinned) { if (pinned_ != new_pinned) { pinned_ = new_pinned; emit pinnedChanged(); } }
+    bool warm() const { return warm_; }
+    void setWarm(bool new_warm) { if (warm_ != new_warm) { warm_ = new_warm; emit warmChanged(); } }
+    int abrOffset() const { return abr_offset_; }
+    void setAbrOffset(int new_abr_offset);
+    const QString &abrStatus() const { return abr_status_; }
+    void setAbrStatus(const QString &new_abr_status) { if (abr_status_ != new_abr_status) { abr_status_ = new_abr_status; emit abrStatusChanged(); } }
 
     QString effectiveOption() const;
 signals:
@@ -53,6 +64,9 @@ signals:
     void onlineChanged();
     void activatedChanged();
     void recordingChanged();
+    void pinnedChanged();
+    void warmChanged();
+    void abrStatusChanged();
 
     void effectiveOptionChanged();
 private:
@@ -62,12 +76,21 @@ private:
     QUrl cover_;
     int option_index_ = -1;
     QList<QString> available_options_;
-    bool online_ = false, activated_ = false, recording_ = false;
+    bool online_ = false, activated_ = false, recording_ = false, pinned_ = false, warm_ = false;
+    int abr_offset_ = 0; //Steps below option_index_ chosen by quality control
+    QString abr_status_;
 };
 
 class LiveStreamSourceModel : public QAbstractListModel
 {
     Q_OBJECT
+
+    struct AbrState
+    {
+        int bad_reports = 0, good_reports = 0, ignored_reports = 0;
+    };
+
+    Q_PROPERTY(int warmSourceLimit READ warmSourceLimit WRITE setWarmSourceLimit NOTIFY warmSourceLimitChanged)
 public:
     explicit LiveStreamSourceModel(QObject *parent = nullptr);
     ~LiveStreamSourceModel();
@@ -75,10 +98,14 @@ public:
     int rowCount(const QModelIndex & = QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role) const override;
 
+    int warmSourceLimit() const { return warm_source_limit_; }
+    void setWarmSourceLimit(int new_warm_source_limit);
+
     Q_INVOKABLE void addFileSource(const QString &name, const QString &path);
     Q_INVOKABLE void addBilibiliSource(const QString &name, int room_display_id);
     Q_INVOKABLE void setSourceOption(int id, int option_index);
     Q_INVOKABLE void setSourceRecording(int id, bool enabled);
+    Q_INVOKABLE void setSourcePinned(int id, bool pinned);
     Q_INVOKABLE void clearSourceBuffer(int id);
     Q_INVOKABLE void removeSourceById(int id);
     Q_INVOKABLE void removeSourceByIndex(int index);
@@ -88,16 +115,25 @@ public:
     void ActivateAndGetSources(std::vector<std::pair<int, LiveStreamSourceInfo *>> &sources);
     void DeactivateAllSource();
 signals:
+    void warmSourceLimitChanged();
+
     void newSource(int id);
     void deleteSource(int id);
 public slots:
     void UpdateSingleSourceDone(int status, const QString &description, const QUrl &cover, const QList<QString> &options);
 private:
-    void AddSource(LiveStreamSource *source, const QString &name);
+    int AddSource(LiveStreamSource *source, const QString &name);
     int FindSourceIndex(int id);
 
+    void PromoteSource(int id, LiveStreamSourceInfo *source_info);
+    void ReleaseSources(const std::vector<int> &ids);
+    void UpdateWarmSources();
+    bool IsSourceWanted(int id) const { return activated_sources_.count(id) > 0 || warm_sources_.count(id) > 0; }
+
     void OnActivated(int id);
     void OnDeactivated(int id);
+    void OnStatisticsUpdated(int id, qreal ingest_ratio, qreal decode_speed, int underruns);
+    void SetSourceAbrOffset(LiveStreamSourceInfo *source_info, int abr_offset, const QString &abr_status);
 
     void StartUpdateSources();
     void ContinueUpdateSources();
@@ -105,7 +141,9 @@ private:
 
     static void ActivateSource(LiveStreamSource *source, const QString &option);
     static void DeactivateSource(LiveStreamSource *source);
+    static void SwitchSourceOption(LiveStreamSource *source, const QString &option);
     static void ClearSourceBuffer(LiveStreamSource *source);
+    static void StandbySource(LiveStreamSource *source, bool standby);
     static void EnableSourceRecording(LiveStreamSource *source, const QString &out_path);
     static void DisableSourceRecording(LiveStreamSource *source);
 
@@ -122,6 +160,13 @@ private:
 
     std::unordered_set<int> activated_sources_;
 
+    //Sources kept connected in standby while not on screen, picked from pinned sources first, then from recent_sources_
+    int warm_source_limit_;
+    std::unordered_set<int> warm_sources_;
+    std::vector<int> recent_sources_;
+
+    std::unordered_map<int, AbrState> abr_states_;
+
     std::vector<int> sources_updating_;
     int sources_updated_count_ = -1;
 };
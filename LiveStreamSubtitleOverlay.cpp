@@ -3,78 +3,209 @@
 
 #include "LiveStreamView.h"
 
+Q_LOGGING_CATEGORY(CategorySubtitle, "qddm.subtitle")
+
 static constexpr int kSubtitleRowSpacing = 5, kSubtitleSameRowSpacing = 10;
 
-LiveStreamSubtitleOverlay::LiveStreamSubtitleOverlay(QQuickItem *parent)
-    :QQuickItem(parent)
+namespace
 {
-    connect(this, &QQuickItem::heightChanged, this, &LiveStreamSubtitleOverlay::OnHeightChanged);
-}
 
-void LiveStreamSubtitleOverlay::setTextDelegate(QQmlComponent *new_text_delegate)
+//Holds one image node per placed item, nodes of items no longer placed are removed after each sync
+class SubtitleNode : public QSGNode
 {
-    if (text_delegate_ != new_text_delegate)
+    struct Child
     {
-        if (subtitle_row_height_item_)
-        {
-            delete subtitle_row_height_item_;
-            subtitle_row_height_item_ = nullptr;
-        }
-        if (subtitle_row_height_context_)
+        QSGImageNode *node;
+        unsigned int style_serial;
+        unsigned int sync_serial;
+    };
+public:
+    //Returns nullptr if the item has no node yet or its node has to be rasterized again
+    QSGImageNode *Find(uint64_t id, unsigned int style_serial)
+    {
+        auto itr = children_.find(id);
+        if (itr == children_.end())
+            return nullptr;
+        if (itr->second.style_serial != style_serial)
         {
-            delete subtitle_row_height_context_;
-            subtitle_row_height_context_ = nullptr;
+            removeChildNode(itr->second.node);
+            delete itr->second.node;
+            children_.erase(itr);
+            return nullptr;
         }
-        text_delegate_ = new_text_delegate;
+        itr->second.sync_serial = sync_serial_;
+        return itr->second.node;
+    }
+
+    QSGImageNode *Add(uint64_t id, unsigned int style_serial, QQuickWindow *window, QSGTexture *texture)
+    {
+        QSGImageNode *node = window->createImageNode();
+        node->setFiltering(QSGTexture::Linear);
+        node->setTexture(texture);
+        node->setOwnsTexture(true);
+        appendChildNode(node);
+        children_.emplace(id, Child{ node, style_serial, sync_serial_ });
+        return node;
+    }
 
-        if (text_delegate_)
+    void BeginSync() { ++sync_serial_; }
+    void EndSync()
+    {
+        for (auto itr = children_.begin(); itr != children_.end();)
         {
-            subtitle_row_height_context_ = new QQmlContext(text_delegate_->creationContext(), this);
-            if (subtitle_row_height_context_)
+            if (itr->second.sync_serial != sync_serial_)
+            {
+                removeChildNode(itr->second.node);
+                delete itr->second.node;
+                itr = children_.erase(itr);
+            }
+            else
             {
-                subtitle_row_height_context_->setContextProperty("subtitleText", "Ip");
-                subtitle_row_height_context_->setContextProperty("subtitleColor", QColor(0xFF, 0xFF, 0xFF, 0x00));
-                subtitle_row_height_item_ = qobject_cast<QQuickItem *>(text_delegate_->create(subtitle_row_height_context_));
-                if (subtitle_row_height_item_)
-                {
-                    subtitle_row_height_item_->setParent(this);
-                    subtitle_row_height_item_->setParentItem(this);
-                    subtitle_row_height_item_->setEnabled(false);
-                    subtitle_row_height_item_->setVisible(false);
-                    connect(subtitle_row_height_item_, &QQuickItem::heightChanged, this, &LiveStreamSubtitleOverlay::OnItemHeightChanged);
-                    connect(subtitle_row_height_item_, &QQuickItem::widthChanged, this, &LiveStreamSubtitleOverlay::OnItemWidthChanged);
-                }
+                ++itr;
             }
-            OnItemHeightChanged();
         }
+    }
+private:
+    std::unordered_map<uint64_t, Child> children_;
+    unsigned int sync_serial_ = 0;
+};
+
+}
+
+LiveStreamSubtitleOverlay::LiveStreamSubtitleOverlay(QQuickItem *parent)
+    :QQuickItem(parent)
+{
+    setFlag(ItemHasContents, true);
+    connect(this, &QQuickItem::heightChanged, this, &LiveStreamSubtitleOverlay::OnHeightChanged);
+    connect(this, &QQuickItem::widthChanged, this, &LiveStreamSubtitleOverlay::OnWidthChanged);
+    UpdateMetrics();
+#ifdef _DEBUG
+    stress_rate_ = qEnvironmentVariableIntValue("QDDM_DANMU_STRESS");
+#endif
+}
 
-        emit textDelegateChanged();
+void LiveStreamSubtitleOverlay::setFont(const QFont &new_font)
+{
+    if (font_ != new_font)
+    {
+        font_ = new_font;
+        UpdateMetrics();
+        emit fontChanged();
+    }
+}
+
+void LiveStreamSubtitleOverlay::setOutlineColor(const QColor &new_outline_color)
+{
+    if (outline_color_ != new_outline_color)
+    {
+        outline_color_ = new_outline_color;
+        style_serial_ += 1;
+        update();
+        emit outlineColorChanged();
     }
 }
 
 void LiveStreamSubtitleOverlay::onNewSubtitleFrame(const QSharedPointer<SubtitleFrame> &frame)
 {
-    if (!text_delegate_)
+#ifdef _DEBUG
+    frames_per_second_ += 1;
+#endif
+    //Spam is shown once with a count, as long as the first one is still waiting
+    auto itr = pending_by_content_.find(frame->content);
+    if (itr != pending_by_content_.end())
+    {
+        SubtitleItem &item = items_[itr.value()];
+        item.count += 1;
+        item.width = (int)ceil(QFontMetricsF(font_).horizontalAdvance(ItemText(item)));
+        coalesced_ += 1;
         return;
-
-    QQmlContext *text_item_context = new QQmlContext(text_delegate_->creationContext(), this);
-    if (!text_item_context)
+    }
+    if ((int)(placed_slots_.size() + pending_slots_.size()) >= MaxActiveComments())
+    {
+        dropped_ += 1;
         return;
-    text_item_context->setContextProperty("subtitleText", frame->content);
-    text_item_context->setContextProperty("subtitleColor", frame->color);
+    }
+    admitted_ += 1;
 
-    QQuickItem *text_item = qobject_cast<QQuickItem *>(text_delegate_->create(text_item_context));
-    if (!text_item)
+    //Only measured here, rasterized once it's placed
+    int slot = AllocateSlot();
+    SubtitleItem &item = items_[slot];
+    item.id = next_item_id_++;
+    item.frame = frame;
+    item.style = GetItemType(frame->style);
+    item.width = (int)ceil(QFontMetricsF(font_).horizontalAdvance(frame->content));
+    item.enqueue_time = clock_ms_;
+    pending_slots_.push_back(slot);
+    pending_by_content_.insert(frame->content, slot);
+}
+
+QSGNode *LiveStreamSubtitleOverlay::updatePaintNode(QSGNode *node_base, QQuickItem::UpdatePaintNodeData *)
+{
+    SubtitleNode *node = static_cast<SubtitleNode *>(node_base);
+    if (!node)
     {
-        delete text_item_context;
-        return;
+        if (placed_slots_.empty())
+            return nullptr;
+        node = new SubtitleNode;
+    }
+#ifdef _DEBUG
+    PlaybackClock::time_point sync_begin = PlaybackClock::now();
+#endif
+
+    QQuickWindow *window = this->window();
+    qreal device_pixel_ratio = window->effectiveDevicePixelRatio();
+    node->BeginSync();
+    for (int slot : placed_slots_)
+    {
+        const SubtitleItem &item = items_[slot];
+        QSGImageNode *image_node = node->Find(item.id, style_serial_);
+        if (!image_node)
+        {
+            QImage image = RenderItem(item, device_pixel_ratio);
+            image_node = node->Add(item.id, style_serial_, window, window->createTextureFromImage(image));
+#ifdef _DEBUG
+            rasterized_per_second_ += 1;
+#endif
+        }
+        QSizeF size = QSizeF(image_node->texture()->textureSize()) / device_pixel_ratio;
+        image_node->setRect(QRectF(item.position - QPointF(kOutlineWidth, kOutlineWidth), size));
+    }
+    node->EndSync();
+
+#ifdef _DEBUG
+    PlaybackClock::time_point sync_end = PlaybackClock::now();
+    sync_time_ += sync_end - sync_begin;
+    syncs_per_second_ += 1;
+    if (sync_end - last_debug_report_ > std::chrono::seconds(1))
+    {
+        last_debug_report_ = sync_end;
+        qCDebug(CategorySubtitle) << frames_per_second_ << " comments received, " << rasterized_per_second_ << " rasterized, " << placed_slots_.size() << " shown, " << pending_slots_.size() << " waiting";
+        if (syncs_per_second_ > 0)
+            qCDebug(CategorySubtitle) << std::chrono::duration_cast<std::chrono::microseconds>(sync_time_).count() / syncs_per_second_ << "us average sync over " << syncs_per_second_ << " frames";
+        if (updates_per_second_ > 0)
+            qCDebug(CategorySubtitle) << std::chrono::duration_cast<std::chrono::microseconds>(update_time_).count() / updates_per_second_ << "us average layout update";
+        sync_time_ = update_time_ = PlaybackClock::duration::zero();
+        frames_per_second_ = syncs_per_second_ = updates_per_second_ = rasterized_per_second_ = 0;
     }
-    text_item->setParent(this);
-    text_item->setParentItem(this);
-    text_item->setEnabled(false);
-    text_item->setVisible(false);
+#endif
+    return node;
+}
 
-    active_subtitles_.emplace_back(text_item_context, text_item, GetItemType(frame->style), (int)round(text_item->width()));
+QImage LiveStreamSubtitleOverlay::RenderItem(const SubtitleItem &item, qreal device_pixel_ratio) const
+{
+    QFontMetricsF metrics(font_);
+    QSize size = (QSizeF(item.width + 2 * kOutlineWidth, subtitle_row_height_) * device_pixel_ratio).toSize();
+    QImage image(size.expandedTo(QSize(1, 1)), QImage::Format_ARGB32_Premultiplied);
+    image.setDevicePixelRatio(device_pixel_ratio);
+    image.fill(Qt::transparent);
+
+    QPainterPath path;
+    path.addText(kOutlineWidth, kOutlineWidth + metrics.ascent(), font_, ItemText(item));
+    QPainter painter(&image);
+    painter.setRenderHint(QPainter::Antialiasing);
+    painter.strokePath(path, QPen(outline_color_, kOutlineWidth * 2, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin));
+    painter.fillPath(path, item.frame->color);
+    return image;
 }
 
 void LiveStreamSubtitleOverlay::OnHeightChanged()
@@ -87,47 +218,38 @@ void LiveStreamSubtitleOverlay::OnHeightChanged()
     }
 }
 
-void LiveStreamSubtitleOverlay::OnItemHeightChanged()
+void LiveStreamSubtitleOverlay::OnWidthChanged()
 {
-    int new_subtitle_row_height;
-    if (!subtitle_row_height_item_)
-    {
-        new_subtitle_row_height = 0;
-    }
-    else
-    {
-        new_subtitle_row_height = (int)round(subtitle_row_height_item_->height());
-    }
+    //Exit times of scrolling items depend on the width
+    RebuildLanes();
+}
+
+void LiveStreamSubtitleOverlay::UpdateMetrics()
+{
+    QFontMetricsF metrics(font_);
+    int new_subtitle_row_height = (int)ceil(metrics.height()) + 2 * kOutlineWidth;
+    for (SubtitleItem &item : items_)
+        if (item.frame)
+            item.width = (int)ceil(metrics.horizontalAdvance(ItemText(item)));
+    style_serial_ += 1;
     if (subtitle_row_height_ != new_subtitle_row_height)
     {
         subtitle_row_height_ = new_subtitle_row_height;
         UpdateHeight();
     }
-}
-
-void LiveStreamSubtitleOverlay::OnItemWidthChanged()
-{
-    for (SubtitleItem &item : active_subtitles_)
-        item.width = (int)round(item.visual_item->width());
+    update();
 }
 
 void LiveStreamSubtitleOverlay::UpdateHeight()
 {
     if (overlay_height_ <= kSubtitleRowSpacing || subtitle_row_height_ <= 0)
-    {
         subtitle_row_status_.clear();
-        return;
-    }
-
-    subtitle_row_status_.resize((int)((overlay_height_ - kSubtitleRowSpacing) / (subtitle_row_height_ + kSubtitleRowSpacing)));
+    else
+        subtitle_row_status_.resize((int)((overlay_height_ - kSubtitleRowSpacing) / (subtitle_row_height_ + kSubtitleRowSpacing)));
+    RebuildLanes();
 
-    for (SubtitleItem &item : active_subtitles_)
-    {
-        if (item.row != -1)
-        {
-            UpdateItemY(item);
-        }
-    }
+    for (int slot : placed_slots_)
+        UpdateItemY(items_[slot]);
 }
 
 void LiveStreamSubtitleOverlay::Update(qreal t)
@@ -136,131 +258,278 @@ void LiveStreamSubtitleOverlay::Update(qreal t)
     while (t_diff < 0)
         t_diff += LiveStreamView::kAnimationTimeSourcePeriod;
     t_ = t;
+    clock_ms_ += t_diff;
 
-    int overlay_width = (int)width();
-    int row_count = (int)subtitle_row_status_.size();
-    for (int item_index = 0; item_index < (int)active_subtitles_.size(); ++item_index)
+#ifdef _DEBUG
+    if (stress_rate_ > 0)
     {
-        auto &item = active_subtitles_[item_index];
-        if (item.row == -1)
+        //Synthetic comments of varying length and style for profiling without a busy room
+        stress_remainder_ += (int64_t)stress_rate_ * t_diff;
+        for (; stress_remainder_ >= 1000; stress_remainder_ -= 1000)
         {
-            for (int row = 0; row < row_count; ++row)
-            {
-                bool row_available = false;
-                if (subtitle_row_status_[row].status[item.style] == -1)
-                {
-                    row_available = true;
-                }
-                else if (!IsStyleFixedPosition(item.style))
-                {
-                    int item_in_row_index = subtitle_row_status_[row].status[item.style];
-                    Q_ASSERT(item_in_row_index < (int)active_subtitles_.size());
-                    auto &item_in_row = active_subtitles_[item_in_row_index];
-                    if (item_in_row.progress_num > (item_in_row.width + kSubtitleSameRowSpacing) * SubtitleItem::kProgressDen)
-                        if ((long long)((item_in_row.width + overlay_width) * SubtitleItem::kProgressDen - item_in_row.progress_num) * (item.width + 800) < (long long)(overlay_width * SubtitleItem::kProgressDen) * (item_in_row.width + 800))
-                            row_available = true;
-                }
-
-                if (row_available)
-                {
-                    subtitle_row_status_[row].status[item.style] = item_index;
-                    item.row = row;
-                    UpdateItemY(item);
-                    item.visual_item->setEnabled(true);
-                    item.visual_item->setVisible(true);
-                    break;
-                }
-            }
+            //Every eighth one repeats an earlier text like chat spam does
+            uint64_t serial = stress_serial_++;
+            uint64_t text_serial = serial % 8 == 0 ? serial % 64 : serial;
+            QSharedPointer<SubtitleFrame> frame = QSharedPointer<SubtitleFrame>::create();
+            frame->content = QStringLiteral("Stress %1 ").arg(text_serial).repeated(1 + (int)(text_serial % 4));
+            frame->color = QColor::fromHsv((int)(serial * 37 % 360), 160, 255);
+            frame->style = serial % 16 == 1 ? SubtitleStyle::TOP : serial % 16 == 2 ? SubtitleStyle::BOTTOM : SubtitleStyle::NORMAL;
+            onNewSubtitleFrame(frame);
         }
-        if (item.row != -1)
-        {
-            int item_width = item.width;
-            if (IsStyleFixedPosition(item.style)) //Fixed position style, progress_num is ms
-            {
-                item.progress_num += t_diff;
-                constexpr int item_max_progress = 8000;
-                if (item.progress_num > item_max_progress)
-                {
-                    if (OccupiesRow(item_index, item))
-                        subtitle_row_status_[item.row].status[item.style] = -1;
-                    item.row = -1;
-                }
-            }
-            else //Variable position style, progress_num/kProgressDen is position
-            {
-                item.progress_num += (item_width + 800) * t_diff;
-                int item_max_progress = item_width + overlay_width;
-                if (item.progress_num > item_max_progress * SubtitleItem::kProgressDen)
-                {
-                    if (OccupiesRow(item_index, item))
-                        subtitle_row_status_[item.row].status[item.style] = -1;
-                    item.row = -1;
-                }
-            }
-
-            qreal x;
+    }
+#endif
+    UpdateFloodStatistics();
+    if (placed_slots_.empty() && pending_slots_.empty())
+        return;
+#ifdef _DEBUG
+    PlaybackClock::time_point update_begin = PlaybackClock::now();
+#endif
 
-            if (item.style == ROW_NORMAL)
-                x = overlay_width - (qreal)item.progress_num / SubtitleItem::kProgressDen;
-            else if (item.style == ROW_REVERSE)
-                x = (qreal)item.progress_num / SubtitleItem::kProgressDen - item_width;
-            else
-                x = (qreal)(overlay_width - item_width) / 2;
+    ProcessLaneClearEvents();
 
-            item.visual_item->setX(x);
+    int overlay_width = (int)width();
+    for (size_t i = 0; i < placed_slots_.size();)
+    {
+        int slot = placed_slots_[i];
+        SubtitleItem &item = items_[slot];
+        bool expired;
+        if (IsStyleFixedPosition(item.style)) //Fixed position style, progress_num is ms
+        {
+            item.progress_num += t_diff;
+            constexpr int item_max_progress = 8000;
+            expired = item.progress_num > item_max_progress;
+        }
+        else //Variable position style, progress_num/kProgressDen is position
+        {
+            item.progress_num += (item.width + 800) * t_diff;
+            int item_max_progress = item.width + overlay_width;
+            expired = item.progress_num > item_max_progress * SubtitleItem::kProgressDen;
         }
+        if (expired)
+        {
+            ReleaseSlot(slot); //Swaps the last placed slot into i
+            continue;
+        }
+        UpdateItemX(item);
+        ++i;
     }
 
-    for (int i = 0; i < (int)active_subtitles_.size(); ++i)
+    //Oldest first, an item that doesn't fit doesn't hold back later ones of other styles or widths
+    DropStalePending();
+    for (auto itr = pending_slots_.begin(); itr != pending_slots_.end();)
     {
-        auto &item = active_subtitles_[i];
-        if (item.row == -1)
+        int slot = *itr;
+        if (PlaceItem(slot))
         {
-            QQuickItem *visual_item = item.visual_item;
-            QQmlContext *visual_item_context = item.visual_item_context;
-
-            active_subtitles_.erase(active_subtitles_.begin() + i);
-            for (int j = 0; j < (int)subtitle_row_status_.size(); ++j)
-            {
-                for (int k = 0; k < ROW_TYPE_COUNT; ++k)
-                {
-                    if (subtitle_row_status_[j].status[k] > i)
-                        subtitle_row_status_[j].status[k] -= 1;
-                    else if (subtitle_row_status_[j].status[k] == i)
-                        subtitle_row_status_[j].status[k] = -1;
-                }
-            }
+            itr = pending_slots_.erase(itr);
+            RemovePending(slot);
+        }
+        else
+        {
+            ++itr;
+        }
+    }
 
-            if (visual_item)
-                delete visual_item;
-            if (visual_item_context)
-                delete visual_item_context;
+#ifdef _DEBUG
+    for (int row = 0; row < (int)subtitle_row_status_.size(); ++row)
+        for (int k = 0; k < ROW_TYPE_COUNT; ++k)
+        {
+            int slot = subtitle_row_status_[row].lanes[k].slot;
+            Q_ASSERT_X(slot == -1 || (slot < (int)items_.size() && items_[slot].row == row && items_[slot].style == k), "LiveStreamSubtitleOverlay", "lane points at an item on another row or style");
         }
+    update_time_ += PlaybackClock::now() - update_begin;
+    updates_per_second_ += 1;
+#endif
+
+    update();
+}
+
+int LiveStreamSubtitleOverlay::AllocateSlot()
+{
+    if (free_slots_.empty())
+    {
+        items_.emplace_back();
+        return (int)items_.size() - 1;
+    }
+    int slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+}
+
+void LiveStreamSubtitleOverlay::ReleaseSlot(int slot)
+{
+    SubtitleItem &item = items_[slot];
+    ReleaseLane(slot);
+    if (item.placed_index != -1)
+    {
+        int last_slot = placed_slots_.back();
+        placed_slots_[item.placed_index] = last_slot;
+        items_[last_slot].placed_index = item.placed_index;
+        placed_slots_.pop_back();
     }
+    item = SubtitleItem();
+    free_slots_.push_back(slot);
+}
+
+int LiveStreamSubtitleOverlay::MaxActiveComments() const
+{
+    return std::max(kMinActiveComments, (int)(width() * height()) / kAreaPerComment);
+}
 
+void LiveStreamSubtitleOverlay::RemovePending(int slot)
+{
+    auto itr = pending_by_content_.find(items_[slot].frame->content);
+    if (itr != pending_by_content_.end() && itr.value() == slot)
+        pending_by_content_.erase(itr);
+}
 
+void LiveStreamSubtitleOverlay::DropStalePending()
+{
+    //Waiting comments are in arrival order, the ones that couldn't be placed in time are no longer relevant
+    while (!pending_slots_.empty() && clock_ms_ - items_[pending_slots_.front()].enqueue_time > kPlacementDeadlineMS)
+    {
+        int slot = pending_slots_.front();
+        pending_slots_.pop_front();
+        dropped_ += 1;
+        RemovePending(slot);
+        ReleaseSlot(slot);
+    }
+}
+
+void LiveStreamSubtitleOverlay::UpdateFloodStatistics()
+{
+    int64_t elapsed = clock_ms_ - flood_statistics_clock_;
+    if (elapsed < 1000)
+        return;
+    flood_statistics_clock_ = clock_ms_;
+    admitted_rate_ = (int)(admitted_ * 1000 / elapsed);
+    coalesced_rate_ = (int)(coalesced_ * 1000 / elapsed);
+    dropped_rate_ = (int)(dropped_ * 1000 / elapsed);
 #ifdef _DEBUG
-    for (int j = 0; j < (int)subtitle_row_status_.size(); ++j)
-        for (int k = 0; k < ROW_TYPE_COUNT; ++k)
-            if (subtitle_row_status_[j].status[k] != -1 && (subtitle_row_status_[j].status[k] >= (int)active_subtitles_.size() || active_subtitles_[subtitle_row_status_[j].status[k]].row != j))
-                Q_ASSERT(false);
+    if (admitted_ + coalesced_ + dropped_ > 0)
+        qCDebug(CategorySubtitle) << admitted_rate_ << "/s admitted, " << coalesced_rate_ << "/s coalesced, " << dropped_rate_ << "/s dropped, limit " << MaxActiveComments();
 #endif
+    admitted_ = coalesced_ = dropped_ = 0;
+    emit floodStatisticsChanged();
 }
 
-void LiveStreamSubtitleOverlay::UpdateItemY(const SubtitleItem &item)
+QString LiveStreamSubtitleOverlay::ItemText(const SubtitleItem &item) const
+{
+    if (item.count <= 1)
+        return item.frame->content;
+    return QStringLiteral("%1 \u00D7%2").arg(item.frame->content).arg(item.count);
+}
+
+bool LiveStreamSubtitleOverlay::PlaceItem(int slot)
+{
+    SubtitleItem &item = items_[slot];
+    //Fixed items need a free row, scrolling ones a row whose last item leaves before the new one, moving at its own speed, catches up
+    int64_t threshold = SubtitleLaneTree::kFree + 1;
+    if (!IsStyleFixedPosition(item.style))
+        threshold = clock_ms_ + (int64_t)width() * SubtitleItem::kProgressDen / (item.width + 800);
+    int row = lane_trees_[item.style].FindFirstBelow(threshold);
+    if (row == -1)
+        return false;
+
+    item.row = row;
+    item.progress_num = 0;
+    item.placed_index = (int)placed_slots_.size();
+    placed_slots_.push_back(slot);
+    OccupyLane(slot);
+    UpdateItemY(item);
+    UpdateItemX(item);
+    return true;
+}
+
+void LiveStreamSubtitleOverlay::OccupyLane(int slot)
+{
+    const SubtitleItem &item = items_[slot];
+    if (item.row >= (int)subtitle_row_status_.size())
+        return;
+    Lane &lane = subtitle_row_status_[item.row].lanes[item.style];
+    lane.slot = slot;
+    lane.serial += 1;
+    lane_trees_[item.style].Set(item.row, SubtitleLaneTree::kBlocked);
+    if (IsStyleFixedPosition(item.style))
+        return;
+    int speed = item.width + 800;
+    int64_t clear_progress = (int64_t)(item.width + kSubtitleSameRowSpacing) * SubtitleItem::kProgressDen;
+    int64_t exit_progress = (int64_t)(item.width + (int)width()) * SubtitleItem::kProgressDen;
+    LaneClearEvent event;
+    event.clear_time = clock_ms_ + (clear_progress - item.progress_num) / speed + 1;
+    event.exit_time = clock_ms_ + (exit_progress - item.progress_num) / speed;
+    event.style = item.style;
+    event.row = item.row;
+    event.serial = lane.serial;
+    lane_clear_events_.push(event);
+}
+
+void LiveStreamSubtitleOverlay::ReleaseLane(int slot)
+{
+    const SubtitleItem &item = items_[slot];
+    if (item.row == -1 || item.row >= (int)subtitle_row_status_.size())
+        return;
+    Lane &lane = subtitle_row_status_[item.row].lanes[item.style];
+    if (lane.slot != slot)
+        return;
+    lane.slot = -1;
+    lane.serial += 1;
+    lane_trees_[item.style].Set(item.row, SubtitleLaneTree::kFree);
+}
+
+void LiveStreamSubtitleOverlay::ProcessLaneClearEvents()
+{
+    while (!lane_clear_events_.empty() && lane_clear_events_.top().clear_time <= clock_ms_)
+    {
+        LaneClearEvent event = lane_clear_events_.top();
+        lane_clear_events_.pop();
+        if (event.row < (int)subtitle_row_status_.size() && subtitle_row_status_[event.row].lanes[event.style].serial == event.serial)
+            lane_trees_[event.style].Set(event.row, event.exit_time);
+    }
+}
+
+void LiveStreamSubtitleOverlay::RebuildLanes()
+{
+    int row_count = (int)subtitle_row_status_.size();
+    for (RowStatus &status : subtitle_row_status_)
+        for (Lane &lane : status.lanes)
+        {
+            lane.slot = -1;
+            lane.serial += 1;
+        }
+    for (SubtitleLaneTree &tree : lane_trees_)
+        tree.Reset(row_count);
+    lane_clear_events_ = decltype(lane_clear_events_)();
+
+    //The latest item of each row blocks it again, items in rows that no longer exist just finish
+    std::vector<int> slots = placed_slots_;
+    std::sort(slots.begin(), slots.end(), [this](int a, int b) { return items_[a].id < items_[b].id; });
+    for (int slot : slots)
+        OccupyLane(slot);
+    ProcessLaneClearEvents();
+}
+
+void LiveStreamSubtitleOverlay::UpdateItemY(SubtitleItem &item)
 {
     int y;
     if (item.style == ROW_BOTTOM)
         y = overlay_height_ - (item.row + 1) * (subtitle_row_height_ + kSubtitleRowSpacing);
     else
         y = item.row * (subtitle_row_height_ + kSubtitleRowSpacing) + kSubtitleRowSpacing;
-    item.visual_item->setY(y);
+    item.position.setY(y);
 }
 
-bool LiveStreamSubtitleOverlay::OccupiesRow(int index, const SubtitleItem &item)
+void LiveStreamSubtitleOverlay::UpdateItemX(SubtitleItem &item)
 {
-    Q_ASSERT(index >= 0 && index < (int)active_subtitles_.size());
-    return item.row >= 0 && item.row < (int)subtitle_row_status_.size() && subtitle_row_status_[item.row].status[item.style] == index;
+    int overlay_width = (int)width();
+    qreal x;
+    if (item.style == ROW_NORMAL)
+        x = overlay_width - (qreal)item.progress_num / SubtitleItem::kProgressDen;
+    else if (item.style == ROW_REVERSE)
+        x = (qreal)item.progress_num / SubtitleItem::kProgressDen - item.width;
+    else
+        x = (qreal)(overlay_width - item.width) / 2;
+    item.position.setX(x);
 }
 
 bool LiveStreamSubtitleOverlay::IsStyleFixedPosition(ItemType style)
@@ -2,7 +2,12 @@
 #define LIVESTREAMVIEWSUBTITLEOVERLAY_H
 
 #include "SubtitleFrame.h"
+#include "SubtitleLaneTree.h"
 
+Q_DECLARE_LOGGING_CATEGORY(CategorySubtitle)
+
+//Lays out comments in rows and draws them as textured quads of one scene graph node
+//Each comment is rasterized once when it's placed, small textures share the scene graph's atlas so all comments are drawn in one batch
 class LiveStreamSubtitleOverlay : public QQuickItem
 {
     Q_OBJECT
@@ -16,63 +21,138 @@ class LiveStreamSubtitleOverlay : public QQuickItem
     };
     static constexpr int ROW_TYPE_COUNT = ROW_REVERSE + 1;
 
+    //Item last placed in a row of one style
+    struct Lane
+    {
+        int slot = -1;
+        unsigned int serial = 0; //Invalidates queued clear events
+    };
     struct RowStatus
     {
-        int status[4] = { -1, -1, -1, -1 };
+        Lane lanes[ROW_TYPE_COUNT];
+    };
+    //A scrolling item stops blocking its row for other items once it's fully shown plus spacing
+    struct LaneClearEvent
+    {
+        int64_t clear_time, exit_time;
+        ItemType style;
+        int row;
+        unsigned int serial;
+
+        bool operator>(const LaneClearEvent &other) const { return clear_time > other.clear_time; }
     };
 
     struct SubtitleItem
     {
         static constexpr int kProgressDen = 8192;
 
-        SubtitleItem() = default;
-        SubtitleItem(QQmlContext *new_context, QQuickItem *new_item, ItemType new_style, int new_width) :visual_item_context(new_context), visual_item(new_item), style(new_style), width(new_width) {}
-
-        QQmlContext *visual_item_context = nullptr;
-        QQuickItem *visual_item = nullptr;
+        uint64_t id = 0; //Keys the node of the item, slots are reused so it can't be the slot
+        QSharedPointer<SubtitleFrame> frame;
         ItemType style = ROW_NORMAL;
         int width = 0, row = -1, progress_num = 0;
+        int placed_index = -1; //Into placed_slots_
+        int count = 1; //Identical comments coalesced into this one while it waited
+        int64_t enqueue_time = 0;
+        QPointF position;
     };
 
     Q_PROPERTY(qreal t READ t WRITE setT NOTIFY tChanged)
-    Q_PROPERTY(QQmlComponent* textDelegate READ textDelegate WRITE setTextDelegate NOTIFY textDelegateChanged)
+    Q_PROPERTY(QFont font READ font WRITE setFont NOTIFY fontChanged)
+    Q_PROPERTY(QColor outlineColor READ outlineColor WRITE setOutlineColor NOTIFY outlineColorChanged)
+    //Comments per second let in, merged into a waiting identical one, and dropped by the density limit or the placement deadline
+    Q_PROPERTY(int admittedRate READ admittedRate NOTIFY floodStatisticsChanged)
+    Q_PROPERTY(int coalescedRate READ coalescedRate NOTIFY floodStatisticsChanged)
+    Q_PROPERTY(int droppedRate READ droppedRate NOTIFY floodStatisticsChanged)
 public:
     LiveStreamSubtitleOverlay(QQuickItem *parent = nullptr);
 
     qreal t() const { return t_; }
     void setT(qreal new_t) { if (t_ != new_t) { Update(new_t); emit tChanged(); } }
 
-    QQmlComponent *textDelegate() const { return text_delegate_; }
-    void setTextDelegate(QQmlComponent *new_text_delegate);
+    QFont font() const { return font_; }
+    void setFont(const QFont &new_font);
+    QColor outlineColor() const { return outline_color_; }
+    void setOutlineColor(const QColor &new_outline_color);
+
+    int admittedRate() const { return admitted_rate_; }
+    int coalescedRate() const { return coalesced_rate_; }
+    int droppedRate() const { return dropped_rate_; }
+protected:
+    QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) override;
 signals:
     void tChanged();
-    void textDelegateChanged();
+    void fontChanged();
+    void outlineColorChanged();
+    void floodStatisticsChanged();
 public slots:
     void onNewSubtitleFrame(const QSharedPointer<SubtitleFrame> &subtitle_frame);
 private slots:
     void OnHeightChanged();
-    void OnItemHeightChanged();
-    void OnItemWidthChanged();
+    void OnWidthChanged();
 private:
+    static constexpr int kOutlineWidth = 1;
+    //Shown and waiting comments are limited to one per this many square pixels of the overlay, but at least kMinActiveComments
+    static constexpr int kAreaPerComment = 15000;
+    static constexpr int kMinActiveComments = 8;
+    static constexpr int kPlacementDeadlineMS = 3000;
+
+    void UpdateMetrics();
     void UpdateHeight();
     void Update(qreal t);
 
-    void UpdateItemY(const SubtitleItem &item);
-
-    bool OccupiesRow(int index, const SubtitleItem &item);
+    int AllocateSlot();
+    void ReleaseSlot(int slot);
+    int MaxActiveComments() const;
+    void RemovePending(int slot);
+    void DropStalePending();
+    void UpdateFloodStatistics();
+    QString ItemText(const SubtitleItem &item) const;
+    bool PlaceItem(int slot);
+    //Blocks the row of the item for others until its progress allows
+    void OccupyLane(int slot);
+    void ReleaseLane(int slot);
+    void ProcessLaneClearEvents();
+    void RebuildLanes();
+
+    void UpdateItemY(SubtitleItem &item);
+    void UpdateItemX(SubtitleItem &item);
+    QImage RenderItem(const SubtitleItem &item, qreal device_pixel_ratio) const;
 
     static bool IsStyleFixedPosition(ItemType style);
     static ItemType GetItemType(SubtitleStyle style);
 
     qreal t_ = 0;
 
-    QQmlComponent *text_delegate_ = nullptr;
-    QQmlContext *subtitle_row_height_context_ = nullptr;
-    QQuickItem *subtitle_row_height_item_ = nullptr;
+    QFont font_;
+    QColor outline_color_ = Qt::black;
+    unsigned int style_serial_ = 0; //Bumped when every item has to be rasterized again
     int subtitle_row_height_ = 0, overlay_height_ = 0;
 
-    std::vector<SubtitleItem> active_subtitles_;
+    //Items stay in their slot while active and free slots are reused, so lanes refer to slots that never move
+    uint64_t next_item_id_ = 0;
+    std::vector<SubtitleItem> items_;
+    std::vector<int> free_slots_;
+    std::deque<int> pending_slots_; //Waiting for a row, oldest first
+    std::vector<int> placed_slots_;
+    QHash<QString, int> pending_by_content_; //Waiting slot of each text, for coalescing
+
+    int admitted_ = 0, coalesced_ = 0, dropped_ = 0;
+    int admitted_rate_ = 0, coalesced_rate_ = 0, dropped_rate_ = 0;
+    int64_t flood_statistics_clock_ = 0;
+
+    int64_t clock_ms_ = 0; //Sum of t differences, lane times are on this clock
     std::vector<RowStatus> subtitle_row_status_;
+    SubtitleLaneTree lane_trees_[ROW_TYPE_COUNT];
+    std::priority_queue<LaneClearEvent, std::vector<LaneClearEvent>, std::greater<LaneClearEvent>> lane_clear_events_;
+
+#ifdef _DEBUG
+    PlaybackClock::time_point last_debug_report_;
+    PlaybackClock::duration sync_time_ = PlaybackClock::duration::zero(), update_time_ = PlaybackClock::duration::zero();
+    int frames_per_second_ = 0, syncs_per_second_ = 0, updates_per_second_ = 0, rasterized_per_second_ = 0;
+    int stress_rate_ = 0; //QDDM_DANMU_STRESS synthetic comments per second
+    int64_t stress_remainder_ = 0;
+    uint64_t stress_serial_ = 0;
+#endif
 };
 
 #endif // LIVESTREAMVIEWSUBTITLEOVERLAY_H
@@ -5,8 +5,11 @@
 #include "LiveStreamDecoder.h"
 #include "AudioOutput.h"
 #include "LiveStreamSubtitleOverlay.h"
+#include "FixedGridLayout.h"
 
 #include "VideoFrameRenderNodeOGL.h"
+#include "VideoFrameRenderNodeSW.h"
+#include "VideoFrameUploadWorker.h"
 
 LiveStreamView::LiveStreamView(QQuickItem *parent)
     :QQuickItem(parent)
@@ -18,10 +21,24 @@ LiveStreamView::LiveStreamView(QQuickItem *parent)
     subtitle_out_ = new LiveStreamSubtitleOverlay(this);
     subtitle_out_->setPosition(QPointF(0, 0));
     subtitle_out_->setSize(size());
+
+    if (VideoFrameUploadWorker::Instance())
+        texture_ring_ = QSharedPointer<VideoFrameTextureRing>::create();
 }
 
 LiveStreamView::~LiveStreamView()
 {
+    if (video_layout_)
+        video_layout_->RemoveVideoTile(this);
+    if (texture_ring_)
+        VideoFrameUploadWorker::Instance()->Release(texture_ring_);
+    if (video_frame_queue_)
+        video_frame_queue_->Close();
+    if (current_source_)
+    {
+        emit detachVideoOutput(this);
+        emit detachAudioFrameQueue(this);
+    }
     emit deleteAudioSource(this);
 }
 
@@ -35,6 +52,14 @@ void LiveStreamView::setSource(LiveStreamSource *source)
             disconnect(current_source_->decoder(), &LiveStreamDecoder::newVideoFrame, this, &LiveStreamView::onNewVideoFrame);
             disconnect(current_source_->decoder(), &LiveStreamDecoder::newAudioFrame, this, &LiveStreamView::onNewAudioFrame);
             disconnect(current_source_, &LiveStreamSource::newSubtitleFrame, this, &LiveStreamView::onNewSubtitleFrame);
+            //When views swap sources the other view may have attached to this decoder already, the decoder ignores detaches from a former owner
+            emit detachVideoOutput(this);
+            emit detachAudioFrameQueue(this);
+            disconnect(this, &LiveStreamView::setVideoVisible, current_source_->decoder(), &LiveStreamDecoder::onSetVideoVisible);
+            disconnect(this, &LiveStreamView::setVideoFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onSetVideoFrameQueue);
+            disconnect(this, &LiveStreamView::detachVideoOutput, current_source_->decoder(), &LiveStreamDecoder::onDetachVideoOutput);
+            disconnect(this, &LiveStreamView::setAudioFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onSetAudioFrameQueue);
+            disconnect(this, &LiveStreamView::detachAudioFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onDetachAudioFrameQueue);
         }
         current_source_ = source;
         if (current_source_)
@@ -44,7 +69,15 @@ void LiveStreamView::setSource(LiveStreamSource *source)
             connect(current_source_->decoder(), &LiveStreamDecoder::newVideoFrame, this, &LiveStreamView::onNewVideoFrame);
             connect(current_source_->decoder(), &LiveStreamDecoder::newAudioFrame, this, &LiveStreamView::onNewAudioFrame);
             connect(current_source_, &LiveStreamSource::newSubtitleFrame, this, &LiveStreamView::onNewSubtitleFrame);
+            connect(this, &LiveStreamView::setVideoVisible, current_source_->decoder(), &LiveStreamDecoder::onSetVideoVisible);
+            connect(this, &LiveStreamView::setVideoFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onSetVideoFrameQueue);
+            connect(this, &LiveStreamView::detachVideoOutput, current_source_->decoder(), &LiveStreamDecoder::onDetachVideoOutput);
+            connect(this, &LiveStreamView::setAudioFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onSetAudioFrameQueue);
+            connect(this, &LiveStreamView::detachAudioFrameQueue, current_source_->decoder(), &LiveStreamDecoder::onDetachAudioFrameQueue);
+            emit setVideoVisible(video_visible_);
         }
+        ResetVideoFrameQueue();
+        ResetAudioFrameQueue();
         emit sourceChanged();
     }
 }
@@ -69,7 +102,9 @@ void LiveStreamView::setAudioOut(AudioOutput *audio_out)
             disconnect(this, &LiveStreamView::setAudioSourcePosition, audio_out_, &AudioOutput::onSetAudioSourcePosition);
             disconnect(this, &LiveStreamView::setAudioSourceMute, audio_out_, &AudioOutput::onSetAudioSourceMute);
             disconnect(this, &LiveStreamView::setAudioSourceSolo, audio_out_, &AudioOutput::onSetAudioSourceSolo);
+            disconnect(this, &LiveStreamView::setAudioSourceQueue, audio_out_, &AudioOutput::onSetAudioSourceQueue);
             disconnect(audio_out_, &AudioOutput::soloAudioSourceChanged, this, &LiveStreamView::OnSoloAudioSourceChanged);
+            disconnect(audio_out_, &AudioOutput::audioSourceDriftChanged, this, &LiveStreamView::OnAudioSourceDriftChanged);
         }
         audio_out_ = audio_out;
         if (audio_out_)
@@ -82,12 +117,36 @@ void LiveStreamView::setAudioOut(AudioOutput *audio_out)
             connect(this, &LiveStreamView::setAudioSourcePosition, audio_out_, &AudioOutput::onSetAudioSourcePosition);
             connect(this, &LiveStreamView::setAudioSourceMute, audio_out_, &AudioOutput::onSetAudioSourceMute);
             connect(this, &LiveStreamView::setAudioSourceSolo, audio_out_, &AudioOutput::onSetAudioSourceSolo);
+            connect(this, &LiveStreamView::setAudioSourceQueue, audio_out_, &AudioOutput::onSetAudioSourceQueue);
             connect(audio_out_, &AudioOutput::soloAudioSourceChanged, this, &LiveStreamView::OnSoloAudioSourceChanged);
+            connect(audio_out_, &AudioOutput::audioSourceDriftChanged, this, &LiveStreamView::OnAudioSourceDriftChanged);
         }
+        ResetAudioFrameQueue();
         emit audioOutChanged();
     }
 }
 
+FixedGridLayout *LiveStreamView::videoLayout() const
+{
+    return video_layout_;
+}
+
+void LiveStreamView::setVideoLayout(FixedGridLayout *video_layout)
+{
+    if (video_layout != video_layout_)
+    {
+        if (video_layout_)
+            video_layout_->RemoveVideoTile(this);
+        video_layout_ = video_layout;
+        if (video_layout_)
+            video_layout_->AddVideoTile(this);
+        next_frames_.clear();
+        ResetVideoFrameQueue();
+        update();
+        emit videoLayoutChanged();
+    }
+}
+
 void LiveStreamView::setVolume(qreal new_volume)
 {
     if (volume_ != new_volume)
@@ -132,7 +191,14 @@ void LiveStreamView::setT(qreal new_t)
     if (t_ != new_t)
     {
         t_ = new_t;
-        update();
+        //Danmu animates in its own items, the video is only synchronized again when a new frame is due
+        if (TakeDueFrames())
+        {
+            if (video_layout_)
+                video_layout_->update();
+            else
+                update();
+        }
         subtitle_out_->setT(t_);
         emit tChanged();
     }
@@ -140,12 +206,58 @@ void LiveStreamView::setT(qreal new_t)
 
 QSGNode *LiveStreamView::updatePaintNode(QSGNode *node_base, QQuickItem::UpdatePaintNodeData *)
 {
-    VideoFrameRenderNodeOGL *node = static_cast<VideoFrameRenderNodeOGL *>(node_base);
-    if (!node)
+    if (video_layout_)
+        return nullptr;
+    bool software_video = VideoFrameRenderNodeSW::Enabled(window());
+    if (!node_base)
     {
         if (width() <= 0 || height() <= 0)
             return nullptr;
-        node = new VideoFrameRenderNodeOGL;
+        if (software_video)
+            node_base = new VideoFrameRenderNodeSW(window());
+        else
+            node_base = new VideoFrameRenderNodeOGL;
+    }
+    if (frame_due_)
+    {
+        node_base->markDirty(QSGNode::DirtyMaterial);
+        frame_due_ = false;
+    }
+
+    if (video_frame_queue_)
+    {
+        //The GUI thread is blocked, tracking present times here is safe
+        size_t drained_begin = next_frames_.size();
+        video_frame_queue_->Drain(next_frames_);
+        for (size_t i = drained_begin; i < next_frames_.size(); ++i)
+            TrackPresentTime(next_frames_[i]->present_time);
+    }
+
+    if (software_video)
+    {
+        VideoFrameRenderNodeSW *node = static_cast<VideoFrameRenderNodeSW *>(node_base);
+        if (!next_frames_.empty())
+        {
+            node->AddVideoFrames(std::move(next_frames_));
+            next_frames_.clear();
+        }
+        node->Synchronize(this);
+        return node;
+    }
+
+    VideoFrameRenderNodeOGL *node = static_cast<VideoFrameRenderNodeOGL *>(node_base);
+    if (texture_ring_)
+    {
+        VideoFrameUploadWorker *upload_worker = VideoFrameUploadWorker::Instance();
+        upload_worker->InitContext(QOpenGLContext::currentContext());
+        if (upload_worker->IsAvailable())
+        {
+            node->SetTextureRing(texture_ring_);
+            //Frames that arrived before the upload context existed
+            for (const auto &frame : next_frames_)
+                PushRingFrame(frame);
+            next_frames_.clear();
+        }
     }
 
     if (!next_frames_.empty())
@@ -163,10 +275,34 @@ void LiveStreamView::geometryChanged(const QRectF &newGeometry, const QRectF &ol
 {
     QQuickItem::geometryChanged(newGeometry, oldGeometry);
 
-    if (newGeometry.size() != oldGeometry.size())
+    if (video_layout_)
+        video_layout_->update();
+    else if (newGeometry.size() != oldGeometry.size())
         update();
 }
 
+void LiveStreamView::itemChange(ItemChange change, const ItemChangeData &value)
+{
+    QQuickItem::itemChange(change, value);
+
+    switch (change)
+    {
+    case ItemSceneChange:
+        if (window_)
+            disconnect(window_, &QWindow::visibilityChanged, this, &LiveStreamView::UpdateVideoVisible);
+        window_ = value.window;
+        if (window_)
+            connect(window_, &QWindow::visibilityChanged, this, &LiveStreamView::UpdateVideoVisible);
+        UpdateVideoVisible();
+        break;
+    case ItemVisibleHasChanged:
+        UpdateVideoVisible();
+        break;
+    default:
+        break;
+    }
+}
+
 void LiveStreamView::onNewMedia(const AVCodecContext *video_decoder_context, const AVCodecContext *audio_decoder_context)
 {
     Q_UNUSED(video_decoder_context);
@@ -177,6 +313,17 @@ void LiveStreamView::onNewVideoFrame(const QSharedPointer<VideoFrame> &video_fra
 {
     if (!current_source_ || sender() != current_source_->decoder())
         return;
+    TrackPresentTime(video_frame->present_time);
+    if (video_layout_)
+    {
+        video_layout_->AddVideoFrame(this, video_frame);
+        return;
+    }
+    if (texture_ring_ && VideoFrameUploadWorker::Instance()->IsAvailable())
+    {
+        PushRingFrame(video_frame);
+        return;
+    }
     bool need_update = next_frames_.empty();
     if (next_frames_.size() >= 8)
         next_frames_.erase(next_frames_.begin());
@@ -185,6 +332,37 @@ void LiveStreamView::onNewVideoFrame(const QSharedPointer<VideoFrame> &video_fra
         update();
 }
 
+void LiveStreamView::TrackPresentTime(PlaybackClock::time_point present_time)
+{
+    auto itr = std::upper_bound(pending_present_times_.begin(), pending_present_times_.end(), present_time);
+    pending_present_times_.insert(itr, present_time);
+    if (pending_present_times_.size() > kPendingPresentTimeLimit)
+        pending_present_times_.erase(pending_present_times_.begin());
+}
+
+bool LiveStreamView::TakeDueFrames()
+{
+    if (pending_present_times_.empty())
+        return false;
+    //Frames due by the next vsync have to be selected in the render that follows this tick
+    PlaybackClock::duration vsync_interval = 16ms;
+    QQuickWindow *window = this->window();
+    if (window && window->screen() && window->screen()->refreshRate() > 0)
+        vsync_interval = std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::duration<double>(1.0 / window->screen()->refreshRate()));
+    auto itr = std::upper_bound(pending_present_times_.begin(), pending_present_times_.end(), PlaybackClock::now() + vsync_interval);
+    if (itr == pending_present_times_.begin())
+        return false;
+    pending_present_times_.erase(pending_present_times_.begin(), itr);
+    frame_due_ = true;
+    return true;
+}
+
+void LiveStreamView::PushRingFrame(const QSharedPointer<VideoFrame> &video_frame)
+{
+    if (texture_ring_->PushFrame(video_frame))
+        VideoFrameUploadWorker::Instance()->Schedule(texture_ring_);
+}
+
 void LiveStreamView::onNewAudioFrame(const QSharedPointer<AudioFrame> &audio_frame)
 {
     if (!current_source_ || sender() != current_source_->decoder())
@@ -221,6 +399,57 @@ void LiveStreamView::OnSoloAudioSourceChanged(void *source_id)
     }
 }
 
+void LiveStreamView::ResetVideoFrameQueue()
+{
+    //A new queue per source, frames of the previous one can't leak in
+    if (video_frame_queue_)
+        video_frame_queue_->Close();
+    video_frame_queue_.reset();
+    if (current_source_ && !video_layout_)
+        video_frame_queue_ = QSharedPointer<VideoFrameQueue>::create(this);
+    if (current_source_)
+        emit setVideoFrameQueue(this, video_frame_queue_);
+}
+
+void LiveStreamView::ResetAudioFrameQueue()
+{
+    //Replaces the queue on both ends, frames left in the old one are discarded
+    audio_frame_queue_.reset();
+    if (current_source_ && audio_out_)
+        audio_frame_queue_ = QSharedPointer<AudioFrameQueue>::create();
+    if (current_source_)
+        emit setAudioFrameQueue(this, audio_frame_queue_);
+    if (audio_out_)
+        emit setAudioSourceQueue(this, audio_frame_queue_);
+}
+
+void LiveStreamView::UpdateVideoVisible()
+{
+    bool video_visible = isVisible() && window_ && window_->visibility() != QWindow::Minimized && window_->visibility() != QWindow::Hidden;
+    if (video_visible_ == video_visible)
+        return;
+    video_visible_ = video_visible;
+    if (!video_visible_)
+    {
+        //Frames already handed over are dropped too, the decoder stops pushing until the next keyframe after showing again
+        next_frames_.clear();
+        pending_present_times_.clear();
+    }
+    if (current_source_)
+        emit setVideoVisible(video_visible_);
+}
+
+void LiveStreamView::OnAudioSourceDriftChanged(void *source_id, qreal drift)
+{
+    if (!audio_out_ || sender() != audio_out_ || source_id != this)
+        return;
+    if (audio_drift_ != drift)
+    {
+        audio_drift_ = drift;
+        emit audioDriftChanged();
+    }
+}
+
 void LiveStreamView::OnWidthChanged()
 {
     subtitle_out_->setWidth(width());
@@ -1,13 +1,15 @@
 #ifndef LIVESTREAMVIEW_H
 #define LIVESTREAMVIEW_H
 
-#include "VideoFrame.h"
-#include "AudioFrame.h"
+#include "VideoFrameQueue.h"
+#include "AudioFrameQueue.h"
 #include "SubtitleFrame.h"
 
 class LiveStreamSource;
 class AudioOutput;
 class LiveStreamSubtitleOverlay;
+class FixedGridLayout;
+class VideoFrameTextureRing;
 
 class LiveStreamView : public QQuickItem
 {
@@ -16,11 +18,13 @@ class LiveStreamView : public QQuickItem
     Q_PROPERTY(LiveStreamSource* source READ source WRITE setSource NOTIFY sourceChanged)
     Q_PROPERTY(AudioOutput* audioOut READ audioOut WRITE setAudioOut NOTIFY audioOutChanged)
     Q_PROPERTY(LiveStreamSubtitleOverlay* subtitleOut READ subtitleOut NOTIFY subtitleOutChanged)
+    Q_PROPERTY(FixedGridLayout* videoLayout READ videoLayout WRITE setVideoLayout NOTIFY videoLayoutChanged)
 
     Q_PROPERTY(qreal volume READ volume WRITE setVolume NOTIFY volumeChanged)
     Q_PROPERTY(QVector3D position READ position WRITE setPosition NOTIFY positionChanged)
     Q_PROPERTY(bool mute READ mute WRITE setMute NOTIFY muteChanged)
     Q_PROPERTY(bool solo READ solo WRITE setSolo NOTIFY soloChanged)
+    Q_PROPERTY(qreal audioDrift READ audioDrift NOTIFY audioDriftChanged)
 
     Q_PROPERTY(qreal t READ t WRITE setT NOTIFY tChanged)
 public:
@@ -34,6 +38,8 @@ public:
     AudioOutput *audioOut() const { return audio_out_; }
     void setAudioOut(AudioOutput *audio_out);
     LiveStreamSubtitleOverlay *subtitleOut() const { return subtitle_out_; }
+    FixedGridLayout *videoLayout() const;
+    void setVideoLayout(FixedGridLayout *video_layout);
 
     qreal volume() const { return volume_; }
     void setVolume(qreal new_volume);
@@ -43,21 +49,26 @@ public:
     void setMute(bool new_mute);
     bool solo() const { return solo_; }
     void setSolo(bool new_solo);
+    //Milliseconds audio is heard later than video is shown, as measured by the audio output
+    qreal audioDrift() const { return audio_drift_; }
 
     qreal t() const { return t_; }
     void setT(qreal new_t);
 protected:
     QSGNode *updatePaintNode(QSGNode *, UpdatePaintNodeData *) override;
     void geometryChanged(const QRectF &newGeometry, const QRectF &oldGeometry) override;
+    void itemChange(ItemChange change, const ItemChangeData &value) override;
 signals:
     void sourceChanged();
     void audioOutChanged();
     void subtitleOutChanged();
+    void videoLayoutChanged();
 
     void volumeChanged();
     void positionChanged();
     void muteChanged();
     void soloChanged();
+    void audioDriftChanged();
 
     void newAudioSource(void *source_id, const AVCodecContext *context);
     void stopAudioSource(void *source_id);
@@ -67,6 +78,13 @@ signals:
     void setAudioSourcePosition(void *source_id, QVector3D position);
     void setAudioSourceMute(void *source_id, bool mute);
     void setAudioSourceSolo(void *source_id, bool solo);
+    void setAudioSourceQueue(void *source_id, const QSharedPointer<AudioFrameQueue> &queue);
+    void setAudioFrameQueue(void *owner, const QSharedPointer<AudioFrameQueue> &queue);
+    void detachAudioFrameQueue(void *owner);
+
+    void setVideoVisible(bool visible);
+    void setVideoFrameQueue(void *owner, const QSharedPointer<VideoFrameQueue> &queue);
+    void detachVideoOutput(void *owner);
 
     void tChanged();
 public slots:
@@ -76,18 +94,42 @@ public slots:
     void onNewSubtitleFrame(const QSharedPointer<SubtitleFrame> &subtitle_frame);
 private slots:
     void OnSoloAudioSourceChanged(void *source_id);
+    void OnAudioSourceDriftChanged(void *source_id, qreal drift);
 
     void OnWidthChanged();
     void OnHeightChanged();
+
+    void UpdateVideoVisible();
 private:
+    static constexpr size_t kPendingPresentTimeLimit = 16;
+
+    void TrackPresentTime(PlaybackClock::time_point present_time);
+    //Returns true if a frame handed to the render side becomes presentable by the next vsync
+    bool TakeDueFrames();
+    void PushRingFrame(const QSharedPointer<VideoFrame> &video_frame);
+    //Frames of the current source are handed to the render side through a queue unless the layout draws them
+    void ResetVideoFrameQueue();
+    //Audio frames of the current source go straight from the decoder to the audio output, bypassing the GUI thread
+    void ResetAudioFrameQueue();
+
     LiveStreamSource *current_source_ = nullptr;
     std::vector<QSharedPointer<VideoFrame>> next_frames_;
+    QSharedPointer<VideoFrameQueue> video_frame_queue_;
     AudioOutput *audio_out_ = nullptr;
+    QSharedPointer<AudioFrameQueue> audio_frame_queue_;
     LiveStreamSubtitleOverlay *subtitle_out_ = nullptr;
+    QPointer<FixedGridLayout> video_layout_; //Video is drawn by the layout instead of this item if set
+    QSharedPointer<VideoFrameTextureRing> texture_ring_; //Set if frames are uploaded by VideoFrameUploadWorker
+    std::vector<PlaybackClock::time_point> pending_present_times_;
+    bool frame_due_ = false;
+    //Not visible, or in a minimized or hidden window
+    bool video_visible_ = true;
+    QPointer<QQuickWindow> window_;
 
     qreal volume_ = 1;
     QVector3D position_;
     bool mute_ = false, solo_ = false;
+    qreal audio_drift_ = 0;
 
     qreal t_ = 0;
 };
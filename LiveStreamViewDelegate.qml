@@ -247,14 +247,9 @@ StackView {
 
                 source: display.sourceInfo ? display.sourceInfo.source : null
                 audioOut: display.audioOut
-                subtitleOut.textDelegate: Text {
-                    text: subtitleText
-                    color: subtitleColor
-                    font.pixelSize: 24
-                    font.bold: true
-                    style: Text.Outline
-                    styleColor: "black"
-                }
+                videoLayout: gridView.batchedVideo ? gridView : null
+                subtitleOut.font: Qt.font({ pixelSize: 24, bold: true })
+                subtitleOut.outlineColor: "black"
 
                 volume: sliderVolume.position
 
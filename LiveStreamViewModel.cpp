@@ -71,8 +71,60 @@ void LiveStreamViewModel::resetLayout(LiveStreamViewLayoutModel *layout_model)
     for (const auto &item : layout_model->LayoutItems())
         new_view_info.push_back(LiveStreamViewInfo(item.row(), item.column(), item.rowSpan(), item.columnSpan(), -1, nullptr, audio_out_));
 
+    //Carry sources over to the new layout so that their connections and decoders survive, views with unchanged geometry keep their sources
+    std::vector<int> displaced_sources;
+    for (const auto &old_view_info : view_info_)
+    {
+        if (old_view_info.sourceId() == -1)
+            continue;
+        auto itr = std::find_if(new_view_info.begin(), new_view_info.end(), [&old_view_info](const LiveStreamViewInfo &view_info)
+        {
+            return view_info.sourceId() == -1 &&
+                view_info.row() == old_view_info.row() && view_info.column() == old_view_info.column() &&
+                view_info.rowSpan() == old_view_info.rowSpan() && view_info.columnSpan() == old_view_info.columnSpan();
+        });
+        if (itr != new_view_info.end())
+            itr->setSourceInfo(old_view_info.sourceId(), old_view_info.sourceInfo());
+        else
+            displaced_sources.push_back(old_view_info.sourceId());
+    }
+    //Then fill empty views with the rest in their original order
+    auto itr_empty_view = new_view_info.begin();
+    for (int source_id : displaced_sources)
+    {
+        while (itr_empty_view != new_view_info.end() && itr_empty_view->sourceId() != -1)
+            ++itr_empty_view;
+        if (itr_empty_view == new_view_info.end())
+            break;
+        itr_empty_view->setSourceInfo(source_id, nullptr);
+    }
+
     if (Q_LIKELY(source_model_))
-        source_model_->DeactivateAllSource();
+    {
+        //Only sources that no longer fit are released
+        std::vector<std::pair<int, LiveStreamSourceInfo *>> sources;
+        for (const auto &view_info : new_view_info)
+            if (view_info.sourceId() != -1)
+                sources.emplace_back(view_info.sourceId(), nullptr);
+        source_model_->ActivateAndGetSources(sources);
+        auto itr_source = sources.begin();
+        for (auto &view_info : new_view_info)
+        {
+            if (view_info.sourceId() == -1)
+                continue;
+            Q_ASSERT(itr_source != sources.end() && itr_source->first == view_info.sourceId());
+            if (itr_source->second)
+                view_info.setSourceInfo(itr_source->first, itr_source->second);
+            else
+                view_info.setSourceInfo(-1, nullptr);
+            ++itr_source;
+        }
+    }
+    else
+    {
+        for (auto &view_info : new_view_info)
+            view_info.setSourceInfo(-1, nullptr);
+    }
 
     setRows(layout_model->rows());
     setColumns(layout_model->columns());
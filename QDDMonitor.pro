@@ -10,9 +10,16 @@ CONFIG(release, debug|release): CONFIG += ltcg
 HEADERS += \
     AVObjectWrapper.h \
     AudioFrame.h \
+    AudioFrameQueue.h \
+    AudioMixer.h \
     AudioOutput.h \
+    AudioSampleRing.h \
+    AudioSink.h \
+    AudioTimeline.h \
     BlockingFIFOBuffer.h \
+    DanmuJsonScanner.h \
     FixedGridLayout.h \
+    FlvTagAligner.h \
     LiveStreamDecoder.h \
     LiveStreamSource.h \
     LiveStreamSourceBilibili.h \
@@ -24,15 +31,23 @@ HEADERS += \
     LiveStreamViewLayoutModel.h \
     LiveStreamViewModel.h \
     SubtitleFrame.h \
+    SubtitleLaneTree.h \
     VideoFrame.h \
+    VideoFrameGridRenderNodeOGL.h \
+    VideoFrameQueue.h \
     VideoFrameRenderNodeOGL.h \
+    VideoFrameRenderNodeSW.h \
+    VideoFrameUploadQueue.h \
+    VideoFrameUploadWorker.h \
     pch.h
 
 PRECOMPILED_HEADER = pch.h
 QMAKE_MOC_OPTIONS += -b pch.h
 
 SOURCES += \
+        AudioMixer.cpp \
         AudioOutput.cpp \
+        AudioSink.cpp \
         FixedGridLayout.cpp \
         LiveStreamDecoder.cpp \
         LiveStreamSource.cpp \
@@ -44,7 +59,11 @@ SOURCES += \
         LiveStreamView.cpp \
         LiveStreamViewLayoutModel.cpp \
         LiveStreamViewModel.cpp \
+        VideoFrameGridRenderNodeOGL.cpp \
         VideoFrameRenderNodeOGL.cpp \
+        VideoFrameRenderNodeSW.cpp \
+        VideoFrameUploadQueue.cpp \
+        VideoFrameUploadWorker.cpp \
         main.cpp
 
 RESOURCES += qml.qrc \
@@ -0,0 +1,52 @@
+#ifndef SUBTITLELANETREE_H
+#define SUBTITLELANETREE_H
+
+//Min tree over the rows of one style, each row holds the time after which it no longer blocks a new item
+//Finding the first row a new item fits in is O(log rows) instead of checking every row
+class SubtitleLaneTree
+{
+public:
+    static constexpr int64_t kFree = std::numeric_limits<int64_t>::min();
+    static constexpr int64_t kBlocked = std::numeric_limits<int64_t>::max();
+
+    void Reset(int row_count)
+    {
+        row_count_ = row_count;
+        leaf_count_ = 1;
+        while (leaf_count_ < row_count)
+            leaf_count_ *= 2;
+        //Rows past row_count stay blocked so they're never found
+        values_.assign(leaf_count_ * 2, kBlocked);
+        for (int row = 0; row < row_count; ++row)
+            values_[leaf_count_ + row] = kFree;
+        for (int i = leaf_count_ - 1; i > 0; --i)
+            values_[i] = std::min(values_[i * 2], values_[i * 2 + 1]);
+    }
+
+    int RowCount() const { return row_count_; }
+
+    void Set(int row, int64_t value)
+    {
+        Q_ASSERT(row >= 0 && row < row_count_);
+        int i = leaf_count_ + row;
+        values_[i] = value;
+        for (i /= 2; i > 0; i /= 2)
+            values_[i] = std::min(values_[i * 2], values_[i * 2 + 1]);
+    }
+
+    //Lowest row whose value is below threshold, -1 if none
+    int FindFirstBelow(int64_t threshold) const
+    {
+        if (row_count_ == 0 || values_[1] >= threshold)
+            return -1;
+        int i = 1;
+        while (i < leaf_count_)
+            i = values_[i * 2] < threshold ? i * 2 : i * 2 + 1;
+        return i - leaf_count_;
+    }
+private:
+    int row_count_ = 0, leaf_count_ = 1;
+    std::vector<int64_t> values_ = std::vector<int64_t>(2, kBlocked);
+};
+
+#endif // SUBTITLELANETREE_H
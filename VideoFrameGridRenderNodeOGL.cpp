@@ -0,0 +1,583 @@
+#include "pch.h"
+#include "VideoFrameGridRenderNodeOGL.h"
+
+namespace
+{
+
+static constexpr int kCornerCount = 4 * 2; //triangle strip, vec2
+static constexpr int kInstanceComponentCount = 4 + 4 + 1; //rect, luma and chroma plane size and layer
+static constexpr int kInstanceStride = kInstanceComponentCount * sizeof(GLfloat);
+static constexpr int kLayerGranularity = 8;
+
+constexpr inline qreal ScreenRefreshRate(qreal refresh_rate)
+{
+    if (refresh_rate >= 59 && refresh_rate <= 60)
+        refresh_rate = 60; //Manual patch
+    return refresh_rate;
+}
+
+QByteArray ShaderSource(const QString &file_path)
+{
+    QFile file(file_path);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    QByteArray source = QOpenGLContext::currentContext()->isOpenGLES() ? QByteArrayLiteral("#version 300 es\n") : QByteArrayLiteral("#version 330\n");
+    return source + file.readAll();
+}
+
+void InitArrayTexture(std::unique_ptr<QOpenGLTexture> &texture, const QSize &size, int layers, QOpenGLTexture::TextureFormat texture_format, QOpenGLTexture::PixelFormat pixel_format)
+{
+    texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2DArray);
+    texture->setSize(size.width(), size.height());
+    texture->setLayers(layers);
+    texture->setFormat(texture_format);
+    texture->allocateStorage(pixel_format, QOpenGLTexture::UInt8);
+    texture->setMinificationFilter(QOpenGLTexture::Linear);
+    texture->setMagnificationFilter(QOpenGLTexture::Linear);
+    texture->setWrapMode(QOpenGLTexture::ClampToEdge);
+}
+
+//Same placement as VideoFrameRenderNodeOGL
+QRectF LetterboxRect(const QRectF &bounds, const QSize &frame_size)
+{
+    qreal r1 = frame_size.width() * bounds.height(), r2 = bounds.width() * frame_size.height();
+    QRectF rect = bounds;
+    if (r1 > r2)
+    {
+        qreal render_height = frame_size.height() * bounds.width() / frame_size.width();
+        rect.setY(bounds.y() + (bounds.height() - render_height) / 2);
+        rect.setHeight(render_height);
+    }
+    else if (r1 < r2)
+    {
+        qreal render_width = frame_size.width() * bounds.height() / frame_size.height();
+        rect.setX(bounds.x() + (bounds.width() - render_width) / 2);
+        rect.setWidth(render_width);
+    }
+    return rect.adjusted(0, 0, -1, -1);
+}
+
+}
+
+bool VideoFrameGridRenderNodeOGL::TextureArrayGroup::IsCompatible(const PixelUnpackBufferItem &item) const
+{
+    return pixel_format == item.pixel_format && color_range == item.color_range && colorspace == item.colorspace;
+}
+
+VideoFrameGridRenderNodeOGL::VideoFrameGridRenderNodeOGL()
+{
+}
+
+VideoFrameGridRenderNodeOGL::~VideoFrameGridRenderNodeOGL()
+{
+    VideoFrameGridRenderNodeOGL::releaseResources();
+}
+
+void VideoFrameGridRenderNodeOGL::releaseResources()
+{
+    for (auto &tile : tiles_)
+    {
+        tile.second->frame_queue.ReleaseResources();
+        tile.second->group = nullptr;
+        tile.second->layer = -1;
+    }
+    groups_.clear();
+    for (int i = 0; i < ShaderTypeCount; ++i)
+        shaders_[i].program = nullptr;
+    vertex_buffer_ = nullptr;
+    instance_buffer_ = nullptr;
+}
+
+bool VideoFrameGridRenderNodeOGL::IsSupported(QOpenGLContext *context)
+{
+    if (!context)
+        return false;
+    QSurfaceFormat format = context->format();
+    if (context->isOpenGLES())
+        return format.majorVersion() >= 3;
+    return format.version() >= qMakePair(3, 3);
+}
+
+VideoFrameGridRenderNodeOGL::ShaderItem *VideoFrameGridRenderNodeOGL::GetShader(AVPixelFormat pixel_format)
+{
+    ShaderType type;
+    const char *fragment_shader_path;
+    switch (pixel_format)
+    {
+    case AV_PIX_FMT_RGB0:
+        type = ShaderRGBX;
+        fragment_shader_path = ":/shaders/rgbxarray.frag";
+        break;
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+        type = ShaderYUVBiplanar;
+        fragment_shader_path = ":/shaders/yuvbiplanararray.frag";
+        break;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        type = ShaderYUVTriplanar;
+        fragment_shader_path = ":/shaders/yuvtriplanararray.frag";
+        break;
+    default:
+        return nullptr;
+    }
+
+    ShaderItem &shader = shaders_[type];
+    if (!shader.program)
+    {
+        shader.program = std::make_unique<QOpenGLShaderProgram>();
+        shader.program->addCacheableShaderFromSourceCode(QOpenGLShader::Vertex, ShaderSource(":/shaders/instanced.vert"));
+        shader.program->addCacheableShaderFromSourceCode(QOpenGLShader::Fragment, ShaderSource(fragment_shader_path));
+        shader.program->bindAttributeLocation("cornerIn", 0);
+        shader.program->bindAttributeLocation("rectIn", 1);
+        shader.program->bindAttributeLocation("planeSizeIn", 2);
+        shader.program->bindAttributeLocation("layerIn", 3);
+        shader.program->link();
+
+        shader.matrix_uniform_index = shader.program->uniformLocation("matrix");
+        shader.opacity_uniform_index = shader.program->uniformLocation("opacity");
+        shader.color_matrix_uniform_index = shader.program->uniformLocation("colorMatrix");
+        shader.layer_plane_size_uniform_index = shader.program->uniformLocation("layerPlaneSize");
+        shader.texture_uniform_index[0] = shader.program->uniformLocation("texture0");
+        shader.texture_uniform_index[1] = shader.program->uniformLocation("texture1");
+        shader.texture_uniform_index[2] = shader.program->uniformLocation("texture2");
+    }
+    return &shader;
+}
+
+void VideoFrameGridRenderNodeOGL::InitVertexBuffer()
+{
+    static constexpr GLfloat kCornerIn[] = {
+        0.0f, 0.0f,
+        0.0f, 1.0f,
+        1.0f, 0.0f,
+        1.0f, 1.0f,
+    };
+    static_assert(sizeof(kCornerIn) == kCornerCount * sizeof(GLfloat));
+    vertex_buffer_ = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+    vertex_buffer_->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    vertex_buffer_->create();
+    vertex_buffer_->bind();
+    vertex_buffer_->allocate(kCornerIn, sizeof(kCornerIn));
+    vertex_buffer_->release();
+
+    instance_buffer_ = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::VertexBuffer);
+    instance_buffer_->setUsagePattern(QOpenGLBuffer::StreamDraw);
+    instance_buffer_->create();
+}
+
+void VideoFrameGridRenderNodeOGL::AssignLayer(Tile &tile, const void *tile_id, const PixelUnpackBufferItem &item)
+{
+    if (VideoFrameUploadQueue::PlaneCount(item.pixel_format) == 0)
+    {
+        qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
+        ReleaseLayer(tile);
+        return;
+    }
+
+    if (tile.group && !tile.group->IsCompatible(item))
+        ReleaseLayer(tile);
+    if (!tile.group)
+    {
+        TextureArrayGroup *group = nullptr;
+        for (auto &group_item : groups_)
+        {
+            if (group_item->IsCompatible(item))
+            {
+                group = group_item.get();
+                break;
+            }
+        }
+        if (!group)
+        {
+            groups_.push_back(std::make_unique<TextureArrayGroup>());
+            group = groups_.back().get();
+            group->pixel_format = item.pixel_format;
+            group->color_range = item.color_range;
+            group->colorspace = item.colorspace;
+            group->color_matrix = VideoFrameUploadQueue::ColorMatrix(item.pixel_format, item.colorspace, item.color_range);
+        }
+
+        auto itr = std::find(group->layers.begin(), group->layers.end(), nullptr);
+        if (itr != group->layers.end())
+        {
+            *itr = tile_id;
+            tile.layer = itr - group->layers.begin();
+        }
+        else
+        {
+            group->layers.push_back(tile_id);
+            tile.layer = group->layers.size() - 1;
+        }
+        tile.group = group;
+    }
+
+    //Layers only grow while the group is alive so that tiles switching resolution don't reallocate every time
+    TextureArrayGroup &group = *tile.group;
+    QSize layer_size = group.layer_size.expandedTo(item.frame_size);
+    int layer_count = (static_cast<int>(group.layers.size()) + kLayerGranularity - 1) / kLayerGranularity * kLayerGranularity;
+    if (!group.textures[0] || layer_size != group.layer_size || layer_count > group.textures[0]->layers())
+        ResizeGroup(group, layer_size, std::max(layer_count, group.textures[0] ? group.textures[0]->layers() : 0));
+    tile.frame_size = item.frame_size;
+}
+
+void VideoFrameGridRenderNodeOGL::ReleaseLayer(Tile &tile)
+{
+    TextureArrayGroup *group = tile.group;
+    int layer = tile.layer;
+    tile.group = nullptr;
+    tile.layer = -1;
+    tile.need_refill = false;
+    if (!group)
+        return;
+
+    group->layers[layer] = nullptr;
+    if (std::all_of(group->layers.begin(), group->layers.end(), [](const void *layer_owner) { return layer_owner == nullptr; }))
+        groups_.erase(std::find_if(groups_.begin(), groups_.end(), [group](const std::unique_ptr<TextureArrayGroup> &group_item) { return group_item.get() == group; }));
+}
+
+void VideoFrameGridRenderNodeOGL::ResizeGroup(TextureArrayGroup &group, const QSize &layer_size, int layer_count)
+{
+    group.layer_size = layer_size;
+    int plane_count = VideoFrameUploadQueue::PlaneCount(group.pixel_format);
+    for (int i = 0; i < kTextureItemCount; ++i)
+    {
+        if (i >= plane_count)
+        {
+            group.textures[i] = nullptr;
+            continue;
+        }
+        QOpenGLTexture::TextureFormat texture_format;
+        QOpenGLTexture::PixelFormat texture_pixel_format;
+        VideoFrameUploadQueue::PlaneTextureFormat(group.pixel_format, i, texture_format, texture_pixel_format);
+        InitArrayTexture(group.textures[i], VideoFrameUploadQueue::PlaneSize(group.pixel_format, layer_size, i), layer_count, texture_format, texture_pixel_format);
+    }
+
+    //New storage is empty, every tile in the group has to upload its current frame again
+    for (auto &tile : tiles_)
+        if (tile.second->group == &group)
+            tile.second->need_refill = true;
+}
+
+void VideoFrameGridRenderNodeOGL::UpdateLayer(Tile &tile, PixelUnpackBufferItem &item)
+{
+    if (!item.buffer)
+        return;
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    TextureArrayGroup &group = *tile.group;
+    int plane_count = VideoFrameUploadQueue::PlaneCount(item.pixel_format);
+
+    tile.frame_queue.BeginTransfer();
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    item.buffer->bind();
+    for (int i = 0; i < plane_count && group.textures[i]; ++i)
+    {
+        QOpenGLTexture::TextureFormat texture_format;
+        QOpenGLTexture::PixelFormat texture_pixel_format;
+        VideoFrameUploadQueue::PlaneTextureFormat(item.pixel_format, i, texture_format, texture_pixel_format);
+        QSize plane_size = VideoFrameUploadQueue::PlaneSize(item.pixel_format, item.frame_size, i);
+
+        group.textures[i]->bind();
+        f->glTexSubImage3D(static_cast<GLenum>(QOpenGLTexture::Target2DArray), 0, 0, 0, tile.layer, plane_size.width(), plane_size.height(), 1, static_cast<GLenum>(texture_pixel_format), GL_UNSIGNED_BYTE, item.PlaneData(i));
+        group.textures[i]->release();
+    }
+    item.buffer->release();
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    tile.frame_queue.EndTransfer(item);
+    tile.need_refill = false;
+
+#ifdef _DEBUG
+    texture_updates_per_second_ += 1;
+#endif
+}
+
+void VideoFrameGridRenderNodeOGL::render(const RenderState *state)
+{
+    auto playback_time = playback_time_base_ + playback_time_interval_ * playback_time_tick_;
+    auto current_time = PlaybackClock::now();
+    if (std::chrono::abs(playback_time - current_time) > playback_time_interval_)
+    {
+        ResynchronizeTimer(current_time);
+        playback_time = current_time;
+        playback_time_tick_ = 1; //Progress tick
+    }
+    else
+    {
+        playback_time_tick_ += 1;
+    }
+
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (!support_checked_)
+    {
+        support_checked_ = true;
+        supported_ = IsSupported(context);
+        if (!supported_)
+            qCWarning(CategoryVideoPlayback) << "Batched video rendering needs OpenGL 3.3 or OpenGL ES 3.0";
+    }
+    if (!supported_)
+        return;
+
+#ifdef _DEBUG
+    PlaybackClock::time_point render_begin = PlaybackClock::now();
+#endif
+
+    for (auto &[tile_id, tile] : tiles_)
+    {
+        if (PixelUnpackBufferItem *selected_texture_buffer = tile->frame_queue.SelectPresentable(playback_time))
+        {
+            AssignLayer(*tile, tile_id, *selected_texture_buffer);
+            if (tile->group)
+                UpdateLayer(*tile, *selected_texture_buffer);
+        }
+    }
+    for (auto &[tile_id, tile] : tiles_)
+    {
+        if (tile->need_refill)
+        {
+            if (PixelUnpackBufferItem *last_texture_buffer = tile->frame_queue.LastPresented())
+                UpdateLayer(*tile, *last_texture_buffer);
+        }
+        tile->frame_queue.Upload(playback_time, playback_time_interval_);
+    }
+
+    //Instances are laid out group by group so that each group is one contiguous range
+    struct DrawRange
+    {
+        TextureArrayGroup *group;
+        int first, count;
+    };
+    std::vector<DrawRange> draw_ranges;
+    instance_data_.clear();
+    for (auto &group : groups_)
+    {
+        int first = instance_data_.size() / kInstanceComponentCount;
+        for (auto &[tile_id, tile] : tiles_)
+        {
+            if (tile->group != group.get() || tile->rect.isEmpty() || tile->frame_size.isEmpty())
+                continue;
+            QRectF rect = LetterboxRect(tile->rect, tile->frame_size);
+            QSize chroma_size = VideoFrameUploadQueue::PlaneSize(group->pixel_format, tile->frame_size, 1);
+            instance_data_.insert(instance_data_.end(), {
+                                      GLfloat(rect.x()), GLfloat(rect.y()), GLfloat(rect.width()), GLfloat(rect.height()),
+                                      GLfloat(tile->frame_size.width()), GLfloat(tile->frame_size.height()), GLfloat(chroma_size.width()), GLfloat(chroma_size.height()),
+                                      GLfloat(tile->layer),
+                                  });
+        }
+        int count = instance_data_.size() / kInstanceComponentCount - first;
+        if (count > 0)
+            draw_ranges.push_back({ group.get(), first, count });
+    }
+
+    if (!draw_ranges.empty())
+    {
+        QOpenGLExtraFunctions *f = context->extraFunctions();
+
+        if (!vertex_buffer_)
+            InitVertexBuffer();
+        instance_buffer_->bind();
+        instance_buffer_->allocate(instance_data_.data(), instance_data_.size() * sizeof(GLfloat));
+        instance_buffer_->release();
+
+        f->glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+        f->glEnable(GL_BLEND);
+        f->glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+        if (state->scissorEnabled())
+        {
+            f->glEnable(GL_SCISSOR_TEST);
+            const QRect r = state->scissorRect();
+            f->glScissor(r.x(), r.y(), r.width(), r.height());
+        }
+        if (state->stencilEnabled())
+        {
+            f->glEnable(GL_STENCIL_TEST);
+            f->glStencilFunc(GL_EQUAL, state->stencilValue(), 0xFF);
+            f->glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        }
+
+        QMatrix4x4 matrix = *state->projectionMatrix() * *this->matrix();
+        for (const DrawRange &draw_range : draw_ranges)
+        {
+            TextureArrayGroup &group = *draw_range.group;
+            ShaderItem *shader = GetShader(group.pixel_format);
+            if (!shader)
+                continue;
+
+            shader->program->bind();
+            shader->program->setUniformValue(shader->matrix_uniform_index, matrix);
+            shader->program->setUniformValue(shader->opacity_uniform_index, (GLfloat)inheritedOpacity());
+            if (shader->color_matrix_uniform_index != -1)
+                shader->program->setUniformValue(shader->color_matrix_uniform_index, group.color_matrix);
+            QSize layer_chroma_size = VideoFrameUploadQueue::PlaneSize(group.pixel_format, group.layer_size, 1);
+            shader->program->setUniformValue(shader->layer_plane_size_uniform_index, QVector4D(group.layer_size.width(), group.layer_size.height(), layer_chroma_size.width(), layer_chroma_size.height()));
+            for (int i = 0; i < kTextureItemCount && group.textures[i]; ++i)
+            {
+                f->glActiveTexture(GL_TEXTURE0 + i);
+                group.textures[i]->bind();
+                shader->program->setUniformValue(shader->texture_uniform_index[i], i);
+            }
+
+            vertex_buffer_->bind();
+            shader->program->setAttributeBuffer(0, GL_FLOAT, 0, 2);
+            shader->program->enableAttributeArray(0);
+            instance_buffer_->bind();
+            shader->program->setAttributeBuffer(1, GL_FLOAT, draw_range.first * kInstanceStride, 4, kInstanceStride);
+            shader->program->setAttributeBuffer(2, GL_FLOAT, draw_range.first * kInstanceStride + 4 * sizeof(GLfloat), 4, kInstanceStride);
+            shader->program->setAttributeBuffer(3, GL_FLOAT, draw_range.first * kInstanceStride + 8 * sizeof(GLfloat), 1, kInstanceStride);
+            shader->program->enableAttributeArray(1);
+            shader->program->enableAttributeArray(2);
+            shader->program->enableAttributeArray(3);
+            f->glVertexAttribDivisor(1, 1);
+            f->glVertexAttribDivisor(2, 1);
+            f->glVertexAttribDivisor(3, 1);
+
+            f->glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, draw_range.count);
+
+#ifdef _DEBUG
+            draws_per_second_ += 1;
+#endif
+        }
+
+        //Instanced attributes would leak into the next scene graph batch otherwise
+        f->glVertexAttribDivisor(1, 0);
+        f->glVertexAttribDivisor(2, 0);
+        f->glVertexAttribDivisor(3, 0);
+        f->glDisableVertexAttribArray(1);
+        f->glDisableVertexAttribArray(2);
+        f->glDisableVertexAttribArray(3);
+        instance_buffer_->release();
+        f->glActiveTexture(GL_TEXTURE0);
+    }
+
+#ifdef _DEBUG
+    PlaybackClock::time_point render_end = PlaybackClock::now();
+    auto render_time = render_end - render_begin;
+    if (render_time > max_render_time_)
+        max_render_time_ = render_time;
+    total_render_time_ += render_time;
+    renders_per_second_ += 1;
+    if (current_time - last_second_ > std::chrono::seconds(1))
+    {
+        if (current_time - last_second_ > std::chrono::seconds(3))
+            last_second_ = current_time;
+        else
+            last_second_ += std::chrono::seconds(1);
+        qCDebug(CategoryVideoPlayback) << tiles_.size() << " tiles in " << groups_.size() << " texture array groups";
+        qCDebug(CategoryVideoPlayback) << frames_per_second_ << " fps from sources";
+        qCDebug(CategoryVideoPlayback) << renders_per_second_ << " fps render";
+        qCDebug(CategoryVideoPlayback) << draws_per_second_ << " instanced draws";
+        qCDebug(CategoryVideoPlayback) << texture_updates_per_second_ << " texture updates";
+        qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_render_time_).count() << "us max render time";
+        if (renders_per_second_ > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(total_render_time_).count() / renders_per_second_ << "us average render time";
+        VideoFrameUploadQueue::UploadStatistics upload_statistics;
+        for (auto &tile : tiles_)
+        {
+            VideoFrameUploadQueue::UploadStatistics tile_statistics = tile.second->frame_queue.TakeStatistics();
+            upload_statistics.copy_time += tile_statistics.copy_time;
+            upload_statistics.transfer_gpu_time += tile_statistics.transfer_gpu_time;
+            upload_statistics.copies += tile_statistics.copies;
+            upload_statistics.transfers_timed += tile_statistics.transfers_timed;
+            upload_statistics.fence_stalls += tile_statistics.fence_stalls;
+            upload_statistics.skipped_frames += tile_statistics.skipped_frames;
+        }
+        if (upload_statistics.copies > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(upload_statistics.copy_time).count() / upload_statistics.copies << "us average copy time";
+        if (upload_statistics.transfers_timed > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(upload_statistics.transfer_gpu_time).count() / upload_statistics.transfers_timed << "us average GPU transfer time";
+        qCDebug(CategoryVideoPlayback) << upload_statistics.fence_stalls << " uploads deferred by busy buffers";
+        qCDebug(CategoryVideoPlayback) << upload_statistics.skipped_frames << " frames skipped before upload";
+        size_t texture_bytes = 0;
+        for (auto &group : groups_)
+            texture_bytes += static_cast<size_t>(VideoFrameUploadQueue::TextureBytes(group->pixel_format, group->layer_size)) * group->layers.size();
+        if (!tiles_.empty())
+            qCDebug(CategoryVideoPlayback) << texture_bytes / tiles_.size() / 1024 << "KiB texture memory per tile," << texture_bytes / 1024 << "KiB total";
+        max_render_time_ = total_render_time_ = PlaybackClock::duration::zero();
+        frames_per_second_ = renders_per_second_ = texture_updates_per_second_ = draws_per_second_ = 0;
+    }
+#endif
+}
+
+QSGRenderNode::StateFlags VideoFrameGridRenderNodeOGL::changedStates() const
+{
+    return ColorState | BlendState | ScissorState | StencilState;
+}
+
+QSGRenderNode::RenderingFlags VideoFrameGridRenderNodeOGL::flags() const
+{
+    return BoundedRectRendering | DepthAwareRendering;
+}
+
+QRectF VideoFrameGridRenderNodeOGL::rect() const
+{
+    return QRect(0, 0, width_, height_);
+}
+
+void VideoFrameGridRenderNodeOGL::AddVideoFrames(const void *tile_id, std::vector<QSharedPointer<VideoFrame>> &&frames)
+{
+#ifdef _DEBUG
+    frames_per_second_ += frames.size();
+#endif
+    std::unique_ptr<Tile> &tile = tiles_[tile_id];
+    if (!tile)
+        tile = std::make_unique<Tile>();
+    tile->frame_queue.AddVideoFrames(std::move(frames));
+}
+
+void VideoFrameGridRenderNodeOGL::SetTileRect(const void *tile_id, const QRectF &rect)
+{
+    std::unique_ptr<Tile> &tile = tiles_[tile_id];
+    if (!tile)
+        tile = std::make_unique<Tile>();
+    tile->rect = rect;
+}
+
+void VideoFrameGridRenderNodeOGL::RemoveTile(const void *tile_id)
+{
+    auto itr = tiles_.find(tile_id);
+    if (itr == tiles_.end())
+        return;
+    ReleaseLayer(*itr->second);
+    tiles_.erase(itr);
+}
+
+void VideoFrameGridRenderNodeOGL::Synchronize(QQuickItem *item)
+{
+    if (width_ != item->width() || height_ != item->height())
+    {
+        width_ = item->width();
+        height_ = item->height();
+        this->markDirty(DirtyGeometry);
+    }
+    this->markDirty(DirtyMaterial);
+
+    QQuickWindow *window = item->window();
+    if (window)
+    {
+        qreal device_pixel_ratio = window->effectiveDevicePixelRatio();
+        for (auto &tile : tiles_)
+            tile.second->frame_queue.SetTargetSize((tile.second->rect.size() * device_pixel_ratio).toSize());
+
+        QScreen *screen = window->screen();
+        if (screen_ != screen)
+        {
+            screen_ = screen;
+            if (screen)
+            {
+                static constexpr auto kTickPerSecond = std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::seconds(1)).count();
+                refresh_rate_ = ScreenRefreshRate(screen->refreshRate());
+                playback_time_interval_ = PlaybackClock::duration(static_cast<PlaybackClock::duration::rep>(round(kTickPerSecond / refresh_rate_)));
+            }
+        }
+    }
+}
+
+void VideoFrameGridRenderNodeOGL::ResynchronizeTimer(PlaybackClock::time_point current_time)
+{
+    qCDebug(CategoryVideoPlayback) << "Resynchronizing clock, Error: " << std::chrono::duration_cast<std::chrono::microseconds>(current_time - playback_time_base_).count() << "us";
+    playback_time_base_ = current_time;
+    playback_time_tick_ = 0;
+}
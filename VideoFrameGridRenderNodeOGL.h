@@ -0,0 +1,101 @@
+#ifndef VIDEOFRAMEGRIDRENDERNODEOGL_H
+#define VIDEOFRAMEGRIDRENDERNODEOGL_H
+
+#include "VideoFrameUploadQueue.h"
+
+//Draws the video of every tile of a layout, the planes of all tiles with the same format share one texture array per plane
+//Every format is drawn with a single instanced draw, needs OpenGL 3.3 or OpenGL ES 3.0
+class VideoFrameGridRenderNodeOGL : public QSGRenderNode
+{
+    static constexpr int kTextureItemCount = VideoFrameUploadQueue::kPlaneCount;
+    using PixelUnpackBufferItem = VideoFrameUploadQueue::PixelUnpackBufferItem;
+
+    struct TextureArrayGroup
+    {
+        AVPixelFormat pixel_format = AV_PIX_FMT_NONE;
+        AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+        AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED;
+        QMatrix4x4 color_matrix;
+
+        std::unique_ptr<QOpenGLTexture> textures[kTextureItemCount];
+        QSize layer_size;
+        std::vector<const void *> layers; //Tile owning each layer, nullptr if free
+
+        bool IsCompatible(const PixelUnpackBufferItem &item) const;
+    };
+    struct Tile
+    {
+        VideoFrameUploadQueue frame_queue;
+        QRectF rect;
+
+        TextureArrayGroup *group = nullptr;
+        int layer = -1;
+        QSize frame_size;
+        bool need_refill = false;
+    };
+    enum ShaderType
+    {
+        ShaderRGBX,
+        ShaderYUVBiplanar,
+        ShaderYUVTriplanar,
+        ShaderTypeCount
+    };
+    struct ShaderItem
+    {
+        std::unique_ptr<QOpenGLShaderProgram> program;
+        int matrix_uniform_index = -1, opacity_uniform_index = -1, color_matrix_uniform_index = -1, layer_plane_size_uniform_index = -1;
+        int texture_uniform_index[kTextureItemCount] = { -1, -1, -1 };
+    };
+public:
+    VideoFrameGridRenderNodeOGL();
+    ~VideoFrameGridRenderNodeOGL();
+
+    void render(const RenderState *state) override;
+    void releaseResources() override;
+    StateFlags changedStates() const override;
+    RenderingFlags flags() const override;
+    QRectF rect() const override;
+
+    static bool IsSupported(QOpenGLContext *context);
+
+    //Tiles are identified by their items, rect is in the coordinates of the item owning this node
+    void AddVideoFrames(const void *tile_id, std::vector<QSharedPointer<VideoFrame>> &&frames);
+    void SetTileRect(const void *tile_id, const QRectF &rect);
+    void RemoveTile(const void *tile_id);
+
+    void Synchronize(QQuickItem *item);
+private:
+    ShaderItem *GetShader(AVPixelFormat pixel_format);
+    void InitVertexBuffer();
+
+    void AssignLayer(Tile &tile, const void *tile_id, const PixelUnpackBufferItem &item);
+    void ReleaseLayer(Tile &tile);
+    void ResizeGroup(TextureArrayGroup &group, const QSize &layer_size, int layer_count);
+    void UpdateLayer(Tile &tile, PixelUnpackBufferItem &item);
+
+    void ResynchronizeTimer(PlaybackClock::time_point current_time);
+
+    int width_ = 0, height_ = 0;
+    QScreen *screen_ = nullptr;
+
+    PlaybackClock::time_point playback_time_base_;
+    PlaybackClock::duration playback_time_interval_ = 1s;
+    int playback_time_tick_;
+    qreal refresh_rate_ = 1;
+
+    std::unordered_map<const void *, std::unique_ptr<Tile>> tiles_;
+    std::vector<std::unique_ptr<TextureArrayGroup>> groups_;
+
+    bool support_checked_ = false, supported_ = false;
+    ShaderItem shaders_[ShaderTypeCount];
+    std::unique_ptr<QOpenGLBuffer> vertex_buffer_, instance_buffer_;
+    std::vector<GLfloat> instance_data_;
+
+#ifdef _DEBUG
+    PlaybackClock::time_point last_second_;
+    PlaybackClock::duration max_render_time_, total_render_time_;
+    int frames_per_second_ = 0, renders_per_second_ = 0, texture_updates_per_second_ = 0, draws_per_second_ = 0;
+#endif
+};
+
+#endif // VIDEOFRAMEGRIDRENDERNODEOGL_H
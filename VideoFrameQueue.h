@@ -0,0 +1,66 @@
+#ifndef VIDEOFRAMEQUEUE_H
+#define VIDEOFRAMEQUEUE_H
+
+#include "VideoFrame.h"
+
+//Single producer (decoder thread), single consumer (render thread during sync) frame handoff
+//The receiver is woken with one queued update() when the queue goes from drained to non-empty, not once per frame
+class VideoFrameQueue
+{
+public:
+    static constexpr size_t kCapacity = 16;
+
+    enum PushResult
+    {
+        PushDropped, //Full, consumer is not draining
+        PushQueued,
+        PushQueuedAndNotified,
+    };
+
+    explicit VideoFrameQueue(QObject *receiver) :receiver_(receiver) {}
+
+    //Producer
+    PushResult Push(const QSharedPointer<VideoFrame> &frame)
+    {
+        size_t write_index = write_index_.load(std::memory_order_relaxed);
+        if (write_index - read_index_.load(std::memory_order_acquire) >= kCapacity)
+            return PushDropped;
+        frames_[write_index % kCapacity] = frame;
+        write_index_.store(write_index + 1, std::memory_order_release);
+
+        if (notify_pending_.exchange(true, std::memory_order_acq_rel))
+            return PushQueued;
+        QMutexLocker lock(&receiver_mutex_);
+        if (receiver_)
+            QMetaObject::invokeMethod(receiver_, "update", Qt::QueuedConnection);
+        return PushQueuedAndNotified;
+    }
+
+    //Consumer, takes every queued frame, frames pushed meanwhile notify again
+    void Drain(std::vector<QSharedPointer<VideoFrame>> &frames)
+    {
+        notify_pending_.store(false, std::memory_order_release);
+        size_t read_index = read_index_.load(std::memory_order_relaxed);
+        size_t write_index = write_index_.load(std::memory_order_acquire);
+        for (; read_index != write_index; ++read_index)
+            frames.push_back(std::move(frames_[read_index % kCapacity]));
+        read_index_.store(read_index, std::memory_order_release);
+    }
+
+    //Receiver thread, the producer stops notifying before the receiver goes away
+    void Close()
+    {
+        QMutexLocker lock(&receiver_mutex_);
+        receiver_ = nullptr;
+    }
+private:
+    QSharedPointer<VideoFrame> frames_[kCapacity];
+    std::atomic<size_t> write_index_{ 0 }, read_index_{ 0 };
+    std::atomic<bool> notify_pending_{ false };
+
+    QMutex receiver_mutex_;
+    QObject *receiver_ = nullptr;
+};
+Q_DECLARE_METATYPE(QSharedPointer<VideoFrameQueue>);
+
+#endif // VIDEOFRAMEQUEUE_H
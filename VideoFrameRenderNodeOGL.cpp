@@ -21,56 +21,6 @@ constexpr int DivideTwoRoundUp(int a)
     return (a + 1) / 2;
 }
 
-struct ColorMatrix
-{
-    constexpr ColorMatrix(const double (&eff)[5], const double (&range_eff)[3][2])
-        :color_matrix()
-    {
-        double matrix[4][4] = {
-            { 1, 0,                         eff[4],                    0 },
-            { 1, -eff[2] * eff[3] / eff[1], -eff[0] * eff[4] / eff[1], 0 },
-            { 1, eff[3],                    0,                         0 },
-            { 0, 0,                         0,                         1 },
-        };
-        for (int i = 0; i < 3; ++i)
-        {
-            matrix[i][3] = range_eff[0][1] * matrix[i][0] + range_eff[1][1] * matrix[i][1] + range_eff[2][1] * matrix[i][2];
-            matrix[i][0] *= range_eff[0][0];
-            matrix[i][1] *= range_eff[1][0];
-            matrix[i][2] *= range_eff[2][0];
-        }
-        for (int i = 0; i < 4; ++i)
-            for (int j = 0; j < 4; ++j)
-                color_matrix[i * 4 + j] = matrix[i][j];
-    }
-
-    float color_matrix[16];
-};
-
-static constexpr double kBT601Eff[5] = { 0.299, 0.587, 0.114, 1.772, 1.402 };
-static constexpr double kBT709Eff[5] = { 0.2126, 0.7152, 0.0722, 1.8556, 1.5748 };
-static constexpr double kBT2020Eff[5] = { 0.2627, 0.6780, 0.0593, 1.8814, 1.4747 };
-
-static constexpr double kMpegRangeEff[3][2] = { { 255.0 / 219.0, -16.0 / 219.0 }, { 255.0 / 224.0, -128.0 / 224.0 }, { 255.0 / 224.0, -128.0 / 224.0 } };
-static constexpr double kJpegRangeEff[3][2] = { { 1, 0 }, { 1, -128.0 / 255.0 }, { 1, -128.0 / 255.0 } };
-
-static constexpr ColorMatrix kColorMatrixBT601M(kBT601Eff, kMpegRangeEff);
-static constexpr ColorMatrix kColorMatrixBT601J(kBT601Eff, kJpegRangeEff);
-static constexpr ColorMatrix kColorMatrixBT709M(kBT709Eff, kMpegRangeEff);
-static constexpr ColorMatrix kColorMatrixBT709J(kBT709Eff, kJpegRangeEff);
-static constexpr ColorMatrix kColorMatrixBT2020M(kBT2020Eff, kMpegRangeEff);
-static constexpr ColorMatrix kColorMatrixBT2020J(kBT2020Eff, kJpegRangeEff);
-
-void InitSinglePixelUnpackBuffer(std::unique_ptr<QOpenGLBuffer> &buffer, int buffer_size)
-{
-    buffer = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::PixelUnpackBuffer);
-    buffer->setUsagePattern(QOpenGLBuffer::StreamDraw);
-    buffer->create();
-    buffer->bind();
-    buffer->allocate(buffer_size);
-    buffer->release();
-}
-
 void InitSingleTexture(std::unique_ptr<QOpenGLTexture> &texture, int width, int height, QOpenGLTexture::TextureFormat texture_format, QOpenGLTexture::PixelFormat pixel_format, QOpenGLTexture::PixelType pixel_type)
 {
     texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
@@ -82,56 +32,16 @@ void InitSingleTexture(std::unique_ptr<QOpenGLTexture> &texture, int width, int
     texture->setWrapMode(QOpenGLTexture::ClampToEdge);
 }
 
-void UpdateSinglePixelUnpackBuffer(QOpenGLBuffer *buffer, const void *data, int line_size, int texture_line_size, int height)
-{
-    buffer->bind();
-    if (line_size == texture_line_size)
-    {
-        void *buffer_mapped = buffer->map(QOpenGLBuffer::WriteOnly);
-        if (buffer_mapped)
-        {
-            memcpy(buffer_mapped, data, line_size * height);
-            buffer->unmap();
-        }
-    }
-    else
-    {
-        void *buffer_mapped = buffer->map(QOpenGLBuffer::WriteOnly);
-        if (buffer_mapped)
-        {
-            for (int i = 0; i < height; ++i)
-                memcpy(static_cast<char *>(buffer_mapped) + i * texture_line_size, static_cast<const char *>(data) + i * line_size, texture_line_size);
-            buffer->unmap();
-        }
-    }
-    buffer->release();
-}
-
-void UpdateSingleTexture(QOpenGLTexture *texture, QOpenGLTexture::PixelFormat pixel_format, QOpenGLTexture::PixelType pixel_type, QOpenGLBuffer *buffer)
+//Source is an offset into the bound pixel unpack buffer
+void UpdateSingleTexture(QOpenGLTexture *texture, QOpenGLTexture::PixelFormat pixel_format, QOpenGLTexture::PixelType pixel_type, const void *source)
 {
-    buffer->bind();
-    texture->setData(pixel_format, pixel_type, reinterpret_cast<const void *>(0));
-    buffer->release();
+    texture->setData(pixel_format, pixel_type, source);
 }
 
 }
 
-bool VideoFrameRenderNodeOGL::PixelUnpackBufferItem::IsCompatible(AVFrame *frame)
-{
-    if (frame_size != QSize(frame->width, frame->height))
-        return false;
-    if (pixel_format != frame->format)
-        return false;
-    if (color_range != frame->color_range)
-        return false;
-    if (colorspace != frame->colorspace)
-        return false;
-    return true;
-}
-
 VideoFrameRenderNodeOGL::VideoFrameRenderNodeOGL()
 {
-    texture_buffers_empty_.resize(kQueueSize);
 }
 
 VideoFrameRenderNodeOGL::~VideoFrameRenderNodeOGL()
@@ -149,10 +59,45 @@ void VideoFrameRenderNodeOGL::releaseResources()
     vertex_buffer_ = nullptr;
     for (int i = 0; i < kTextureItemCount; ++i)
         textures_[i] = nullptr;
-    texture_buffers_uploaded_.clear();
-    texture_buffers_empty_.clear();
-    texture_buffers_empty_.resize(kQueueSize);
-    texture_buffers_used_.clear();
+    ring_presentable_ = VideoFrameTextureRing::Presentable();
+    frame_queue_.ReleaseResources();
+}
+
+void VideoFrameRenderNodeOGL::UpdateFormat(AVPixelFormat pixel_format, const QSize &frame_size, AVColorRange color_range, AVColorSpace colorspace)
+{
+    //Ring textures are allocated by the upload worker
+    bool own_textures = !texture_ring_;
+    if (pixel_format != pixel_format_)
+    {
+        pixel_format_ = pixel_format;
+        frame_size_ = frame_size;
+        InitShader();
+        if (own_textures)
+            InitTexture();
+        vertex_buffer_need_update_ = true;
+        if (color_matrix_uniform_index_ != -1)
+        {
+            color_range_ = color_range;
+            colorspace_ = colorspace;
+            InitColorMatrix();
+        }
+    }
+    else
+    {
+        if (frame_size_ != frame_size)
+        {
+            frame_size_ = frame_size;
+            if (own_textures)
+                InitTexture();
+            vertex_buffer_need_update_ = true;
+        }
+        if (color_matrix_uniform_index_ != -1 && (color_range_ != color_range || colorspace_ != colorspace))
+        {
+            color_range_ = color_range;
+            colorspace_ = colorspace;
+            InitColorMatrix();
+        }
+    }
 }
 
 void VideoFrameRenderNodeOGL::InitShader()
@@ -229,120 +174,42 @@ void VideoFrameRenderNodeOGL::InitTexture()
 
 void VideoFrameRenderNodeOGL::UpdateTexture(PixelUnpackBufferItem &item)
 {
+    if (!item.buffer)
+        return;
+    frame_queue_.BeginTransfer();
+    item.buffer->bind();
     switch (pixel_format_)
     {
     case AV_PIX_FMT_RGB0:
-        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, item.buffers[0].get());
-        break;
-    case AV_PIX_FMT_NV12:
-    case AV_PIX_FMT_NV21:
-        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[0].get());
-        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::RG, QOpenGLTexture::UInt8, item.buffers[1].get());
-        break;
-    case AV_PIX_FMT_YUV420P:
-    case AV_PIX_FMT_YUVJ420P:
-        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[0].get());
-        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[1].get());
-        UpdateSingleTexture(textures_[2].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[2].get());
-        break;
-    case AV_PIX_FMT_YUV444P:
-    case AV_PIX_FMT_YUVJ444P:
-        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[0].get());
-        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[1].get());
-        UpdateSingleTexture(textures_[2].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.buffers[2].get());
-        break;
-    default:
-        qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
-    }
-}
-
-void VideoFrameRenderNodeOGL::InitPixelUnpackBuffer(PixelUnpackBufferItem &item)
-{
-    switch (item.pixel_format)
-    {
-    case AV_PIX_FMT_RGB0:
-        InitSinglePixelUnpackBuffer(item.buffers[0], item.frame_size.width() * item.frame_size.height() * 4 * sizeof(GLubyte));
-        break;
-    case AV_PIX_FMT_NV12:
-    case AV_PIX_FMT_NV21:
-        InitSinglePixelUnpackBuffer(item.buffers[0], item.frame_size.width() * item.frame_size.height() * 1 * sizeof(GLubyte));
-        InitSinglePixelUnpackBuffer(item.buffers[1], DivideTwoRoundUp(item.frame_size.width()) * DivideTwoRoundUp(item.frame_size.height()) * 2 * sizeof(GLubyte));
-        break;
-    case AV_PIX_FMT_YUV420P:
-    case AV_PIX_FMT_YUVJ420P:
-        InitSinglePixelUnpackBuffer(item.buffers[0], item.frame_size.width() * item.frame_size.height() * 1 * sizeof(GLubyte));
-        InitSinglePixelUnpackBuffer(item.buffers[1], DivideTwoRoundUp(item.frame_size.width()) * DivideTwoRoundUp(item.frame_size.height()) * 1 * sizeof(GLubyte));
-        InitSinglePixelUnpackBuffer(item.buffers[2], DivideTwoRoundUp(item.frame_size.width()) * DivideTwoRoundUp(item.frame_size.height()) * 1 * sizeof(GLubyte));
-        break;
-    case AV_PIX_FMT_YUV444P:
-    case AV_PIX_FMT_YUVJ444P:
-        InitSinglePixelUnpackBuffer(item.buffers[0], item.frame_size.width() * item.frame_size.height() * 1 * sizeof(GLubyte));
-        InitSinglePixelUnpackBuffer(item.buffers[1], item.frame_size.width() * item.frame_size.height() * 1 * sizeof(GLubyte));
-        InitSinglePixelUnpackBuffer(item.buffers[2], item.frame_size.width() * item.frame_size.height() * 1 * sizeof(GLubyte));
-        break;
-    default:
-        qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
-    }
-}
-
-void VideoFrameRenderNodeOGL::UpdatePixelUnpackBuffer(PixelUnpackBufferItem &item, AVFrame *frame)
-{
-    switch (item.pixel_format)
-    {
-    case AV_PIX_FMT_RGB0:
-        UpdateSinglePixelUnpackBuffer(item.buffers[0].get(), frame->data[0], frame->linesize[0], item.frame_size.width() * 4 * sizeof(GLubyte), item.frame_size.height());
+        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::RGBA, QOpenGLTexture::UInt8, item.PlaneData(0));
         break;
     case AV_PIX_FMT_NV12:
     case AV_PIX_FMT_NV21:
-        UpdateSinglePixelUnpackBuffer(item.buffers[0].get(), frame->data[0], frame->linesize[0], item.frame_size.width() * 1 * sizeof(GLubyte), item.frame_size.height());
-        UpdateSinglePixelUnpackBuffer(item.buffers[1].get(), frame->data[1], frame->linesize[1], DivideTwoRoundUp(item.frame_size.width()) * 2 * sizeof(GLubyte), DivideTwoRoundUp(item.frame_size.height()));
+        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(0));
+        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::RG, QOpenGLTexture::UInt8, item.PlaneData(1));
         break;
     case AV_PIX_FMT_YUV420P:
     case AV_PIX_FMT_YUVJ420P:
-        UpdateSinglePixelUnpackBuffer(item.buffers[0].get(), frame->data[0], frame->linesize[0], item.frame_size.width() * 1 * sizeof(GLubyte), item.frame_size.height());
-        UpdateSinglePixelUnpackBuffer(item.buffers[1].get(), frame->data[1], frame->linesize[1], DivideTwoRoundUp(item.frame_size.width()) * 1 * sizeof(GLubyte), DivideTwoRoundUp(item.frame_size.height()));
-        UpdateSinglePixelUnpackBuffer(item.buffers[2].get(), frame->data[2], frame->linesize[2], DivideTwoRoundUp(item.frame_size.width()) * 1 * sizeof(GLubyte), DivideTwoRoundUp(item.frame_size.height()));
+        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(0));
+        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(1));
+        UpdateSingleTexture(textures_[2].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(2));
         break;
     case AV_PIX_FMT_YUV444P:
     case AV_PIX_FMT_YUVJ444P:
-        UpdateSinglePixelUnpackBuffer(item.buffers[0].get(), frame->data[0], frame->linesize[0], item.frame_size.width() * 1 * sizeof(GLubyte), item.frame_size.height());
-        UpdateSinglePixelUnpackBuffer(item.buffers[1].get(), frame->data[1], frame->linesize[1], item.frame_size.width() * 1 * sizeof(GLubyte), item.frame_size.height());
-        UpdateSinglePixelUnpackBuffer(item.buffers[2].get(), frame->data[2], frame->linesize[2], item.frame_size.width() * 1 * sizeof(GLubyte), item.frame_size.height());
+        UpdateSingleTexture(textures_[0].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(0));
+        UpdateSingleTexture(textures_[1].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(1));
+        UpdateSingleTexture(textures_[2].get(), QOpenGLTexture::Red, QOpenGLTexture::UInt8, item.PlaneData(2));
         break;
     default:
         qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
     }
+    item.buffer->release();
+    frame_queue_.EndTransfer(item);
 }
 
 void VideoFrameRenderNodeOGL::InitColorMatrix()
 {
-    switch (colorspace_)
-    {
-    case AVCOL_SPC_RGB:
-        color_matrix_.setToIdentity();
-        break;
-    case AVCOL_SPC_BT2020_CL:
-    case AVCOL_SPC_BT2020_NCL:
-        color_matrix_ = QMatrix4x4(color_range_ == AVCOL_RANGE_JPEG ? kColorMatrixBT2020J.color_matrix : kColorMatrixBT2020M.color_matrix);
-        break;
-    case AVCOL_SPC_BT470BG:
-    case AVCOL_SPC_SMPTE170M:
-    case AVCOL_SPC_SMPTE240M:
-        color_matrix_ = QMatrix4x4(color_range_ == AVCOL_RANGE_JPEG ? kColorMatrixBT601J.color_matrix : kColorMatrixBT601M.color_matrix);
-        break;
-    case AVCOL_SPC_BT709:
-    default:
-        color_matrix_ = QMatrix4x4(color_range_ == AVCOL_RANGE_JPEG ? kColorMatrixBT709J.color_matrix : kColorMatrixBT709M.color_matrix);
-        break;
-    }
-    if (pixel_format_ == AV_PIX_FMT_NV21)
-    {
-        color_matrix_ = color_matrix_ * QMatrix4x4(
-                    1, 0, 0, 0,
-                    0, 0, 1, 0,
-                    0, 1, 0, 0,
-                    0, 0, 0, 1);
-    }
+    color_matrix_ = VideoFrameUploadQueue::ColorMatrix(pixel_format_, colorspace_, color_range_);
 }
 
 void VideoFrameRenderNodeOGL::InitVertexBuffer()
@@ -362,40 +229,6 @@ void VideoFrameRenderNodeOGL::InitVertexBuffer()
     vertex_buffer_->release();
 }
 
-void VideoFrameRenderNodeOGL::Upload(PlaybackClock::time_point current_time)
-{
-    if (texture_buffers_used_.size() > kUsedQueueSize)
-    {
-        auto itr = texture_buffers_used_.begin(), itr_end = itr + texture_buffers_used_.size() - kUsedQueueSize;
-        texture_buffers_empty_.insert(texture_buffers_empty_.end(), std::make_move_iterator(itr), std::make_move_iterator(itr_end));
-        texture_buffers_used_.erase(itr, itr_end);
-    }
-
-    RemoveImpossibleFrame(current_time);
-    while (!video_frames_.empty() && !texture_buffers_empty_.empty())
-    {
-        auto &frame = video_frames_.front();
-        auto &buffer = texture_buffers_empty_.front();
-        Q_ASSERT(frame->present_time > current_time);
-        if (!buffer.IsCompatible(frame->frame.Get()))
-        {
-            for (int i = 0; i < kTextureItemCount; ++i)
-                buffer.buffers[i].reset();
-            buffer.frame_size = QSize(frame->frame->width, frame->frame->height);
-            buffer.pixel_format = static_cast<AVPixelFormat>(frame->frame->format);
-            buffer.color_range = frame->frame->color_range;
-            buffer.colorspace = frame->frame->colorspace;
-            InitPixelUnpackBuffer(buffer);
-        }
-        buffer.present_time = frame->present_time;
-        UpdatePixelUnpackBuffer(buffer, frame->frame.Get());
-
-        texture_buffers_uploaded_.push_back(std::move(buffer));
-        texture_buffers_empty_.erase(texture_buffers_empty_.begin());
-        video_frames_.erase(video_frames_.begin());
-    }
-}
-
 void VideoFrameRenderNodeOGL::render(const RenderState *state)
 {
     auto playback_time = playback_time_base_ + playback_time_interval_ * playback_time_tick_;
@@ -416,63 +249,30 @@ void VideoFrameRenderNodeOGL::render(const RenderState *state)
 #endif
 
     auto present_time_limit = playback_time;
-    if (!texture_buffers_uploaded_.empty() && texture_buffers_uploaded_.front().present_time <= present_time_limit)
+    if (texture_ring_)
     {
-        decltype(texture_buffers_uploaded_)::iterator texture_buffer_itr = texture_buffers_uploaded_.begin(), texture_buffer_itr_end = texture_buffers_uploaded_.end(), selected_texture_buffer_itr;
-        for (; texture_buffer_itr != texture_buffer_itr_end && texture_buffer_itr->present_time <= present_time_limit; ++texture_buffer_itr)
-            selected_texture_buffer_itr = texture_buffer_itr;
-
-        if (selected_texture_buffer_itr->pixel_format != pixel_format_)
+        if (texture_ring_->SelectPresentable(present_time_limit, playback_time_interval_, ring_presentable_))
         {
-            pixel_format_ = static_cast<AVPixelFormat>(selected_texture_buffer_itr->pixel_format);
-            frame_size_ = selected_texture_buffer_itr->frame_size;
-            InitShader();
-            InitTexture();
-            vertex_buffer_need_update_ = true;
-            if (color_matrix_uniform_index_ != -1)
-            {
-                color_range_ = selected_texture_buffer_itr->color_range;
-                colorspace_ = selected_texture_buffer_itr->colorspace;
-                InitColorMatrix();
-            }
+            UpdateFormat(ring_presentable_.pixel_format, ring_presentable_.frame_size, ring_presentable_.color_range, ring_presentable_.colorspace);
+#ifdef _DEBUG
+            CountTextureChange(current_time, ring_presentable_.present_time);
+#endif
         }
-        else
+    }
+    else
+    {
+        if (PixelUnpackBufferItem *selected_texture_buffer = frame_queue_.SelectPresentable(present_time_limit))
         {
-            if (frame_size_ != selected_texture_buffer_itr->frame_size)
-            {
-                frame_size_ = selected_texture_buffer_itr->frame_size;
-                InitTexture();
-                vertex_buffer_need_update_ = true;
-            }
-            if (color_matrix_uniform_index_ != -1 && (color_range_ != selected_texture_buffer_itr->color_range || colorspace_ != selected_texture_buffer_itr->colorspace))
-            {
-                color_range_ = selected_texture_buffer_itr->color_range;
-                colorspace_ = selected_texture_buffer_itr->colorspace;
-                InitColorMatrix();
-            }
-        }
-
-        UpdateTexture(*selected_texture_buffer_itr);
-
+            UpdateFormat(selected_texture_buffer->pixel_format, selected_texture_buffer->frame_size, selected_texture_buffer->color_range, selected_texture_buffer->colorspace);
+            UpdateTexture(*selected_texture_buffer);
 #ifdef _DEBUG
-        texture_updates_per_second_ += 1;
-        if (current_time - last_texture_change_time_ > max_texture_diff_time_)
-            max_texture_diff_time_ = current_time - last_texture_change_time_;
-        if (current_time - last_texture_change_time_ < min_texture_diff_time_)
-            min_texture_diff_time_ = current_time - last_texture_change_time_;
-        if (current_time - selected_texture_buffer_itr->present_time > max_latency_)
-            max_latency_ = current_time - selected_texture_buffer_itr->present_time;
-        if (current_time - selected_texture_buffer_itr->present_time < min_latency_)
-            min_latency_ = current_time - selected_texture_buffer_itr->present_time;
-        last_texture_change_time_ = current_time;
+            CountTextureChange(current_time, selected_texture_buffer->present_time);
 #endif
+        }
 
-        texture_buffers_used_.insert(texture_buffers_used_.end(), std::make_move_iterator(texture_buffers_uploaded_.begin()), std::make_move_iterator(texture_buffer_itr));
-        texture_buffers_uploaded_.erase(texture_buffers_uploaded_.begin(), texture_buffer_itr);
+        frame_queue_.Upload(playback_time, playback_time_interval_);
     }
 
-    Upload(playback_time);
-
     QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
 
     if (shader_)
@@ -489,23 +289,15 @@ void VideoFrameRenderNodeOGL::render(const RenderState *state)
         if (color_matrix_uniform_index_ != -1)
             shader_->setUniformValue(color_matrix_uniform_index_, color_matrix_);
 
-        if (textures_[0])
+        GLuint texture_ids[kTextureItemCount] = {};
+        for (int i = 0; i < kTextureItemCount; ++i)
+            texture_ids[i] = texture_ring_ ? ring_presentable_.textures[i] : (textures_[i] ? textures_[i]->textureId() : 0);
+        const int texture_uniform_indices[kTextureItemCount] = { texture_0_uniform_index_, texture_1_uniform_index_, texture_2_uniform_index_ };
+        for (int i = 0; i < kTextureItemCount && texture_ids[i]; ++i)
         {
-            f->glActiveTexture(GL_TEXTURE0);
-            textures_[0]->bind();
-            shader_->setUniformValue(texture_0_uniform_index_, 0);
-            if (textures_[1])
-            {
-                f->glActiveTexture(GL_TEXTURE1);
-                textures_[1]->bind();
-                shader_->setUniformValue(texture_1_uniform_index_, 1);
-                if (textures_[2])
-                {
-                    f->glActiveTexture(GL_TEXTURE2);
-                    textures_[2]->bind();
-                    shader_->setUniformValue(texture_2_uniform_index_, 2);
-                }
-            }
+            f->glActiveTexture(GL_TEXTURE0 + i);
+            f->glBindTexture(GL_TEXTURE_2D, texture_ids[i]);
+            shader_->setUniformValue(texture_uniform_indices[i], i);
         }
 
         vertex_buffer_->bind();
@@ -587,6 +379,8 @@ void VideoFrameRenderNodeOGL::render(const RenderState *state)
 
 #ifdef _DEBUG
     renders_per_second_ += 1;
+    if (current_time - last_frame_time_ > playback_time_interval_ * 3 / 2)
+        missed_vsyncs_per_second_ += 1;
     if (current_time - last_frame_time_ > max_diff_time_)
         max_diff_time_ = current_time - last_frame_time_;
     if (current_time - last_frame_time_ < min_diff_time_)
@@ -598,13 +392,18 @@ void VideoFrameRenderNodeOGL::render(const RenderState *state)
             last_second_ = current_time;
         else
             last_second_ += std::chrono::seconds(1);
-        qCDebug(CategoryVideoPlayback) << texture_buffers_uploaded_.size() << " textures uploaded";
-        qCDebug(CategoryVideoPlayback) << texture_buffers_used_.size() << " textures used";
-        qCDebug(CategoryVideoPlayback) << texture_buffers_empty_.size() << " textures empty";
-        qCDebug(CategoryVideoPlayback) << video_frames_.size() << " frames in pending queue";
+        if (!texture_ring_)
+        {
+            qCDebug(CategoryVideoPlayback) << frame_queue_.UploadedCount() << " textures uploaded";
+            qCDebug(CategoryVideoPlayback) << frame_queue_.UsedCount() << " textures used";
+            qCDebug(CategoryVideoPlayback) << frame_queue_.EmptyCount() << " textures empty";
+            qCDebug(CategoryVideoPlayback) << frame_queue_.PendingCount() << " frames in pending queue";
+        }
         qCDebug(CategoryVideoPlayback) << frames_per_second_ << " fps from source";
         qCDebug(CategoryVideoPlayback) << renders_per_second_ << " fps render";
         qCDebug(CategoryVideoPlayback) << texture_updates_per_second_ << " texture updates";
+        qCDebug(CategoryVideoPlayback) << missed_vsyncs_per_second_ << " missed vsyncs";
+        qCDebug(CategoryVideoPlayback) << frame_size_ << " texture size," << VideoFrameUploadQueue::TextureBytes(pixel_format_, frame_size_) * (texture_ring_ ? VideoFrameTextureRing::kRingSize : 1) / 1024 << "KiB texture memory";
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_diff_time_).count() << "us max diff (frame to frame)";
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_diff_time_).count() << "us min diff (frame to frame)";
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_texture_diff_time_).count() << "us max diff (texture to texture)";
@@ -613,9 +412,16 @@ void VideoFrameRenderNodeOGL::render(const RenderState *state)
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_latency_).count() << "us min latency";
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_timing_diff_).count() << "us max render time";
         qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(playback_time_interval_).count() << "us time unit";
+        VideoFrameUploadQueue::UploadStatistics upload_statistics = frame_queue_.TakeStatistics();
+        if (upload_statistics.copies > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(upload_statistics.copy_time).count() / upload_statistics.copies << "us average copy time" << (frame_queue_.PersistentMapping() ? "(persistent)" : "(orphaned)");
+        if (upload_statistics.transfers_timed > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(upload_statistics.transfer_gpu_time).count() / upload_statistics.transfers_timed << "us average GPU transfer time";
+        qCDebug(CategoryVideoPlayback) << upload_statistics.fence_stalls << " uploads deferred by busy buffers";
+        qCDebug(CategoryVideoPlayback) << upload_statistics.skipped_frames << " frames skipped before upload";
         max_diff_time_ = max_texture_diff_time_ = max_latency_ = min_timing_diff_ = std::chrono::seconds(-10);
         min_diff_time_ = min_texture_diff_time_ = min_latency_ = std::chrono::seconds(10);
-        frames_per_second_ = renders_per_second_ = texture_updates_per_second_ = 0;
+        frames_per_second_ = renders_per_second_ = texture_updates_per_second_ = missed_vsyncs_per_second_ = 0;
     }
 #endif
 }
@@ -640,12 +446,8 @@ void VideoFrameRenderNodeOGL::AddVideoFrame(const QSharedPointer<VideoFrame> &fr
 #ifdef _DEBUG
     frames_per_second_ += 1;
 #endif
-    auto ritr = video_frames_.rbegin(), ritr_end = video_frames_.rend();
-    for (; ritr != ritr_end; ++ritr)
-        if ((*ritr)->present_time < frame->present_time)
-            break;
-    video_frames_.insert(ritr.base(), frame);
-    RemoveImpossibleFrame(PlaybackClock::now());
+    frame_queue_.AddVideoFrame(frame);
+    this->markDirty(DirtyMaterial);
 }
 
 void VideoFrameRenderNodeOGL::AddVideoFrames(std::vector<QSharedPointer<VideoFrame>> &&frames)
@@ -653,15 +455,21 @@ void VideoFrameRenderNodeOGL::AddVideoFrames(std::vector<QSharedPointer<VideoFra
 #ifdef _DEBUG
     frames_per_second_ += frames.size();
 #endif
-    for (auto &frame : frames)
-    {
-        auto ritr = video_frames_.rbegin(), ritr_end = video_frames_.rend();
-        for (; ritr != ritr_end; ++ritr)
-            if ((*ritr)->present_time < frame->present_time)
-                break;
-        video_frames_.insert(ritr.base(), std::move(frame));
-    }
-    RemoveImpossibleFrame(PlaybackClock::now());
+    frame_queue_.AddVideoFrames(std::move(frames));
+    this->markDirty(DirtyMaterial);
+}
+
+void VideoFrameRenderNodeOGL::SetTextureRing(const QSharedPointer<VideoFrameTextureRing> &ring)
+{
+    if (texture_ring_ == ring)
+        return;
+    texture_ring_ = ring;
+    //Force the format to be picked up again from the first ring frame
+    pixel_format_ = AV_PIX_FMT_NONE;
+    ring_presentable_ = VideoFrameTextureRing::Presentable();
+    for (int i = 0; i < kTextureItemCount; ++i)
+        textures_[i] = nullptr;
+    frame_queue_.ReleaseResources();
 }
 
 void VideoFrameRenderNodeOGL::Synchronize(QQuickItem *item)
@@ -682,11 +490,16 @@ void VideoFrameRenderNodeOGL::Synchronize(QQuickItem *item)
         this->markDirty(DirtyGeometry);
         vertex_buffer_need_update_ = true;
     }
-    this->markDirty(DirtyMaterial);
 
     QQuickWindow *window = item->window();
     if (window)
     {
+        qreal device_pixel_ratio = window->effectiveDevicePixelRatio();
+        QSize target_size = (QSizeF(width_, height_) * device_pixel_ratio).toSize();
+        frame_queue_.SetTargetSize(target_size);
+        if (texture_ring_)
+            texture_ring_->SetTargetSize(target_size);
+
         QScreen *screen = window->screen();
         if (screen_ != screen)
         {
@@ -701,23 +514,25 @@ void VideoFrameRenderNodeOGL::Synchronize(QQuickItem *item)
     }
 }
 
+#ifdef _DEBUG
+void VideoFrameRenderNodeOGL::CountTextureChange(PlaybackClock::time_point current_time, PlaybackClock::time_point present_time)
+{
+    texture_updates_per_second_ += 1;
+    if (current_time - last_texture_change_time_ > max_texture_diff_time_)
+        max_texture_diff_time_ = current_time - last_texture_change_time_;
+    if (current_time - last_texture_change_time_ < min_texture_diff_time_)
+        min_texture_diff_time_ = current_time - last_texture_change_time_;
+    if (current_time - present_time > max_latency_)
+        max_latency_ = current_time - present_time;
+    if (current_time - present_time < min_latency_)
+        min_latency_ = current_time - present_time;
+    last_texture_change_time_ = current_time;
+}
+#endif
+
 void VideoFrameRenderNodeOGL::ResynchronizeTimer(PlaybackClock::time_point current_time)
 {
     qCDebug(CategoryVideoPlayback) << "Resynchronizing clock, Error: " << std::chrono::duration_cast<std::chrono::microseconds>(current_time - playback_time_base_).count() << "us";
     playback_time_base_ = current_time;
     playback_time_tick_ = 0;
 }
-
-void VideoFrameRenderNodeOGL::RemoveImpossibleFrame(PlaybackClock::time_point current_time)
-{
-    auto itr_begin = video_frames_.begin(), itr_end = video_frames_.end();
-    auto itr = itr_begin;
-    for (; itr != itr_end; ++itr)
-        if ((*itr)->present_time > current_time)
-            break;
-#ifdef _DEBUG
-    if (itr != itr_begin)
-        qCDebug(CategoryVideoPlayback) << "Skipping " << itr - itr_begin << "impossible frame";
-#endif
-    video_frames_.erase(itr_begin, itr);
-}
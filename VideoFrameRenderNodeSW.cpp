@@ -0,0 +1,201 @@
+#include "pch.h"
+#include "VideoFrameRenderNodeSW.h"
+
+namespace
+{
+
+constexpr inline qreal ScreenRefreshRate(qreal refresh_rate)
+{
+    if (refresh_rate >= 59 && refresh_rate <= 60)
+        refresh_rate = 60; //Manual patch
+    return refresh_rate;
+}
+
+//Largest rect with the aspect ratio of frame_size centered in bounds
+QRectF FitRect(const QSize &frame_size, const QSizeF &bounds)
+{
+    if (frame_size.isEmpty() || bounds.isEmpty())
+        return QRectF();
+    QSizeF size = QSizeF(frame_size).scaled(bounds, Qt::KeepAspectRatio);
+    return QRectF(QPointF((bounds.width() - size.width()) / 2, (bounds.height() - size.height()) / 2), size);
+}
+
+}
+
+bool VideoFrameRenderNodeSW::Forced()
+{
+    static const bool forced = qEnvironmentVariableIntValue("QDDM_SOFTWARE_VIDEO") != 0;
+    return forced;
+}
+
+bool VideoFrameRenderNodeSW::Enabled(QQuickWindow *window)
+{
+    if (Forced())
+        return true;
+    return window && window->rendererInterface() && window->rendererInterface()->graphicsApi() != QSGRendererInterface::OpenGL;
+}
+
+VideoFrameRenderNodeSW::VideoFrameRenderNodeSW(QQuickWindow *window)
+    :window_(window)
+{
+    image_node_ = window_->createImageNode();
+    image_node_->setFiltering(QSGTexture::Linear);
+    image_node_->setOwnsTexture(true);
+    appendChildNode(image_node_);
+}
+
+void VideoFrameRenderNodeSW::AddVideoFrames(std::vector<QSharedPointer<VideoFrame>> &&frames)
+{
+#ifdef _DEBUG
+    frames_per_second_ += frames.size();
+#endif
+    for (auto &frame : frames)
+        pending_frames_.push_back(std::move(frame));
+    if (pending_frames_.size() > kPendingFrameLimit)
+        pending_frames_.erase(pending_frames_.begin(), pending_frames_.end() - kPendingFrameLimit);
+}
+
+void VideoFrameRenderNodeSW::Synchronize(QQuickItem *item)
+{
+    PlaybackClock::time_point current_time = PlaybackClock::now();
+
+    QScreen *screen = window_->screen();
+    if (screen_ != screen)
+    {
+        screen_ = screen;
+        if (screen)
+        {
+            static constexpr auto kTickPerSecond = std::chrono::duration_cast<PlaybackClock::duration>(std::chrono::seconds(1)).count();
+            playback_time_interval_ = PlaybackClock::duration(static_cast<PlaybackClock::duration::rep>(round(kTickPerSecond / ScreenRefreshRate(screen->refreshRate()))));
+        }
+    }
+
+    QSizeF item_size(item->width(), item->height());
+    qreal device_pixel_ratio = window_->effectiveDevicePixelRatio();
+    bool size_changed = item_size_ != item_size || device_pixel_ratio_ != device_pixel_ratio;
+    item_size_ = item_size;
+    device_pixel_ratio_ = device_pixel_ratio;
+
+    //Frames arrive in present order, everything before the latest due one is skipped
+    auto due_end = std::upper_bound(pending_frames_.begin(), pending_frames_.end(), current_time + playback_time_interval_,
+                                    [](PlaybackClock::time_point time, const QSharedPointer<VideoFrame> &frame) { return time < frame->present_time; });
+    if (due_end != pending_frames_.begin())
+    {
+        const QSharedPointer<VideoFrame> &frame = *(due_end - 1);
+        frame_size_ = QSize(frame->frame->width, frame->frame->height);
+        //Converted at the size it's shown but never enlarged, the node scales up
+        QSize image_size = (FitRect(frame_size_, item_size_).size() * device_pixel_ratio_).toSize().boundedTo(frame_size_);
+#ifdef _DEBUG
+        PlaybackClock::time_point convert_begin = PlaybackClock::now();
+#endif
+        if (!image_size.isEmpty() && ConvertFrame(frame->frame.Get(), image_size))
+        {
+            image_node_->setTexture(window_->createTextureFromImage(image_));
+            image_node_->setSourceRect(QRectF(QPointF(0, 0), image_.size()));
+            size_changed = true;
+#ifdef _DEBUG
+            PlaybackClock::duration convert_time = PlaybackClock::now() - convert_begin;
+            if (convert_time > max_convert_time_)
+                max_convert_time_ = convert_time;
+            CountTextureChange(current_time, frame->present_time);
+#endif
+        }
+        pending_frames_.erase(pending_frames_.begin(), due_end);
+    }
+    if (size_changed)
+        UpdateRect();
+
+#ifdef _DEBUG
+    ReportStatistics(current_time);
+#endif
+}
+
+bool VideoFrameRenderNodeSW::ConvertFrame(const AVFrame *frame, const QSize &image_size)
+{
+    AVPixelFormat pixel_format = static_cast<AVPixelFormat>(frame->format);
+    sws_context_ = sws_getCachedContext(sws_context_.DetachObject(),
+                                        frame->width, frame->height, pixel_format,
+                                        image_size.width(), image_size.height(), AV_PIX_FMT_RGB32,
+                                        SWS_BILINEAR, nullptr, nullptr, nullptr);
+    if (!sws_context_)
+    {
+        qCWarning(CategoryVideoPlayback) << "Can't convert pixel format " << av_get_pix_fmt_name(pixel_format);
+        return false;
+    }
+    const AVPixFmtDescriptor *descriptor = av_pix_fmt_desc_get(pixel_format);
+    if (descriptor && !(descriptor->flags & AV_PIX_FMT_FLAG_RGB))
+    {
+        int src_range = frame->color_range == AVCOL_RANGE_JPEG || pixel_format == AV_PIX_FMT_YUVJ420P || pixel_format == AV_PIX_FMT_YUVJ444P;
+        const int *coefficients = sws_getCoefficients(frame->colorspace == AVCOL_SPC_UNSPECIFIED ? SWS_CS_DEFAULT : frame->colorspace);
+        sws_setColorspaceDetails(sws_context_.Get(), coefficients, src_range, sws_getCoefficients(SWS_CS_DEFAULT), 1, 0, 1 << 16, 1 << 16);
+    }
+
+    //The previous image may still be held by its texture, bits() detaches from it then
+    if (image_.size() != image_size)
+        image_ = QImage(image_size, QImage::Format_RGB32);
+    uint8_t *data[4] = { image_.bits() };
+    int linesize[4] = { static_cast<int>(image_.bytesPerLine()) };
+    if (sws_scale(sws_context_.Get(), frame->data, frame->linesize, 0, frame->height, data, linesize) < 0)
+    {
+        qCWarning(CategoryVideoPlayback) << "Error while color format converting";
+        return false;
+    }
+    return true;
+}
+
+void VideoFrameRenderNodeSW::UpdateRect()
+{
+    image_node_->setRect(FitRect(frame_size_, item_size_));
+}
+
+#ifdef _DEBUG
+void VideoFrameRenderNodeSW::CountTextureChange(PlaybackClock::time_point current_time, PlaybackClock::time_point present_time)
+{
+    texture_updates_per_second_ += 1;
+    if (current_time - last_texture_change_time_ > max_texture_diff_time_)
+        max_texture_diff_time_ = current_time - last_texture_change_time_;
+    if (current_time - last_texture_change_time_ < min_texture_diff_time_)
+        min_texture_diff_time_ = current_time - last_texture_change_time_;
+    if (current_time - present_time > max_latency_)
+        max_latency_ = current_time - present_time;
+    if (current_time - present_time < min_latency_)
+        min_latency_ = current_time - present_time;
+    last_texture_change_time_ = current_time;
+}
+
+void VideoFrameRenderNodeSW::ReportStatistics(PlaybackClock::time_point current_time)
+{
+    //Same counters as VideoFrameRenderNodeOGL, render time is the conversion of a frame
+    renders_per_second_ += 1;
+    if (current_time - last_frame_time_ > playback_time_interval_ * 3 / 2)
+        missed_vsyncs_per_second_ += 1;
+    if (current_time - last_frame_time_ > max_diff_time_)
+        max_diff_time_ = current_time - last_frame_time_;
+    if (current_time - last_frame_time_ < min_diff_time_)
+        min_diff_time_ = current_time - last_frame_time_;
+    last_frame_time_ = current_time;
+    if (current_time - last_second_ <= std::chrono::seconds(1))
+        return;
+    if (current_time - last_second_ > std::chrono::seconds(3))
+        last_second_ = current_time;
+    else
+        last_second_ += std::chrono::seconds(1);
+    qCDebug(CategoryVideoPlayback) << pending_frames_.size() << " frames in pending queue";
+    qCDebug(CategoryVideoPlayback) << frames_per_second_ << " fps from source";
+    qCDebug(CategoryVideoPlayback) << renders_per_second_ << " fps render";
+    qCDebug(CategoryVideoPlayback) << texture_updates_per_second_ << " texture updates";
+    qCDebug(CategoryVideoPlayback) << missed_vsyncs_per_second_ << " missed vsyncs";
+    qCDebug(CategoryVideoPlayback) << image_.size() << " texture size," << image_.sizeInBytes() / 1024 << "KiB texture memory";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_diff_time_).count() << "us max diff (frame to frame)";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_diff_time_).count() << "us min diff (frame to frame)";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_texture_diff_time_).count() << "us max diff (texture to texture)";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_texture_diff_time_).count() << "us min diff (texture to texture)";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_latency_).count() << "us max latency";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(min_latency_).count() << "us min latency";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(max_convert_time_).count() << "us max convert time";
+    qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(playback_time_interval_).count() << "us time unit";
+    max_diff_time_ = max_texture_diff_time_ = max_latency_ = max_convert_time_ = std::chrono::seconds(-10);
+    min_diff_time_ = min_texture_diff_time_ = min_latency_ = std::chrono::seconds(10);
+    frames_per_second_ = renders_per_second_ = texture_updates_per_second_ = missed_vsyncs_per_second_ = 0;
+}
+#endif
@@ -0,0 +1,56 @@
+#ifndef VIDEOFRAMERENDERNODESW_H
+#define VIDEOFRAMERENDERNODESW_H
+
+#include "VideoFrame.h"
+
+Q_DECLARE_LOGGING_CATEGORY(CategoryVideoPlayback)
+
+//Converts frames to RGB on the CPU and draws them with a QSGImageNode, works with any scene graph backend including software and offscreen ones
+//Taken when the window doesn't render with OpenGL, QDDM_SOFTWARE_VIDEO=1 forces it for profiling without the GPU path
+class VideoFrameRenderNodeSW : public QSGNode
+{
+    struct SwsContextReleaseFunctor
+    {
+        void operator()(SwsContext **object) const { SwsContext *p = *object; *object = nullptr; sws_freeContext(p); }
+    };
+    using SwsContextObject = AVObjectBase<SwsContext, SwsContextReleaseFunctor>;
+public:
+    static bool Forced();
+    static bool Enabled(QQuickWindow *window);
+
+    explicit VideoFrameRenderNodeSW(QQuickWindow *window);
+
+    void AddVideoFrames(std::vector<QSharedPointer<VideoFrame>> &&frames);
+
+    //Converts the latest frame due by the next vsync at the size it's shown and fits it in the item
+    void Synchronize(QQuickItem *item);
+private:
+    static constexpr size_t kPendingFrameLimit = 8;
+
+    bool ConvertFrame(const AVFrame *frame, const QSize &image_size);
+    void UpdateRect();
+#ifdef _DEBUG
+    void CountTextureChange(PlaybackClock::time_point current_time, PlaybackClock::time_point present_time);
+    void ReportStatistics(PlaybackClock::time_point current_time);
+#endif
+
+    QQuickWindow *window_;
+    QSGImageNode *image_node_; //Child owned by this node
+    std::vector<QSharedPointer<VideoFrame>> pending_frames_;
+    QScreen *screen_ = nullptr;
+    PlaybackClock::duration playback_time_interval_ = 1s;
+
+    SwsContextObject sws_context_;
+    QImage image_;
+    QSize frame_size_;
+    QSizeF item_size_;
+    qreal device_pixel_ratio_ = 1;
+
+#ifdef _DEBUG
+    PlaybackClock::time_point last_frame_time_, last_texture_change_time_, last_second_;
+    PlaybackClock::duration max_diff_time_, min_diff_time_, max_texture_diff_time_, min_texture_diff_time_, max_latency_, min_latency_, max_convert_time_;
+    int frames_per_second_ = 0, renders_per_second_ = 0, texture_updates_per_second_ = 0, missed_vsyncs_per_second_ = 0;
+#endif
+};
+
+#endif // VIDEOFRAMERENDERNODESW_H
@@ -0,0 +1,656 @@
+#include "pch.h"
+#include "VideoFrameUploadQueue.h"
+
+namespace
+{
+
+constexpr int DivideTwoRoundUp(int a)
+{
+    return (a + 1) / 2;
+}
+
+struct ColorMatrixTable
+{
+    constexpr ColorMatrixTable(const double (&eff)[5], const double (&range_eff)[3][2])
+        :color_matrix()
+    {
+        double matrix[4][4] = {
+            { 1, 0,                         eff[4],                    0 },
+            { 1, -eff[2] * eff[3] / eff[1], -eff[0] * eff[4] / eff[1], 0 },
+            { 1, eff[3],                    0,                         0 },
+            { 0, 0,                         0,                         1 },
+        };
+        for (int i = 0; i < 3; ++i)
+        {
+            matrix[i][3] = range_eff[0][1] * matrix[i][0] + range_eff[1][1] * matrix[i][1] + range_eff[2][1] * matrix[i][2];
+            matrix[i][0] *= range_eff[0][0];
+            matrix[i][1] *= range_eff[1][0];
+            matrix[i][2] *= range_eff[2][0];
+        }
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                color_matrix[i * 4 + j] = matrix[i][j];
+    }
+
+    float color_matrix[16];
+};
+
+static constexpr double kBT601Eff[5] = { 0.299, 0.587, 0.114, 1.772, 1.402 };
+static constexpr double kBT709Eff[5] = { 0.2126, 0.7152, 0.0722, 1.8556, 1.5748 };
+static constexpr double kBT2020Eff[5] = { 0.2627, 0.6780, 0.0593, 1.8814, 1.4747 };
+
+static constexpr double kMpegRangeEff[3][2] = { { 255.0 / 219.0, -16.0 / 219.0 }, { 255.0 / 224.0, -128.0 / 224.0 }, { 255.0 / 224.0, -128.0 / 224.0 } };
+static constexpr double kJpegRangeEff[3][2] = { { 1, 0 }, { 1, -128.0 / 255.0 }, { 1, -128.0 / 255.0 } };
+
+static constexpr ColorMatrixTable kColorMatrixBT601M(kBT601Eff, kMpegRangeEff);
+static constexpr ColorMatrixTable kColorMatrixBT601J(kBT601Eff, kJpegRangeEff);
+static constexpr ColorMatrixTable kColorMatrixBT709M(kBT709Eff, kMpegRangeEff);
+static constexpr ColorMatrixTable kColorMatrixBT709J(kBT709Eff, kJpegRangeEff);
+static constexpr ColorMatrixTable kColorMatrixBT2020M(kBT2020Eff, kMpegRangeEff);
+static constexpr ColorMatrixTable kColorMatrixBT2020J(kBT2020Eff, kJpegRangeEff);
+
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+
+static constexpr int kPlaneAlignment = 64;
+
+//Box filter over blocks of 2^scale_shift pixels, every byte is averaged as its own component
+//Blocks past the right or bottom edge repeat the last pixel, sums is scratch space kept by the caller between frames
+void DownscalePlane(char *destination, const QSize &destination_size, const uint8_t *source, int source_line_size, const QSize &source_size, int bytes_per_pixel, int scale_shift, std::vector<uint32_t> &sums)
+{
+    const int block = 1 << scale_shift;
+    const int width = destination_size.width(), row_components = width * bytes_per_pixel;
+    //Only a last partial block needs its source column clamped
+    const int full_columns = std::min(width, source_size.width() >> scale_shift);
+    const int sum_shift = scale_shift * 2;
+    const uint32_t rounding = 1u << (sum_shift - 1);
+    if (sums.size() < static_cast<size_t>(row_components))
+        sums.resize(row_components);
+    for (int y = 0; y < destination_size.height(); ++y)
+    {
+        uint8_t *destination_row = reinterpret_cast<uint8_t *>(destination) + y * row_components;
+        int first_column = 0;
+        if (scale_shift == 1 && y * 2 + 1 < source_size.height())
+        {
+            //Common 2x2 case, averaged straight from two source rows
+            const uint8_t *row_0 = source + y * 2 * source_line_size, *row_1 = row_0 + source_line_size;
+            for (int x = 0; x < full_columns; ++x)
+            {
+                const int i = x * 2 * bytes_per_pixel;
+                for (int c = 0; c < bytes_per_pixel; ++c)
+                    destination_row[x * bytes_per_pixel + c] = static_cast<uint8_t>((row_0[i + c] + row_0[i + bytes_per_pixel + c] + row_1[i + c] + row_1[i + bytes_per_pixel + c] + 2) >> 2);
+            }
+            first_column = full_columns;
+        }
+        if (first_column == width)
+            continue;
+
+        uint32_t *row_sums = sums.data();
+        std::fill(row_sums + first_column * bytes_per_pixel, row_sums + row_components, 0);
+        for (int block_y = 0; block_y < block; ++block_y)
+        {
+            const uint8_t *source_row = source + std::min(y * block + block_y, source_size.height() - 1) * source_line_size;
+            for (int x = first_column; x < full_columns; ++x)
+            {
+                uint32_t *sum = row_sums + x * bytes_per_pixel;
+                const uint8_t *source_pixel = source_row + x * block * bytes_per_pixel;
+                for (int i = 0; i < block * bytes_per_pixel; i += bytes_per_pixel)
+                    for (int c = 0; c < bytes_per_pixel; ++c)
+                        sum[c] += source_pixel[i + c];
+            }
+            for (int x = std::max(first_column, full_columns); x < width; ++x)
+            {
+                uint32_t *sum = row_sums + x * bytes_per_pixel;
+                for (int block_x = 0; block_x < block; ++block_x)
+                {
+                    const uint8_t *source_pixel = source_row + std::min(x * block + block_x, source_size.width() - 1) * bytes_per_pixel;
+                    for (int c = 0; c < bytes_per_pixel; ++c)
+                        sum[c] += source_pixel[c];
+                }
+            }
+        }
+        for (int i = first_column * bytes_per_pixel; i < row_components; ++i)
+            destination_row[i] = static_cast<uint8_t>((row_sums[i] + rounding) >> sum_shift);
+    }
+}
+
+}
+
+bool VideoFrameUploadQueue::PixelUnpackBufferItem::IsCompatible(AVFrame *frame, int frame_scale_shift)
+{
+    if (source_size != QSize(frame->width, frame->height))
+        return false;
+    if (scale_shift != frame_scale_shift)
+        return false;
+    if (pixel_format != frame->format)
+        return false;
+    if (color_range != frame->color_range)
+        return false;
+    if (colorspace != frame->colorspace)
+        return false;
+    return true;
+}
+
+VideoFrameUploadQueue::VideoFrameUploadQueue()
+{
+    texture_buffers_empty_.resize(kQueueSize);
+}
+
+VideoFrameUploadQueue::~VideoFrameUploadQueue()
+{
+    ReleaseResources();
+}
+
+void VideoFrameUploadQueue::SetTargetSize(const QSize &target_size)
+{
+    if (DownscaleEnabled())
+        target_size_ = target_size;
+}
+
+void VideoFrameUploadQueue::AddVideoFrame(const QSharedPointer<VideoFrame> &frame)
+{
+    auto ritr = video_frames_.rbegin(), ritr_end = video_frames_.rend();
+    for (; ritr != ritr_end; ++ritr)
+        if ((*ritr)->present_time < frame->present_time)
+            break;
+    video_frames_.insert(ritr.base(), frame);
+    RemoveImpossibleFrame(PlaybackClock::now());
+}
+
+void VideoFrameUploadQueue::AddVideoFrames(std::vector<QSharedPointer<VideoFrame>> &&frames)
+{
+    for (auto &frame : frames)
+    {
+        auto ritr = video_frames_.rbegin(), ritr_end = video_frames_.rend();
+        for (; ritr != ritr_end; ++ritr)
+            if ((*ritr)->present_time < frame->present_time)
+                break;
+        video_frames_.insert(ritr.base(), std::move(frame));
+    }
+    RemoveImpossibleFrame(PlaybackClock::now());
+}
+
+VideoFrameUploadQueue::PixelUnpackBufferItem *VideoFrameUploadQueue::SelectPresentable(PlaybackClock::time_point present_time_limit)
+{
+    if (texture_buffers_uploaded_.empty() || texture_buffers_uploaded_.front().present_time > present_time_limit)
+        return nullptr;
+
+    auto texture_buffer_itr = texture_buffers_uploaded_.begin(), texture_buffer_itr_end = texture_buffers_uploaded_.end();
+    for (; texture_buffer_itr != texture_buffer_itr_end && texture_buffer_itr->present_time <= present_time_limit; ++texture_buffer_itr);
+
+    texture_buffers_used_.insert(texture_buffers_used_.end(), std::make_move_iterator(texture_buffers_uploaded_.begin()), std::make_move_iterator(texture_buffer_itr));
+    texture_buffers_uploaded_.erase(texture_buffers_uploaded_.begin(), texture_buffer_itr);
+    return &texture_buffers_used_.back();
+}
+
+VideoFrameUploadQueue::PixelUnpackBufferItem *VideoFrameUploadQueue::LastPresented()
+{
+    if (texture_buffers_used_.empty())
+        return nullptr;
+    return &texture_buffers_used_.back();
+}
+
+void VideoFrameUploadQueue::Upload(PlaybackClock::time_point current_time, PlaybackClock::duration vsync_interval)
+{
+    if (texture_buffers_used_.size() > kUsedQueueSize)
+    {
+        auto itr = texture_buffers_used_.begin(), itr_end = itr + texture_buffers_used_.size() - kUsedQueueSize;
+        texture_buffers_empty_.insert(texture_buffers_empty_.end(), std::make_move_iterator(itr), std::make_move_iterator(itr_end));
+        texture_buffers_used_.erase(itr, itr_end);
+    }
+
+    if (!buffer_storage_checked_)
+        InitBufferStorage();
+
+    RemoveImpossibleFrame(current_time);
+    int skipped_frames = RemoveHiddenFrames(video_frames_, current_time, vsync_interval);
+#ifdef _DEBUG
+    statistics_.skipped_frames += skipped_frames;
+#else
+    Q_UNUSED(skipped_frames);
+#endif
+    while (!video_frames_.empty() && !texture_buffers_empty_.empty())
+    {
+        auto &frame = video_frames_.front();
+        auto &buffer = texture_buffers_empty_.front();
+        Q_ASSERT(frame->present_time > current_time);
+        if (buffer.fence)
+        {
+            //Never block the render thread on the GPU, the frame stays queued until the buffer is free
+            QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+            if (f->glClientWaitSync(buffer.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            {
+#ifdef _DEBUG
+                statistics_.fence_stalls += 1;
+#endif
+                break;
+            }
+            f->glDeleteSync(buffer.fence);
+            buffer.fence = nullptr;
+        }
+        QSize source_size(frame->frame->width, frame->frame->height);
+        int scale_shift = ScaleShift(source_size, target_size_);
+        if (!buffer.IsCompatible(frame->frame.Get(), scale_shift))
+        {
+            buffer.source_size = source_size;
+            buffer.scale_shift = scale_shift;
+            buffer.frame_size = ScaledSize(source_size, scale_shift);
+            buffer.pixel_format = static_cast<AVPixelFormat>(frame->frame->format);
+            buffer.color_range = frame->frame->color_range;
+            buffer.colorspace = frame->frame->colorspace;
+            if (!InitPixelUnpackBuffer(buffer))
+            {
+                video_frames_.erase(video_frames_.begin());
+                continue;
+            }
+        }
+        buffer.present_time = frame->present_time;
+        if (!UpdatePixelUnpackBuffer(buffer, frame->frame.Get()))
+        {
+            video_frames_.erase(video_frames_.begin());
+            continue;
+        }
+
+        texture_buffers_uploaded_.push_back(std::move(buffer));
+        texture_buffers_empty_.erase(texture_buffers_empty_.begin());
+        video_frames_.erase(video_frames_.begin());
+    }
+}
+
+void VideoFrameUploadQueue::ReleaseResources()
+{
+    for (auto *queue : { &texture_buffers_uploaded_, &texture_buffers_empty_, &texture_buffers_used_ })
+        for (auto &buffer : *queue)
+            ReleasePixelUnpackBuffer(buffer);
+    texture_buffers_uploaded_.clear();
+    texture_buffers_empty_.clear();
+    texture_buffers_empty_.resize(kQueueSize);
+    texture_buffers_used_.clear();
+    buffer_storage_checked_ = false;
+    buffer_storage_ = nullptr;
+#if defined(_DEBUG) && !defined(QT_OPENGL_ES_2)
+    transfer_query_ = nullptr;
+    transfer_query_running_ = transfer_query_pending_ = false;
+#endif
+}
+
+void VideoFrameUploadQueue::BeginTransfer()
+{
+#if defined(_DEBUG) && !defined(QT_OPENGL_ES_2)
+    //Only one query in flight, results are collected without waiting so only some transfers are timed
+    if (!transfer_query_)
+    {
+        transfer_query_ = std::make_unique<QOpenGLTimerQuery>();
+        if (!transfer_query_->create())
+            qCDebug(CategoryVideoPlayback) << "Timer query not available";
+    }
+    if (!transfer_query_->isCreated())
+        return;
+    if (transfer_query_pending_)
+    {
+        if (!transfer_query_->isResultAvailable())
+            return;
+        statistics_.transfer_gpu_time += std::chrono::nanoseconds(transfer_query_->waitForResult());
+        statistics_.transfers_timed += 1;
+        transfer_query_pending_ = false;
+    }
+    transfer_query_->begin();
+    transfer_query_running_ = true;
+#endif
+}
+
+void VideoFrameUploadQueue::EndTransfer(PixelUnpackBufferItem &item)
+{
+#if defined(_DEBUG) && !defined(QT_OPENGL_ES_2)
+    if (transfer_query_running_)
+    {
+        transfer_query_->end();
+        transfer_query_running_ = false;
+        transfer_query_pending_ = true;
+    }
+#endif
+    if (!item.buffer_mapped)
+        return;
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    if (item.fence)
+        f->glDeleteSync(item.fence);
+    item.fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+#ifdef _DEBUG
+VideoFrameUploadQueue::UploadStatistics VideoFrameUploadQueue::TakeStatistics()
+{
+    UploadStatistics statistics = statistics_;
+    statistics_ = UploadStatistics();
+    return statistics;
+}
+#endif
+
+int VideoFrameUploadQueue::PlaneCount(AVPixelFormat pixel_format)
+{
+    switch (pixel_format)
+    {
+    case AV_PIX_FMT_RGB0:
+        return 1;
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+        return 2;
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ444P:
+        return 3;
+    default:
+        return 0;
+    }
+}
+
+QSize VideoFrameUploadQueue::PlaneSize(AVPixelFormat pixel_format, const QSize &frame_size, int plane)
+{
+    switch (pixel_format)
+    {
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+    case AV_PIX_FMT_YUV420P:
+    case AV_PIX_FMT_YUVJ420P:
+        if (plane > 0)
+            return QSize(DivideTwoRoundUp(frame_size.width()), DivideTwoRoundUp(frame_size.height()));
+        return frame_size;
+    default:
+        return frame_size;
+    }
+}
+
+int VideoFrameUploadQueue::PlaneBytesPerPixel(AVPixelFormat pixel_format, int plane)
+{
+    switch (pixel_format)
+    {
+    case AV_PIX_FMT_RGB0:
+        return 4 * sizeof(GLubyte);
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+        return (plane > 0 ? 2 : 1) * sizeof(GLubyte);
+    default:
+        return 1 * sizeof(GLubyte);
+    }
+}
+
+QMatrix4x4 VideoFrameUploadQueue::ColorMatrix(AVPixelFormat pixel_format, AVColorSpace colorspace, AVColorRange color_range)
+{
+    QMatrix4x4 color_matrix;
+    switch (colorspace)
+    {
+    case AVCOL_SPC_RGB:
+        color_matrix.setToIdentity();
+        break;
+    case AVCOL_SPC_BT2020_CL:
+    case AVCOL_SPC_BT2020_NCL:
+        color_matrix = QMatrix4x4(color_range == AVCOL_RANGE_JPEG ? kColorMatrixBT2020J.color_matrix : kColorMatrixBT2020M.color_matrix);
+        break;
+    case AVCOL_SPC_BT470BG:
+    case AVCOL_SPC_SMPTE170M:
+    case AVCOL_SPC_SMPTE240M:
+        color_matrix = QMatrix4x4(color_range == AVCOL_RANGE_JPEG ? kColorMatrixBT601J.color_matrix : kColorMatrixBT601M.color_matrix);
+        break;
+    case AVCOL_SPC_BT709:
+    default:
+        color_matrix = QMatrix4x4(color_range == AVCOL_RANGE_JPEG ? kColorMatrixBT709J.color_matrix : kColorMatrixBT709M.color_matrix);
+        break;
+    }
+    if (pixel_format == AV_PIX_FMT_NV21)
+    {
+        color_matrix = color_matrix * QMatrix4x4(
+                    1, 0, 0, 0,
+                    0, 0, 1, 0,
+                    0, 1, 0, 0,
+                    0, 0, 0, 1);
+    }
+    return color_matrix;
+}
+
+void VideoFrameUploadQueue::PlaneTextureFormat(AVPixelFormat pixel_format, int plane, QOpenGLTexture::TextureFormat &texture_format, QOpenGLTexture::PixelFormat &texture_pixel_format)
+{
+    switch (PlaneBytesPerPixel(pixel_format, plane))
+    {
+    case 4:
+        texture_format = QOpenGLTexture::RGBA8_UNorm;
+        texture_pixel_format = QOpenGLTexture::RGBA;
+        break;
+    case 2:
+        texture_format = QOpenGLTexture::RG8_UNorm;
+        texture_pixel_format = QOpenGLTexture::RG;
+        break;
+    default:
+        texture_format = QOpenGLTexture::R8_UNorm;
+        texture_pixel_format = QOpenGLTexture::Red;
+    }
+}
+
+int VideoFrameUploadQueue::PlaneOffsets(AVPixelFormat pixel_format, const QSize &frame_size, int (&plane_offsets)[kPlaneCount])
+{
+    int plane_count = PlaneCount(pixel_format);
+    int buffer_size = 0;
+    for (int i = 0; i < kPlaneCount; ++i)
+    {
+        plane_offsets[i] = buffer_size;
+        if (i >= plane_count)
+            continue;
+        QSize plane_size = PlaneSize(pixel_format, frame_size, i);
+        buffer_size += (plane_size.width() * plane_size.height() * PlaneBytesPerPixel(pixel_format, i) + kPlaneAlignment - 1) / kPlaneAlignment * kPlaneAlignment;
+    }
+    return buffer_size;
+}
+
+bool VideoFrameUploadQueue::DownscaleEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue("QDDM_DOWNSCALE_VIDEO") != 0;
+    return enabled;
+}
+
+int VideoFrameUploadQueue::ScaleShift(const QSize &source_size, const QSize &target_size)
+{
+    if (target_size.isEmpty())
+        return 0;
+    //Keep at least twice the target size so that linear filtering still has detail to work with
+    int scale_shift = 0;
+    while (scale_shift < kMaxScaleShift && (source_size.width() >> (scale_shift + 1)) >= target_size.width() * 2 && (source_size.height() >> (scale_shift + 1)) >= target_size.height() * 2)
+        scale_shift += 1;
+    return scale_shift;
+}
+
+QSize VideoFrameUploadQueue::ScaledSize(const QSize &source_size, int scale_shift)
+{
+    int rounding = (1 << scale_shift) - 1;
+    return QSize((source_size.width() + rounding) >> scale_shift, (source_size.height() + rounding) >> scale_shift);
+}
+
+void VideoFrameUploadQueue::CopyFrame(void *buffer_mapped, const int (&plane_offsets)[kPlaneCount], AVPixelFormat pixel_format, const QSize &frame_size, AVFrame *frame, int scale_shift, std::vector<uint32_t> &downscale_sums)
+{
+    int plane_count = PlaneCount(pixel_format);
+    QSize source_size(frame->width, frame->height);
+    for (int i = 0; i < plane_count; ++i)
+    {
+        QSize plane_size = PlaneSize(pixel_format, frame_size, i);
+        int bytes_per_pixel = PlaneBytesPerPixel(pixel_format, i);
+        char *destination = static_cast<char *>(buffer_mapped) + plane_offsets[i];
+        if (scale_shift == 0)
+            CopyPlane(destination, frame->data[i], frame->linesize[i], plane_size.width() * bytes_per_pixel, plane_size.height());
+        else
+            DownscalePlane(destination, plane_size, frame->data[i], frame->linesize[i], PlaneSize(pixel_format, source_size, i), bytes_per_pixel, scale_shift, downscale_sums);
+    }
+}
+
+int VideoFrameUploadQueue::TextureBytes(AVPixelFormat pixel_format, const QSize &frame_size)
+{
+    int plane_count = PlaneCount(pixel_format);
+    int bytes = 0;
+    for (int i = 0; i < plane_count; ++i)
+    {
+        QSize plane_size = PlaneSize(pixel_format, frame_size, i);
+        bytes += plane_size.width() * plane_size.height() * PlaneBytesPerPixel(pixel_format, i);
+    }
+    return bytes;
+}
+
+int VideoFrameUploadQueue::RemoveHiddenFrames(std::vector<QSharedPointer<VideoFrame>> &frames, PlaybackClock::time_point current_time, PlaybackClock::duration vsync_interval)
+{
+    if (vsync_interval <= PlaybackClock::duration::zero() || frames.size() < 2)
+        return 0;
+
+    //A frame is shown at the first vsync not before its present time, unless the next frame is due by then too
+    //The last frame is always kept since the frames after it are unknown
+    int removed = 0;
+    auto itr = frames.begin();
+    while (itr + 1 != frames.end())
+    {
+        auto vsync_count = ((*itr)->present_time - current_time + vsync_interval - PlaybackClock::duration(1)) / vsync_interval;
+        PlaybackClock::time_point shown_time = current_time + vsync_interval * vsync_count;
+        if ((*(itr + 1))->present_time <= shown_time)
+        {
+            itr = frames.erase(itr);
+            removed += 1;
+        }
+        else
+        {
+            ++itr;
+        }
+    }
+    return removed;
+}
+
+void VideoFrameUploadQueue::CopyPlane(void *buffer_mapped, const void *data, int line_size, int texture_line_size, int height)
+{
+    if (line_size == texture_line_size)
+    {
+        memcpy(buffer_mapped, data, line_size * height);
+    }
+    else
+    {
+        for (int i = 0; i < height; ++i)
+            memcpy(static_cast<char *>(buffer_mapped) + i * texture_line_size, static_cast<const char *>(data) + i * line_size, texture_line_size);
+    }
+}
+
+void VideoFrameUploadQueue::InitBufferStorage()
+{
+    buffer_storage_checked_ = true;
+    buffer_storage_ = nullptr;
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (context->isOpenGLES())
+    {
+        if (context->hasExtension(QByteArrayLiteral("GL_EXT_buffer_storage")))
+            buffer_storage_ = reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorageEXT"));
+    }
+    else
+    {
+        if (context->format().version() >= qMakePair(4, 4) || context->hasExtension(QByteArrayLiteral("GL_ARB_buffer_storage")))
+            buffer_storage_ = reinterpret_cast<BufferStorageFunction>(context->getProcAddress("glBufferStorage"));
+    }
+    qCDebug(CategoryVideoPlayback) << (buffer_storage_ ? "Using persistently mapped pixel unpack buffers" : "Using orphaned pixel unpack buffers");
+}
+
+bool VideoFrameUploadQueue::InitPixelUnpackBuffer(PixelUnpackBufferItem &item)
+{
+    int plane_count = PlaneCount(item.pixel_format);
+    if (plane_count == 0)
+    {
+        qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
+        return false;
+    }
+    int buffer_size = PlaneOffsets(item.pixel_format, item.frame_size, item.plane_offsets);
+
+    //Buffers are kept across format changes as long as they are large enough
+    if (item.buffer && item.buffer_capacity >= buffer_size)
+        return true;
+    ReleasePixelUnpackBuffer(item);
+
+    item.buffer = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::PixelUnpackBuffer);
+    item.buffer->setUsagePattern(QOpenGLBuffer::StreamDraw);
+    item.buffer->create();
+    item.buffer->bind();
+    if (buffer_storage_)
+    {
+        static constexpr GLbitfield kStorageFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+        buffer_storage_(GL_PIXEL_UNPACK_BUFFER, buffer_size, nullptr, kStorageFlags);
+        item.buffer_mapped = f->glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size, kStorageFlags);
+        if (!item.buffer_mapped)
+        {
+            qCWarning(CategoryVideoPlayback) << "Persistent mapping failed, falling back to orphaned pixel unpack buffers";
+            buffer_storage_ = nullptr;
+            item.buffer->release();
+            ReleasePixelUnpackBuffer(item);
+            return InitPixelUnpackBuffer(item);
+        }
+    }
+    else
+    {
+        item.buffer->allocate(buffer_size);
+    }
+    item.buffer->release();
+    item.buffer_capacity = buffer_size;
+    return true;
+}
+
+bool VideoFrameUploadQueue::UpdatePixelUnpackBuffer(PixelUnpackBufferItem &item, AVFrame *frame)
+{
+#ifdef _DEBUG
+    PlaybackClock::time_point copy_begin = PlaybackClock::now();
+#endif
+    int plane_count = PlaneCount(item.pixel_format);
+    if (plane_count == 0 || !item.buffer)
+        return false;
+    void *buffer_mapped = item.buffer_mapped;
+    if (!buffer_mapped)
+    {
+        //Orphan the old storage so that mapping doesn't wait for pending reads of the previous frame
+        item.buffer->bind();
+        item.buffer->allocate(item.buffer_capacity);
+        buffer_mapped = item.buffer->map(QOpenGLBuffer::WriteOnly);
+        if (!buffer_mapped)
+        {
+            item.buffer->release();
+            return false;
+        }
+    }
+    CopyFrame(buffer_mapped, item.plane_offsets, item.pixel_format, item.frame_size, frame, item.scale_shift, downscale_sums_);
+    if (!item.buffer_mapped)
+    {
+        item.buffer->unmap();
+        item.buffer->release();
+    }
+#ifdef _DEBUG
+    statistics_.copy_time += PlaybackClock::now() - copy_begin;
+    statistics_.copies += 1;
+#endif
+    return true;
+}
+
+void VideoFrameUploadQueue::ReleasePixelUnpackBuffer(PixelUnpackBufferItem &item)
+{
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    if (item.fence && context)
+        context->extraFunctions()->glDeleteSync(item.fence);
+    item.fence = nullptr;
+    item.buffer_mapped = nullptr; //Deleting the buffer unmaps it
+    item.buffer = nullptr;
+    item.buffer_capacity = 0;
+}
+
+void VideoFrameUploadQueue::RemoveImpossibleFrame(PlaybackClock::time_point current_time)
+{
+    auto itr_begin = video_frames_.begin(), itr_end = video_frames_.end();
+    auto itr = itr_begin;
+    for (; itr != itr_end; ++itr)
+        if ((*itr)->present_time > current_time)
+            break;
+#ifdef _DEBUG
+    if (itr != itr_begin)
+        qCDebug(CategoryVideoPlayback) << "Skipping " << itr - itr_begin << "impossible frame";
+#endif
+    video_frames_.erase(itr_begin, itr);
+}
@@ -0,0 +1,128 @@
+#ifndef VIDEOFRAMEUPLOADQUEUE_H
+#define VIDEOFRAMEUPLOADQUEUE_H
+
+#include "VideoFrame.h"
+
+Q_DECLARE_LOGGING_CATEGORY(CategoryVideoPlayback)
+
+//Pending frames of one stream and the pixel unpack buffers they are staged in before being copied into textures
+//Everything except the static helpers has to be used with the render thread's GL context current
+class VideoFrameUploadQueue
+{
+public:
+    static constexpr int kPlaneCount = 3;
+    //All planes share one buffer, with buffer storage it stays mapped and a fence guards reuse, otherwise it's orphaned on every write
+    struct PixelUnpackBufferItem
+    {
+        std::unique_ptr<QOpenGLBuffer> buffer;
+        int buffer_capacity = 0;
+        void *buffer_mapped = nullptr;
+        GLsync fence = nullptr;
+        int plane_offsets[kPlaneCount] = {};
+        PlaybackClock::time_point present_time;
+
+        QSize frame_size; //Size of the staged planes, source_size reduced by scale_shift
+        QSize source_size;
+        int scale_shift = 0;
+        AVPixelFormat pixel_format = AV_PIX_FMT_NONE;
+        AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+        AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED;
+
+        bool IsCompatible(AVFrame *frame, int frame_scale_shift);
+        //Offset to pass as the data pointer while buffer is bound
+        const void *PlaneData(int plane) const { return reinterpret_cast<const void *>(static_cast<uintptr_t>(plane_offsets[plane])); }
+    };
+
+    static constexpr size_t kQueueSize = 6;
+    static constexpr size_t kUsedQueueSize = 2;
+    static constexpr int kMaxScaleShift = 3;
+
+#ifdef _DEBUG
+    struct UploadStatistics
+    {
+        PlaybackClock::duration copy_time = PlaybackClock::duration::zero();
+        std::chrono::nanoseconds transfer_gpu_time = 0ns;
+        int copies = 0, transfers_timed = 0, fence_stalls = 0, skipped_frames = 0;
+    };
+#endif
+
+    VideoFrameUploadQueue();
+    ~VideoFrameUploadQueue();
+
+    //Frames are staged at 1/2, 1/4 or 1/8 size, the smallest that stays at least twice target_size, only with QDDM_DOWNSCALE_VIDEO=1
+    //So frames under 4 times target_size are kept as they are
+    void SetTargetSize(const QSize &target_size);
+
+    void AddVideoFrame(const QSharedPointer<VideoFrame> &frame);
+    void AddVideoFrames(std::vector<QSharedPointer<VideoFrame>> &&frames);
+
+    //Retires every uploaded buffer due by present_time_limit and returns the latest one, nullptr if none is due
+    //The returned buffer stays valid until the next Upload
+    PixelUnpackBufferItem *SelectPresentable(PlaybackClock::time_point present_time_limit);
+    //Buffer returned by the last SelectPresentable, for textures that have to be refilled
+    PixelUnpackBufferItem *LastPresented();
+    //Only frames that will be the latest due one at some vsync after current_time are staged
+    void Upload(PlaybackClock::time_point current_time, PlaybackClock::duration vsync_interval);
+    void ReleaseResources();
+
+    //Brackets the texture copies reading from item, which is not written again before the GPU is done with it
+    void BeginTransfer();
+    void EndTransfer(PixelUnpackBufferItem &item);
+
+    size_t PendingCount() const { return video_frames_.size(); }
+    size_t UploadedCount() const { return texture_buffers_uploaded_.size(); }
+    size_t UsedCount() const { return texture_buffers_used_.size(); }
+    size_t EmptyCount() const { return texture_buffers_empty_.size(); }
+    bool PersistentMapping() const { return buffer_storage_ != nullptr; }
+#ifdef _DEBUG
+    UploadStatistics TakeStatistics();
+#endif
+
+    //Plane layout of the supported pixel formats, 0 planes if unsupported
+    static int PlaneCount(AVPixelFormat pixel_format);
+    static QSize PlaneSize(AVPixelFormat pixel_format, const QSize &frame_size, int plane);
+    static int PlaneBytesPerPixel(AVPixelFormat pixel_format, int plane);
+    static QMatrix4x4 ColorMatrix(AVPixelFormat pixel_format, AVColorSpace colorspace, AVColorRange color_range);
+    static void PlaneTextureFormat(AVPixelFormat pixel_format, int plane, QOpenGLTexture::TextureFormat &texture_format, QOpenGLTexture::PixelFormat &texture_pixel_format);
+    //Lays out all planes in one buffer, returns the total size
+    static int PlaneOffsets(AVPixelFormat pixel_format, const QSize &frame_size, int (&plane_offsets)[kPlaneCount]);
+    //Drops sorted frames that are superseded before the vsync they would be shown at, returns the count dropped
+    static int RemoveHiddenFrames(std::vector<QSharedPointer<VideoFrame>> &frames, PlaybackClock::time_point current_time, PlaybackClock::duration vsync_interval);
+    static void CopyPlane(void *buffer_mapped, const void *data, int line_size, int texture_line_size, int height);
+
+    //Reduced-resolution staging, frame_size passed to the helpers below is always the reduced size
+    static bool DownscaleEnabled();
+    static int ScaleShift(const QSize &source_size, const QSize &target_size);
+    static QSize ScaledSize(const QSize &source_size, int scale_shift);
+    //downscale_sums is scratch space for downscaling, kept by the caller so it isn't allocated per frame
+    static void CopyFrame(void *buffer_mapped, const int (&plane_offsets)[kPlaneCount], AVPixelFormat pixel_format, const QSize &frame_size, AVFrame *frame, int scale_shift, std::vector<uint32_t> &downscale_sums);
+    //Bytes of texture memory for one frame
+    static int TextureBytes(AVPixelFormat pixel_format, const QSize &frame_size);
+private:
+    using BufferStorageFunction = void (QOPENGLF_APIENTRYP)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+
+    void InitBufferStorage();
+    bool InitPixelUnpackBuffer(PixelUnpackBufferItem &item);
+    bool UpdatePixelUnpackBuffer(PixelUnpackBufferItem &item, AVFrame *frame);
+    static void ReleasePixelUnpackBuffer(PixelUnpackBufferItem &item);
+
+    void RemoveImpossibleFrame(PlaybackClock::time_point current_time);
+
+    std::vector<QSharedPointer<VideoFrame>> video_frames_;
+    QSize target_size_;
+    std::vector<uint32_t> downscale_sums_;
+    std::vector<PixelUnpackBufferItem> texture_buffers_uploaded_, texture_buffers_empty_, texture_buffers_used_;
+
+    bool buffer_storage_checked_ = false;
+    BufferStorageFunction buffer_storage_ = nullptr;
+
+#ifdef _DEBUG
+    UploadStatistics statistics_;
+#if !defined(QT_OPENGL_ES_2)
+    std::unique_ptr<QOpenGLTimerQuery> transfer_query_;
+    bool transfer_query_running_ = false, transfer_query_pending_ = false;
+#endif
+#endif
+};
+
+#endif // VIDEOFRAMEUPLOADQUEUE_H
@@ -0,0 +1,449 @@
+#include "pch.h"
+#include "VideoFrameUploadWorker.h"
+
+namespace
+{
+
+static constexpr auto kRenderFenceTimeout = 4ms;
+static constexpr auto kRetryInterval = 2ms;
+
+void InsertReadySlot(std::vector<std::unique_ptr<VideoFrameTextureRing::Slot>> &ready_slots, std::unique_ptr<VideoFrameTextureRing::Slot> &&slot)
+{
+    auto itr = std::upper_bound(ready_slots.begin(), ready_slots.end(), slot->present_time, [](PlaybackClock::time_point present_time, const std::unique_ptr<VideoFrameTextureRing::Slot> &ready_slot) { return present_time < ready_slot->present_time; });
+    ready_slots.insert(itr, std::move(slot));
+}
+
+}
+
+VideoFrameTextureRing::VideoFrameTextureRing()
+{
+    for (size_t i = 0; i < kRingSize; ++i)
+        free_slots_.push_back(std::make_unique<Slot>());
+}
+
+bool VideoFrameTextureRing::PushFrame(const QSharedPointer<VideoFrame> &frame)
+{
+    QMutexLocker lock(&mutex_);
+    if (released_)
+        return false;
+    if (pending_frames_.size() >= kPendingLimit)
+        pending_frames_.erase(pending_frames_.begin());
+    pending_frames_.push_back(frame);
+    if (scheduled_)
+        return false;
+    scheduled_ = true;
+    return true;
+}
+
+void VideoFrameTextureRing::SetTargetSize(const QSize &target_size)
+{
+    if (!VideoFrameUploadQueue::DownscaleEnabled())
+        return;
+    QMutexLocker lock(&mutex_);
+    target_size_ = target_size;
+}
+
+bool VideoFrameTextureRing::SelectPresentable(PlaybackClock::time_point present_time_limit, PlaybackClock::duration vsync_interval, Presentable &presentable)
+{
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    QMutexLocker lock(&mutex_);
+    if (released_)
+        return false;
+    last_vsync_ = present_time_limit;
+    vsync_interval_ = vsync_interval;
+
+    auto itr_end = ready_slots_.begin();
+    while (itr_end != ready_slots_.end() && (*itr_end)->present_time <= present_time_limit)
+        ++itr_end;
+    if (itr_end == ready_slots_.begin())
+        return false;
+
+    //Skipped slots are never sampled
+    for (auto itr = ready_slots_.begin(); itr != itr_end - 1; ++itr)
+    {
+        f->glDeleteSync((*itr)->upload_fence);
+        (*itr)->upload_fence = nullptr;
+    }
+    used_slots_.insert(used_slots_.end(), std::make_move_iterator(ready_slots_.begin()), std::make_move_iterator(itr_end));
+    ready_slots_.erase(ready_slots_.begin(), itr_end);
+
+    //Commands sampling a retired slot are already issued, the worker waits for them before writing it
+    while (used_slots_.size() > kUsedRingSize)
+    {
+        std::unique_ptr<Slot> &slot = used_slots_.front();
+        if (slot->upload_fence)
+        {
+            f->glDeleteSync(slot->upload_fence);
+            slot->upload_fence = nullptr;
+        }
+        slot->render_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        free_slots_.push_back(std::move(slot));
+        used_slots_.erase(used_slots_.begin());
+    }
+
+    Slot &selected = *used_slots_.back();
+    std::copy(std::begin(selected.textures), std::end(selected.textures), std::begin(presentable.textures));
+    presentable.present_time = selected.present_time;
+    presentable.frame_size = selected.frame_size;
+    presentable.pixel_format = selected.pixel_format;
+    presentable.color_range = selected.color_range;
+    presentable.colorspace = selected.colorspace;
+    GLsync upload_fence = selected.upload_fence;
+    selected.upload_fence = nullptr;
+    lock.unlock();
+
+    if (upload_fence)
+    {
+        f->glWaitSync(upload_fence, 0, GL_TIMEOUT_IGNORED);
+        f->glDeleteSync(upload_fence);
+    }
+    return true;
+}
+
+VideoFrameUploadWorker::VideoFrameUploadWorker(QObject *parent)
+    :QObject(parent)
+{
+    surface_ = std::make_unique<QOffscreenSurface>();
+    surface_->setFormat(QSurfaceFormat::defaultFormat());
+    surface_->create();
+
+    thread_object_ = new QObject;
+    thread_object_->moveToThread(&thread_);
+    connect(&thread_, &QThread::finished, thread_object_, &QObject::deleteLater);
+    connect(&thread_, &QThread::finished, this, [this]()
+    {
+        QMutexLocker lock(&mutex_);
+        if (context_)
+        {
+            context_->doneCurrent();
+            context_->moveToThread(QCoreApplication::instance()->thread());
+        }
+    }, Qt::DirectConnection);
+    thread_.setObjectName("VideoFrameUploadWorker");
+    thread_.start();
+}
+
+VideoFrameUploadWorker::~VideoFrameUploadWorker()
+{
+    thread_.exit();
+    thread_.wait();
+    context_ = nullptr;
+    surface_ = nullptr;
+}
+
+VideoFrameUploadWorker *VideoFrameUploadWorker::Instance()
+{
+    static VideoFrameUploadWorker *instance = qEnvironmentVariableIntValue("QDDM_UPLOAD_THREAD") != 0 ? new VideoFrameUploadWorker(QCoreApplication::instance()) : nullptr;
+    return instance;
+}
+
+void VideoFrameUploadWorker::InitContext(QOpenGLContext *share_context)
+{
+    QMutexLocker lock(&mutex_);
+    if (context_ || context_failed_ || !share_context)
+        return;
+
+    auto context = std::make_unique<QOpenGLContext>();
+    context->setFormat(share_context->format());
+    context->setShareContext(share_context);
+    context->setScreen(share_context->screen());
+    if (!context->create() || !context->shareContext())
+    {
+        qCWarning(CategoryVideoPlayback) << "Failed to create upload context, uploading on the render thread";
+        context_failed_ = true;
+        return;
+    }
+    if (!context->hasExtension("GL_ARB_sync") && context->format().majorVersion() < 3)
+    {
+        qCWarning(CategoryVideoPlayback) << "Sync objects not supported, uploading on the render thread";
+        context_failed_ = true;
+        return;
+    }
+    context->moveToThread(&thread_);
+    context_ = std::move(context);
+}
+
+bool VideoFrameUploadWorker::IsAvailable()
+{
+    QMutexLocker lock(&mutex_);
+    return context_ != nullptr;
+}
+
+void VideoFrameUploadWorker::Schedule(const QSharedPointer<VideoFrameTextureRing> &ring)
+{
+    QMutexLocker lock(&mutex_);
+    bool idle = scheduled_rings_.empty();
+    scheduled_rings_.push_back(ring);
+    if (idle)
+        QMetaObject::invokeMethod(thread_object_, [this]() { OnSchedule(); }, Qt::QueuedConnection);
+}
+
+void VideoFrameUploadWorker::Release(const QSharedPointer<VideoFrameTextureRing> &ring)
+{
+    QMutexLocker lock(&mutex_);
+    bool idle = released_rings_.empty();
+    released_rings_.push_back(ring);
+    if (idle)
+        QMetaObject::invokeMethod(thread_object_, [this]() { OnRelease(); }, Qt::QueuedConnection);
+}
+
+void VideoFrameUploadWorker::OnSchedule()
+{
+    std::vector<QSharedPointer<VideoFrameTextureRing>> rings;
+    {
+        QMutexLocker lock(&mutex_);
+        rings.swap(scheduled_rings_);
+    }
+    if (!MakeCurrent())
+        return;
+
+    std::vector<QSharedPointer<VideoFrameTextureRing>> stalled_rings;
+    for (const auto &ring : rings)
+        if (!Upload(*ring))
+            stalled_rings.push_back(ring);
+
+    //Rings without a free slot wait for the render thread to retire one
+    if (!stalled_rings.empty())
+    {
+        QMutexLocker lock(&mutex_);
+        bool idle = scheduled_rings_.empty();
+        scheduled_rings_.insert(scheduled_rings_.end(), stalled_rings.begin(), stalled_rings.end());
+        if (idle)
+            QTimer::singleShot(kRetryInterval, thread_object_, [this]() { OnSchedule(); });
+    }
+
+#ifdef _DEBUG
+    PlaybackClock::time_point current_time = PlaybackClock::now();
+    if (current_time - last_debug_report_ > std::chrono::seconds(1))
+    {
+        last_debug_report_ = current_time;
+        if (uploads_ > 0)
+            qCDebug(CategoryVideoPlayback) << std::chrono::duration_cast<std::chrono::microseconds>(upload_time_).count() / uploads_ << "us average worker upload time," << std::chrono::duration_cast<std::chrono::microseconds>(max_upload_time_).count() << "us max";
+        qCDebug(CategoryVideoPlayback) << uploads_ << " worker uploads";
+        qCDebug(CategoryVideoPlayback) << render_fence_waits_ << " worker uploads deferred by render fences";
+        qCDebug(CategoryVideoPlayback) << skipped_frames_ << " frames skipped before worker upload";
+        upload_time_ = max_upload_time_ = PlaybackClock::duration::zero();
+        uploads_ = render_fence_waits_ = skipped_frames_ = 0;
+    }
+#endif
+}
+
+void VideoFrameUploadWorker::OnRelease()
+{
+    std::vector<QSharedPointer<VideoFrameTextureRing>> rings;
+    {
+        QMutexLocker lock(&mutex_);
+        rings.swap(released_rings_);
+    }
+    bool current = MakeCurrent();
+
+    for (const auto &ring : rings)
+    {
+        QMutexLocker lock(&ring->mutex_);
+        ring->released_ = true;
+        ring->pending_frames_.clear();
+        if (!current)
+            continue;
+        //Slots themselves are freed with the ring, the render node may still hold it
+        for (auto slots : { &ring->free_slots_, &ring->ready_slots_, &ring->used_slots_ })
+            for (auto &slot : *slots)
+                ReleaseSlot(*slot);
+    }
+}
+
+bool VideoFrameUploadWorker::MakeCurrent()
+{
+    if (context_current_)
+        return true;
+    QMutexLocker lock(&mutex_);
+    if (!context_)
+        return false;
+    if (!context_->makeCurrent(surface_.get()))
+    {
+        qCWarning(CategoryVideoPlayback) << "Failed to make upload context current";
+        return false;
+    }
+    context_current_ = true;
+    return true;
+}
+
+bool VideoFrameUploadWorker::Upload(VideoFrameTextureRing &ring)
+{
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    while (true)
+    {
+        QSharedPointer<VideoFrame> frame;
+        std::unique_ptr<VideoFrameTextureRing::Slot> slot;
+        int scale_shift = 0;
+        {
+            QMutexLocker lock(&ring.mutex_);
+            //Frames already late or superseded before their vsync would be skipped by the render thread anyway
+            PlaybackClock::time_point current_time = PlaybackClock::now();
+            while (ring.pending_frames_.size() > 1 && ring.pending_frames_[1]->present_time <= current_time)
+            {
+                ring.pending_frames_.erase(ring.pending_frames_.begin());
+#ifdef _DEBUG
+                skipped_frames_ += 1;
+#endif
+            }
+            if (ring.vsync_interval_ > PlaybackClock::duration::zero())
+            {
+                PlaybackClock::time_point vsync_time = ring.last_vsync_;
+                if (vsync_time < current_time)
+                    vsync_time += (current_time - vsync_time) / ring.vsync_interval_ * ring.vsync_interval_;
+                int skipped_frames = VideoFrameUploadQueue::RemoveHiddenFrames(ring.pending_frames_, vsync_time, ring.vsync_interval_);
+#ifdef _DEBUG
+                skipped_frames_ += skipped_frames;
+#else
+                Q_UNUSED(skipped_frames);
+#endif
+            }
+            if (ring.released_ || ring.pending_frames_.empty())
+            {
+                ring.scheduled_ = false;
+                return true;
+            }
+            if (ring.free_slots_.empty())
+                return false;
+            slot = std::move(ring.free_slots_.front());
+            ring.free_slots_.erase(ring.free_slots_.begin());
+            frame = ring.pending_frames_.front();
+            scale_shift = VideoFrameUploadQueue::ScaleShift(QSize(frame->frame->width, frame->frame->height), ring.target_size_);
+        }
+
+        if (slot->render_fence)
+        {
+            GLenum result = f->glClientWaitSync(slot->render_fence, GL_SYNC_FLUSH_COMMANDS_BIT, std::chrono::duration_cast<std::chrono::nanoseconds>(kRenderFenceTimeout).count());
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+#ifdef _DEBUG
+                render_fence_waits_ += 1;
+#endif
+                QMutexLocker lock(&ring.mutex_);
+                ring.free_slots_.insert(ring.free_slots_.begin(), std::move(slot));
+                return false;
+            }
+            f->glDeleteSync(slot->render_fence);
+            slot->render_fence = nullptr;
+        }
+
+        bool uploaded = UploadSlot(*slot, frame->frame.Get(), scale_shift);
+        slot->present_time = frame->present_time;
+
+        QMutexLocker lock(&ring.mutex_);
+        if (!ring.pending_frames_.empty() && ring.pending_frames_.front() == frame)
+            ring.pending_frames_.erase(ring.pending_frames_.begin());
+        if (ring.released_)
+            ReleaseSlot(*slot);
+        if (uploaded && !ring.released_)
+            InsertReadySlot(ring.ready_slots_, std::move(slot));
+        else
+            ring.free_slots_.push_back(std::move(slot));
+    }
+}
+
+bool VideoFrameUploadWorker::UploadSlot(VideoFrameTextureRing::Slot &slot, AVFrame *frame, int scale_shift)
+{
+#ifdef _DEBUG
+    PlaybackClock::time_point upload_begin = PlaybackClock::now();
+#endif
+
+    AVPixelFormat pixel_format = static_cast<AVPixelFormat>(frame->format);
+    int plane_count = VideoFrameUploadQueue::PlaneCount(pixel_format);
+    if (plane_count == 0)
+    {
+        qCWarning(CategoryVideoPlayback) << "Unsupported pixel format";
+        return false;
+    }
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    QSize frame_size = VideoFrameUploadQueue::ScaledSize(QSize(frame->width, frame->height), scale_shift);
+
+    if (slot.frame_size != frame_size || slot.pixel_format != pixel_format)
+    {
+        f->glDeleteTextures(VideoFrameTextureRing::kPlaneCount, slot.textures);
+        std::fill(std::begin(slot.textures), std::end(slot.textures), 0);
+        slot.frame_size = frame_size;
+        slot.pixel_format = pixel_format;
+
+        for (int i = 0; i < plane_count; ++i)
+        {
+            QOpenGLTexture::TextureFormat texture_format;
+            QOpenGLTexture::PixelFormat texture_pixel_format;
+            VideoFrameUploadQueue::PlaneTextureFormat(pixel_format, i, texture_format, texture_pixel_format);
+            QSize plane_size = VideoFrameUploadQueue::PlaneSize(pixel_format, frame_size, i);
+
+            f->glGenTextures(1, &slot.textures[i]);
+            f->glBindTexture(GL_TEXTURE_2D, slot.textures[i]);
+            f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            f->glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(texture_format), plane_size.width(), plane_size.height(), 0, static_cast<GLenum>(texture_pixel_format), GL_UNSIGNED_BYTE, nullptr);
+        }
+        f->glBindTexture(GL_TEXTURE_2D, 0);
+
+        int buffer_size = VideoFrameUploadQueue::PlaneOffsets(pixel_format, frame_size, slot.plane_offsets);
+        if (!slot.buffer || slot.buffer_capacity < buffer_size)
+        {
+            slot.buffer = std::make_unique<QOpenGLBuffer>(QOpenGLBuffer::PixelUnpackBuffer);
+            slot.buffer->setUsagePattern(QOpenGLBuffer::StreamDraw);
+            slot.buffer->create();
+            slot.buffer_capacity = buffer_size;
+        }
+    }
+    slot.color_range = frame->color_range;
+    slot.colorspace = frame->colorspace;
+
+    slot.buffer->bind();
+    slot.buffer->allocate(slot.buffer_capacity); //Orphan, the previous contents may still be read by an earlier transfer
+    void *buffer_mapped = slot.buffer->mapRange(0, slot.buffer_capacity, QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidateBuffer);
+    if (!buffer_mapped)
+    {
+        qCWarning(CategoryVideoPlayback) << "Failed to map upload buffer";
+        slot.buffer->release();
+        return false;
+    }
+    VideoFrameUploadQueue::CopyFrame(buffer_mapped, slot.plane_offsets, pixel_format, frame_size, frame, scale_shift, downscale_sums_);
+    slot.buffer->unmap();
+
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < plane_count; ++i)
+    {
+        QOpenGLTexture::TextureFormat texture_format;
+        QOpenGLTexture::PixelFormat texture_pixel_format;
+        VideoFrameUploadQueue::PlaneTextureFormat(pixel_format, i, texture_format, texture_pixel_format);
+        QSize plane_size = VideoFrameUploadQueue::PlaneSize(pixel_format, frame_size, i);
+
+        f->glBindTexture(GL_TEXTURE_2D, slot.textures[i]);
+        f->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, plane_size.width(), plane_size.height(), static_cast<GLenum>(texture_pixel_format), GL_UNSIGNED_BYTE, reinterpret_cast<const void *>(static_cast<uintptr_t>(slot.plane_offsets[i])));
+    }
+    f->glBindTexture(GL_TEXTURE_2D, 0);
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    slot.buffer->release();
+
+    //The render thread waits on this fence on the GPU before sampling, the flush makes it visible to the other context
+    slot.upload_fence = f->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    f->glFlush();
+
+#ifdef _DEBUG
+    auto upload_time = PlaybackClock::now() - upload_begin;
+    upload_time_ += upload_time;
+    if (upload_time > max_upload_time_)
+        max_upload_time_ = upload_time;
+    uploads_ += 1;
+#endif
+    return true;
+}
+
+void VideoFrameUploadWorker::ReleaseSlot(VideoFrameTextureRing::Slot &slot)
+{
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    f->glDeleteTextures(VideoFrameTextureRing::kPlaneCount, slot.textures);
+    std::fill(std::begin(slot.textures), std::end(slot.textures), 0);
+    if (slot.upload_fence)
+        f->glDeleteSync(slot.upload_fence);
+    if (slot.render_fence)
+        f->glDeleteSync(slot.render_fence);
+    slot.upload_fence = slot.render_fence = nullptr;
+    slot.buffer = nullptr;
+}
@@ -0,0 +1,112 @@
+#ifndef VIDEOFRAMEUPLOADWORKER_H
+#define VIDEOFRAMEUPLOADWORKER_H
+
+#include "VideoFrameUploadQueue.h"
+
+//Textures of one view, filled by VideoFrameUploadWorker and sampled by VideoFrameRenderNodeOGL
+//Each slot goes free -> ready (worker) -> used (render thread) -> free, a fence guards every hand-over between the two contexts
+class VideoFrameTextureRing
+{
+public:
+    static constexpr int kPlaneCount = VideoFrameUploadQueue::kPlaneCount;
+    static constexpr size_t kRingSize = 6;
+    static constexpr size_t kUsedRingSize = 2;
+    static constexpr size_t kPendingLimit = 8;
+
+    struct Slot
+    {
+        GLuint textures[kPlaneCount] = {};
+        std::unique_ptr<QOpenGLBuffer> buffer;
+        int buffer_capacity = 0;
+        int plane_offsets[kPlaneCount] = {};
+        GLsync upload_fence = nullptr, render_fence = nullptr;
+        PlaybackClock::time_point present_time;
+
+        QSize frame_size;
+        AVPixelFormat pixel_format = AV_PIX_FMT_NONE;
+        AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+        AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED;
+    };
+
+    //Copy of the slot to draw, its textures are not written before the slot is retired by a later selection
+    struct Presentable
+    {
+        GLuint textures[kPlaneCount] = {};
+        PlaybackClock::time_point present_time;
+
+        QSize frame_size;
+        AVPixelFormat pixel_format = AV_PIX_FMT_NONE;
+        AVColorRange color_range = AVCOL_RANGE_UNSPECIFIED;
+        AVColorSpace colorspace = AVCOL_SPC_UNSPECIFIED;
+    };
+
+    VideoFrameTextureRing();
+
+    //See VideoFrameUploadQueue::SetTargetSize
+    void SetTargetSize(const QSize &target_size);
+
+    //Returns true if the ring went from idle to having work for the worker
+    bool PushFrame(const QSharedPointer<VideoFrame> &frame);
+
+    //Render thread, present_time_limit is the current vsync, retires every ready slot due by it and returns false if none is due
+    bool SelectPresentable(PlaybackClock::time_point present_time_limit, PlaybackClock::duration vsync_interval, Presentable &presentable);
+private:
+    friend class VideoFrameUploadWorker;
+
+    QMutex mutex_;
+    std::vector<QSharedPointer<VideoFrame>> pending_frames_;
+    std::vector<std::unique_ptr<Slot>> free_slots_, ready_slots_, used_slots_;
+    bool scheduled_ = false, released_ = false;
+    //Vsync timing of the last selection, frames that would be superseded before being shown are not uploaded
+    PlaybackClock::time_point last_vsync_;
+    PlaybackClock::duration vsync_interval_ = PlaybackClock::duration::zero();
+    QSize target_size_;
+};
+
+//Uploads frames on its own thread through a context shared with the scene graph, so render() only selects a texture and draws
+//Enabled with QDDM_UPLOAD_THREAD=1, the context is created the first time a view synchronizes
+class VideoFrameUploadWorker : public QObject
+{
+    Q_OBJECT
+
+    explicit VideoFrameUploadWorker(QObject *parent = nullptr);
+public:
+    ~VideoFrameUploadWorker();
+
+    //GUI thread, nullptr if disabled
+    static VideoFrameUploadWorker *Instance();
+
+    //Render thread with the scene graph context current
+    void InitContext(QOpenGLContext *share_context);
+    bool IsAvailable();
+
+    //GUI or render thread
+    void Schedule(const QSharedPointer<VideoFrameTextureRing> &ring);
+    void Release(const QSharedPointer<VideoFrameTextureRing> &ring);
+private:
+    void OnSchedule();
+    void OnRelease();
+    bool MakeCurrent();
+    //Returns false if the ring ran out of free slots before its pending frames
+    bool Upload(VideoFrameTextureRing &ring);
+    bool UploadSlot(VideoFrameTextureRing::Slot &slot, AVFrame *frame, int scale_shift);
+    void ReleaseSlot(VideoFrameTextureRing::Slot &slot);
+
+    QThread thread_;
+    QObject *thread_object_ = nullptr; //Lives in thread_, target of queued calls
+    std::unique_ptr<QOffscreenSurface> surface_;
+
+    QMutex mutex_;
+    std::unique_ptr<QOpenGLContext> context_;
+    bool context_failed_ = false, context_current_ = false;
+    std::vector<QSharedPointer<VideoFrameTextureRing>> scheduled_rings_, released_rings_;
+    std::vector<uint32_t> downscale_sums_; //Only used on thread_
+
+#ifdef _DEBUG
+    PlaybackClock::time_point last_debug_report_;
+    PlaybackClock::duration upload_time_ = PlaybackClock::duration::zero(), max_upload_time_ = PlaybackClock::duration::zero();
+    int uploads_ = 0, render_fence_waits_ = 0, skipped_frames_ = 0;
+#endif
+};
+
+#endif // VIDEOFRAMEUPLOADWORKER_H
@@ -8,6 +8,7 @@
 #include "LiveStreamSubtitleOverlay.h"
 #include "FixedGridLayout.h"
 #include "AudioOutput.h"
+#include "VideoFrameRenderNodeSW.h"
 
 #include <QLoggingCategory>
 #include <QTranslator>
@@ -16,7 +17,9 @@ int main(int argc, char *argv[])
 {
     qRegisterMetaType<const AVCodecContext *>();
     qRegisterMetaType<QSharedPointer<AudioFrame>>();
+    qRegisterMetaType<QSharedPointer<AudioFrameQueue>>();
     qRegisterMetaType<QSharedPointer<VideoFrame>>();
+    qRegisterMetaType<QSharedPointer<VideoFrameQueue>>();
     qRegisterMetaType<QSharedPointer<SubtitleFrame>>();
 
 #if (QT_VERSION >= QT_VERSION_CHECK(5, 14, 0))
@@ -51,10 +54,15 @@ int main(int argc, char *argv[])
                                      //"qddm.audio=false\n"
                                      //"qddm.decode=false\n"
                                      "qddm.sourcectrl=false\n"
+                                     "qddm.subtitle=false\n"
+                                     //"qddm.source=false\n"
                                      //"qt.scenegraph.general=true"
                                      );
 
     QQmlApplicationEngine engine;
+    //Draw all tiles with one node owned by the grid layout, needs OpenGL 3.3 or OpenGL ES 3.0
+    bool batched_video = qEnvironmentVariableIntValue("QDDM_BATCHED_VIDEO") != 0 && !VideoFrameRenderNodeSW::Forced() && QQuickWindow::sceneGraphBackend() != QLatin1String("software");
+    engine.rootContext()->setContextProperty("batchedVideoRendering", batched_video);
 
     const QUrl url(QStringLiteral("qrc:/main.qml"));
     QObject::connect(&engine, &QQmlApplicationEngine::objectCreated,
@@ -186,6 +186,8 @@ Window {
                     rows: viewModelMain.rows
                     columns: viewModelMain.columns
 
+                    batchedVideo: batchedVideoRendering && (GraphicsInfo.majorVersion > 3 || (GraphicsInfo.majorVersion === 3 && (GraphicsInfo.minorVersion >= 3 || GraphicsInfo.renderableType === GraphicsInfo.SurfaceFormatOpenGLES)))
+
                     Repeater {
                         id: repeaterViews
 
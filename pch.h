@@ -7,13 +7,18 @@
 #include <limits>
 #include <type_traits>
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
 #include <memory>
 #include <stdexcept>
 using namespace std::chrono_literals;
 
+#include <iterator>
 #include <vector>
+#include <deque>
+#include <queue>
+#include <functional>
 #include <unordered_set>
 #include <unordered_map>
 #include <string>
@@ -30,6 +35,7 @@ using namespace std::chrono_literals;
 #include <QMutexLocker>
 #include <QThread>
 #include <QSharedPointer>
+#include <QPointer>
 #include <QUrl>
 #include <QUrlQuery>
 
@@ -46,6 +52,8 @@ using namespace std::chrono_literals;
 #include <QNetworkRequest>
 #include <QTimer>
 #include <QPainter>
+#include <QPainterPath>
+#include <QFontMetricsF>
 #include <QScreen>
 #include <QStandardPaths>
 #include <QStaticText>
@@ -56,15 +64,25 @@ using namespace std::chrono_literals;
 #include <QQuickItem>
 #include <QQuickPaintedItem>
 #include <QSGRenderNode>
+#include <QSGImageNode>
+#include <QSGRendererInterface>
 
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 
 #include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
 #include <QOpenGLBuffer>
 #include <QOpenGLTexture>
 #include <QOpenGLPixelTransferOptions>
 #include <QOpenGLShaderProgram>
+#include <QOpenGLTimerQuery>
+#include <QOffscreenSurface>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QDDM_SSE2
+#include <emmintrin.h>
+#endif
 
 #include <zlib.h>
 
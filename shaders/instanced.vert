@@ -0,0 +1,19 @@
+uniform highp mat4 matrix;
+uniform highp vec4 layerPlaneSize;
+in highp vec2 cornerIn;
+in highp vec4 rectIn;
+in highp vec4 planeSizeIn;
+in highp float layerIn;
+out highp vec4 texCoord;
+out highp vec4 texCoordMax;
+out highp float texLayer;
+
+//Sizes are in texels, luma plane in xy and chroma planes in zw
+//Layers can be larger than the frame in them, coordinates are clamped to the centre of the frame's last texels so linear filtering doesn't blend in what's past them
+void main()
+{
+    gl_Position = matrix * vec4(rectIn.xy + cornerIn * rectIn.zw, 0.0, 1.0);
+    texCoord = cornerIn.xyxy * planeSizeIn / layerPlaneSize;
+    texCoordMax = (planeSizeIn - 0.5) / layerPlaneSize;
+    texLayer = layerIn;
+}
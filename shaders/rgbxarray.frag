@@ -0,0 +1,12 @@
+precision mediump float;
+uniform mediump sampler2DArray texture0;
+uniform lowp float opacity;
+in highp vec4 texCoord;
+in highp vec4 texCoordMax;
+in highp float texLayer;
+out lowp vec4 fragColor;
+
+void main(void)
+{
+    fragColor = vec4(texture(texture0, vec3(min(texCoord.xy, texCoordMax.xy), texLayer)).rgb, 1.0) * opacity;
+}
@@ -0,0 +1,18 @@
+precision mediump float;
+uniform mediump sampler2DArray texture0;
+uniform mediump sampler2DArray texture1;
+uniform mediump mat4 colorMatrix;
+uniform lowp float opacity;
+in highp vec4 texCoord;
+in highp vec4 texCoordMax;
+in highp float texLayer;
+out lowp vec4 fragColor;
+
+void main()
+{
+    mediump float Y = texture(texture0, vec3(min(texCoord.xy, texCoordMax.xy), texLayer)).r;
+    mediump vec2 UV = texture(texture1, vec3(min(texCoord.zw, texCoordMax.zw), texLayer)).rg;
+    mediump vec4 colorYUV = vec4(Y, UV, 1.0);
+    mediump vec4 colorRGB = colorMatrix * colorYUV;
+    fragColor = vec4(colorRGB.rgb, 1.0) * opacity;
+}
@@ -0,0 +1,20 @@
+precision mediump float;
+uniform mediump sampler2DArray texture0;
+uniform mediump sampler2DArray texture1;
+uniform mediump sampler2DArray texture2;
+uniform mediump mat4 colorMatrix;
+uniform lowp float opacity;
+in highp vec4 texCoord;
+in highp vec4 texCoordMax;
+in highp float texLayer;
+out lowp vec4 fragColor;
+
+void main()
+{
+    mediump float Y = texture(texture0, vec3(min(texCoord.xy, texCoordMax.xy), texLayer)).r;
+    mediump float U = texture(texture1, vec3(min(texCoord.zw, texCoordMax.zw), texLayer)).r;
+    mediump float V = texture(texture2, vec3(min(texCoord.zw, texCoordMax.zw), texLayer)).r;
+    mediump vec4 colorYUV = vec4(Y, U, V, 1.0);
+    mediump vec4 colorRGB = colorMatrix * colorYUV;
+    fragColor = vec4(colorRGB.rgb, 1.0) * opacity;
+}